@@ -14,7 +14,64 @@
   #define NES_API
 #endif
 
+// Vectorized environment
+// Owns many instances of one game and steps them all in one call, writing
+// observations into caller provided buffers. Meant for training agents.
+struct NesVecEnvConfig
+{
+    const char* romPath;
+
+    // Save state file (F1) every episode starts from, null to start from power on
+    const char* statePath;
+
+    unsigned int count;
+
+    // Worker threads, 0 for one per hardware thread
+    unsigned int threads;
+
+    // Frames per step, all with the same action. At least 1.
+    unsigned int frameSkip;
+
+    // The screen is shrunk by 1, 2 or 4 in each direction by averaging,
+    // and is RGB or, with grayscale set, one byte of luma per pixel
+    unsigned int downsample;
+    bool grayscale;
+
+    // Work ram bytes ($0000-$1fff) copied out with each observation
+    const unsigned short* ramAddresses;
+    unsigned int ramAddressCount;
+
+    // An episode ends after this many frames, 0 for no limit
+    unsigned int maxEpisodeFrames;
+
+    // An episode also ends when (ram[doneAddress] & doneMask) == doneValue.
+    // A doneMask of 0 turns this off.
+    unsigned short doneAddress;
+    unsigned char doneMask;
+    unsigned char doneValue;
+};
+
+typedef struct NesVecEnv NesVecEnv;
+
 extern "C"
 {
     NES_API bool Nes_Create(const char* romPath, IAudioProvider* audioProvider, INes** ines);
+
+    // returns: null if the rom, state file or config is bad
+    NES_API NesVecEnv* NesVecEnv_Create(const NesVecEnvConfig* config);
+    NES_API void NesVecEnv_Destroy(NesVecEnv* env);
+
+    // Bytes of observation per instance
+    NES_API unsigned int NesVecEnv_ObservationSize(NesVecEnv* env);
+
+    // Start a new episode on every instance.
+    // observations: count * NesVecEnv_ObservationSize bytes
+    // ram: count * ramAddressCount bytes, may be null
+    NES_API void NesVecEnv_Reset(NesVecEnv* env, unsigned char* observations, unsigned char* ram);
+
+    // Run every instance for frameSkip frames.
+    // actions: one NesButtons byte per instance
+    // done: one byte per instance, 1 where an episode ended. That instance has
+    // already been reset and its observation is from the new episode. May be null.
+    NES_API void NesVecEnv_Step(NesVecEnv* env, const unsigned char* actions, unsigned char* observations, unsigned char* ram, unsigned char* done);
 }
\ No newline at end of file
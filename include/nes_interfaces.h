@@ -37,8 +37,103 @@ struct IWriteStream : public IBaseInterface
 struct IRomFile : public IBaseInterface
 {
     virtual bool GetRomFileStream(IReadStream** stream) = 0;
+
+    // Battery backed ram and save states
+    // These are called from a background thread. Returning false means there is
+    // nowhere to keep the data. A write stream's data should only replace the old
+    // data once the stream is released, so that a crash never leaves half a file.
     virtual bool GetSaveGameStream(IWriteStream** stream) = 0;
     virtual bool GetLoadGameStream(IReadStream** stream) = 0;
+    virtual bool GetSaveStateStream(IWriteStream** stream) = 0;
+    virtual bool GetLoadStateStream(IReadStream** stream) = 0;
+};
+
+// Standard controller buttons packed into a byte, in the order the controller reports them
+enum NesButtons
+{
+    NES_BUTTON_A = 1 << 0,
+    NES_BUTTON_B = 1 << 1,
+    NES_BUTTON_SELECT = 1 << 2,
+    NES_BUTTON_START = 1 << 3,
+    NES_BUTTON_UP = 1 << 4,
+    NES_BUTTON_DOWN = 1 << 5,
+    NES_BUTTON_LEFT = 1 << 6,
+    NES_BUTTON_RIGHT = 1 << 7,
+};
+
+// Flags for INes::DoFrame
+enum NesFrameFlags
+{
+    NES_FRAME_DEFAULT = 0,
+    NES_FRAME_NO_RENDER = 1 << 0, // Don't write pixels, screen may be null
+    NES_FRAME_NO_AUDIO = 1 << 1, // Don't send this frame to the audio provider
+};
+
+// Receives the frames INes::RunFrames keeps (implemented by host)
+// Only called for kept frames, and not held on to after RunFrames returns.
+struct IFrameSink
+{
+    // Keep every interval-th frame of a run, 0 to keep only the last
+    virtual unsigned int FrameInterval() = 0;
+
+    // Where to draw a kept frame, 256 * 240 RGBA pixels.
+    // frame is the frame's index in the run.
+    virtual unsigned char* GetFrameBuffer(unsigned int frame) = 0;
+
+    // The frame has been drawn
+    virtual void OnFrame(unsigned int frame) = 0;
+};
+
+// Memory that INes::GetMemoryView can expose
+enum NesMemoryRegion
+{
+    NES_MEMORY_RAM,         // 2KB of work ram, $0000-$07ff
+    NES_MEMORY_CART_RAM,    // Prg ram on the cartridge, $6000-$7fff, at least 8KB (see GetMemoryView)
+    NES_MEMORY_OAM,         // 64 sprites of 4 bytes: y, tile, attributes, x
+    NES_MEMORY_NAMETABLES,  // 2KB of nametables and attribute tables
+    NES_MEMORY_PALETTE,     // 32 bytes, background palettes then sprite palettes
+};
+
+// A read-only window straight onto emulator memory
+struct NesMemoryView
+{
+    const unsigned char* data;
+    unsigned int size;
+
+    // INes::MemoryGeneration() when the view was taken
+    unsigned long long generation;
+};
+
+// Parts of the core INes::GetCounters counts. Times include everything a
+// call makes, so a cpu step's time includes its memory accesses.
+enum NesCounterId
+{
+    NES_COUNTER_CPU_STEP,           // Cpu::Step, one instruction or dma byte
+    NES_COUNTER_APU_STEP,           // Apu::Step, once per cpu step
+    NES_COUNTER_PPU_STEP,           // Ppu::Step, once per cpu step
+    NES_COUNTER_PPU_DRAW_SCANLINE,  // Ppu::DrawScanline, once per visible dot
+    NES_COUNTER_MEM_LOAD,           // MemoryMap::loadb, cpu reads
+    NES_COUNTER_MEM_STORE,          // MemoryMap::storeb, cpu writes
+    NES_COUNTER_MAPPER_PRG_LOAD,    // IMapper::prg_loadb
+    NES_COUNTER_MAPPER_CHR_LOAD,    // IMapper::chr_loadb
+    NES_COUNTER_AUDIO_CALLBACK,     // AudioEngine::ExecuteCallback, on the audio thread
+
+    NES_COUNTER_COUNT
+};
+
+struct NesCounter
+{
+    unsigned long long calls;
+    unsigned long long nanoseconds;
+};
+
+struct NesCounters
+{
+    // The last DoFrame (run-ahead frames included) or frame of RunFrames,
+    // and everything since the counters were last reset
+    NesCounter lastFrame[NES_COUNTER_COUNT];
+    NesCounter total[NES_COUNTER_COUNT];
+    unsigned long long frames;
 };
 
 struct INes : public IBaseInterface
@@ -47,9 +142,77 @@ struct INes : public IBaseInterface
     virtual void Dispose() = 0;
 
     virtual void DoFrame(unsigned char screen[]) = 0;
+    virtual void DoFrame(unsigned char screen[], unsigned int flags) = 0;
+
+    // Emulating and presenting on separate threads.
+    // PublishFrame is DoFrame into a screen of the emulator's own, which is then
+    // handed to AcquireFrame. Every other call belongs to the emulating thread too.
+    // A frame with NES_FRAME_NO_RENDER isn't published.
+    virtual void PublishFrame(unsigned int flags) = 0;
+
+    // The newest frame PublishFrame has finished, for the presenting thread.
+    // Neither side waits for the other: frames published in between are skipped
+    // and the same frame comes back until a new one is published. The pixels
+    // stay put until the next AcquireFrame.
+    // frame: if not null, gets the frame's number, counting published frames from 1
+    // returns: 256 * 240 RGBA pixels, or null if nothing has been published
+    virtual const unsigned char* AcquireFrame(unsigned long long* frame) = 0;
     virtual IStandardController* GetStandardController(unsigned int port) = 0;
+
+    // Run count frames in one call.
+    // inputPerFrame: count NesButtons bytes for controller 1, one per frame,
+    // or null to leave the input alone. Connects a standard controller to
+    // port 0 if there isn't one.
+    // sink: gets the frames it asks to keep, the rest aren't drawn. May be null.
+    // flags: NesFrameFlags for every frame
+    virtual void RunFrames(unsigned int count, const unsigned char* inputPerFrame, IFrameSink* sink, unsigned int flags) = 0;
     virtual void SaveState() = 0;
     virtual void LoadState() = 0;
+
+    // Run-ahead hides the game's own input lag.
+    // Each DoFrame emulates the real frame, then emulates this many more frames with the
+    // same input and presents the last one before rewinding to the real frame.
+    // 0 disables run-ahead.
+    virtual void SetRunAhead(unsigned int frames) = 0;
+
+    // Pipelined rendering spreads one game over two threads.
+    // DoFrame emulates its frame without drawing it and hands the drawing to a
+    // render thread, which draws it while the next DoFrame emulates the next
+    // frame. So screen gets the frame emulated by the previous DoFrame, one
+    // frame late, and the first DoFrame after enabling leaves it alone.
+    // One frame of run-ahead makes up for the delay. RunFrames isn't pipelined.
+    virtual void SetPipelinedRendering(bool enabled) = 0;
+
+    // Draw each frame's scanlines in bands across this many threads once the
+    // frame has run, instead of as it runs. The pixels are the same either way.
+    // 0 turns it off. Pipelined rendering takes precedence.
+    virtual void SetParallelRendering(unsigned int threads) = 0;
+
+    // 64-bit hash of the whole machine state: cpu, ram, ppu (vram, oam, palette),
+    // apu, mapper and cart ram. Two machines with equal hashes will run identically.
+    // RAM is hashed as it is written, so this costs about the same every frame
+    // no matter how much state there is. Call between frames.
+    virtual unsigned long long StateHash() = 0;
+
+    // Read game state without copying it and without going through the bus,
+    // which has side effects on the ppu and apu registers.
+    // The view points at the emulator's own memory and is only meaningful
+    // between frames: running a frame, loading a state or resetting changes
+    // the contents and moves MemoryGeneration on. A view whose generation is
+    // still current describes the machine as it is now.
+    // Cart ram is always there, 8KB when the header declares none, since an
+    // ines header of 0 can mean 8KB and the cpu sees that much either way.
+    // returns: false if region isn't one of NesMemoryRegion
+    virtual bool GetMemoryView(NesMemoryRegion region, NesMemoryView* view) = 0;
+    virtual unsigned long long MemoryGeneration() = 0;
+
+    // Calls and time per part of the core, see NesCounterId.
+    // Only counted when the core is built with NES_COUNTERS defined, as timing
+    // every call slows it down a lot. Without it nothing is counted and
+    // GetCounters returns false. Work on render threads isn't counted.
+    // Call between frames.
+    virtual bool GetCounters(NesCounters* counters) = 0;
+    virtual void ResetCounters() = 0;
 };
 
 // Audio interface (implemented by host)
@@ -78,4 +241,8 @@ struct IStandardController : public IBaseInterface
     virtual void Down(bool state) = 0;
     virtual void Left(bool state) = 0;
     virtual void Right(bool state) = 0;
+
+    // All eight at once as NesButtons. Opposite directions pressed together
+    // cancel out, as they do when set one at a time.
+    virtual void SetButtons(unsigned char buttons) = 0;
 };
\ No newline at end of file
@@ -0,0 +1,85 @@
+#include "stdafx.h"
+#include "framePacer.h"
+
+// Sleeping is only trusted to wake up within this much of when it was asked to
+const std::chrono::microseconds SPIN_TIME(2000);
+
+FramePacer::FramePacer(const char* name, double framesPerSecond)
+    : _name(name)
+    , _frameTime(std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / framesPerSecond)))
+    , _speed(1)
+    , _nextFrame(Clock::now())
+    , _report(false)
+    , _lastReport(Clock::now())
+    , _frames(0)
+    , _totalLateNs(0)
+    , _maxLateNs(0)
+{
+}
+
+void FramePacer::SetSpeed(unsigned int speed)
+{
+    if (speed != _speed)
+    {
+        _speed = speed;
+        _nextFrame = Clock::now();
+    }
+}
+
+void FramePacer::Wait()
+{
+    if (_speed == 0)
+    {
+        return;
+    }
+
+    _nextFrame += _frameTime / _speed;
+
+    Clock::time_point now = Clock::now();
+    if (_nextFrame < now)
+    {
+        // Fell behind, so start again from now rather than race to catch up
+        Report(now, _nextFrame);
+        _nextFrame = now;
+        return;
+    }
+
+    if (_nextFrame - now > SPIN_TIME)
+    {
+        std::this_thread::sleep_until(_nextFrame - SPIN_TIME);
+    }
+
+    do
+    {
+        now = Clock::now();
+    } while (now < _nextFrame);
+
+    Report(now, _nextFrame);
+}
+
+void FramePacer::Report(Clock::time_point now, Clock::time_point due)
+{
+    if (!_report)
+    {
+        return;
+    }
+
+    long long lateNs = std::chrono::duration_cast<std::chrono::nanoseconds>(now - due).count();
+    _totalLateNs += lateNs;
+    _maxLateNs = lateNs > _maxLateNs ? lateNs : _maxLateNs;
+    _frames++;
+
+    if (now - _lastReport >= std::chrono::seconds(1))
+    {
+        printf("%s pacing: %u frames, %.3f ms late on average, %.3f ms at most\n",
+            _name,
+            _frames,
+            _totalLateNs / 1000000.0 / _frames,
+            _maxLateNs / 1000000.0);
+
+        _lastReport = now;
+        _frames = 0;
+        _totalLateNs = 0;
+        _maxLateNs = 0;
+    }
+}
\ No newline at end of file
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <chrono>
+
+// Keeps a loop running at a steady number of frames a second.
+// Wait sleeps until shortly before the next frame is due, as the OS can wake
+// a sleeping thread late, and spins for the rest. With reporting on, how late
+// each frame still starts is printed once a second.
+class FramePacer
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    // name: printed with the jitter report
+    FramePacer(const char* name, double framesPerSecond);
+
+    // Run speed times as fast, 0 for as fast as possible
+    void SetSpeed(unsigned int speed);
+    unsigned int Speed() { return _speed; }
+
+    // Print the jitter report, off to begin with
+    void SetReporting(bool report) { _report = report; }
+
+    // Wait for the next frame to be due
+    void Wait();
+
+private:
+    void Report(Clock::time_point now, Clock::time_point due);
+
+private:
+    const char* _name;
+    Clock::duration _frameTime;
+    unsigned int _speed;
+    Clock::time_point _nextFrame;
+    bool _report;
+
+    // Lateness since the last report
+    Clock::time_point _lastReport;
+    unsigned int _frames;
+    long long _totalLateNs;
+    long long _maxLateNs;
+};
\ No newline at end of file
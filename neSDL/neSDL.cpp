@@ -2,15 +2,124 @@
 #include "sdlAudio.h"
 #include "sdlGfx.h"
 #include "sdlInput.h"
+#include "framePacer.h"
+
+// F3 steps through these, 0 is as fast as possible
+static const unsigned int Speeds[] = { 1, 2, 4, 8, 0 };
+
+static unsigned int NextSpeed(unsigned int speed)
+{
+    unsigned int count = sizeof(Speeds) / sizeof(Speeds[0]);
+    for (unsigned int i = 0; i < count; i++)
+    {
+        if (Speeds[i] == speed)
+        {
+            return Speeds[(i + 1) % count];
+        }
+    }
+    return Speeds[0];
+}
+
+// Reports how long emulation takes per displayed frame so that the cost of run-ahead is visible.
+// Each extra run-ahead frame costs roughly one more emulated frame out of the 16.7ms budget.
+// Only times anything if report is set.
+class EmulationTimer
+{
+public:
+    EmulationTimer(unsigned int runAhead, bool report)
+        : _runAhead(runAhead)
+        , _report(report)
+        , _frames(0)
+        , _totalNs(0)
+    {
+    }
+
+    void Start()
+    {
+        if (!_report)
+        {
+            return;
+        }
+        _start = std::chrono::high_resolution_clock::now();
+    }
+
+    void Stop()
+    {
+        if (!_report)
+        {
+            return;
+        }
+        auto now = std::chrono::high_resolution_clock::now();
+        _totalNs += std::chrono::duration_cast<std::chrono::nanoseconds>(now - _start).count();
+        _frames++;
+
+        if (_frames == 60)
+        {
+            double msPerFrame = (double)_totalNs / _frames / 1000000.0;
+            double msPerEmulatedFrame = msPerFrame / (_runAhead + 1);
+            double headroom = 100.0 * (1.0 - msPerFrame / 16.6667);
+
+            printf("run-ahead %u: %.2f ms/frame, %.2f ms per extra frame, %.0f%% headroom\n",
+                _runAhead,
+                msPerFrame,
+                msPerEmulatedFrame,
+                headroom);
+
+            _frames = 0;
+            _totalNs = 0;
+        }
+    }
+
+private:
+    unsigned int _runAhead;
+    bool _report;
+    unsigned int _frames;
+    long long _totalNs;
+    std::chrono::time_point<std::chrono::high_resolution_clock> _start;
+};
 
 int main(int argc, char* argv[])
 {
     if (argc < 2)
     {
         printf("Must provide path to ROM file.\n");
+        printf("usage: neSDL <rom> [--runahead <frames>] [--pipeline] [--speed <multiplier>] [--uncapped] [--vsync] [--stats]\n");
         return -1;
     }
 
+    unsigned int runAhead = 0;
+    bool pipeline = false;
+    unsigned int speed = 1;
+    bool vsync = false;
+    bool stats = false;
+    for (int i = 2; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--runahead") == 0 && i + 1 < argc)
+        {
+            runAhead = (unsigned int)atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--pipeline") == 0)
+        {
+            pipeline = true;
+        }
+        else if (strcmp(argv[i], "--speed") == 0 && i + 1 < argc)
+        {
+            speed = (unsigned int)atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--uncapped") == 0)
+        {
+            speed = 0;
+        }
+        else if (strcmp(argv[i], "--vsync") == 0)
+        {
+            vsync = true;
+        }
+        else if (strcmp(argv[i], "--stats") == 0)
+        {
+            stats = true;
+        }
+    }
+
     NPtr<SdlAudioProvider> audioProvider(new SdlAudioProvider(44100));
     NPtr<INes> nes;
     if (!Nes_Create(argv[1], audioProvider, &nes))
@@ -18,16 +127,70 @@ int main(int argc, char* argv[])
         return 1;
     }
 
+    nes->SetRunAhead(runAhead);
+    nes->SetPipelinedRendering(pipeline);
+    EmulationTimer timer(runAhead, stats);
+
     IStandardController* controller0 = nes->GetStandardController(0);
     SdlInput input(controller0);
 
-    SdlGfx gfx(3);
+    SdlGfx gfx(3, vsync);
 
-    unsigned char screen[256 * 240 * 4];
-    for (;;)
+    // The emulation runs on a thread of its own and publishes its frames, and
+    // this thread shows whichever frame is newest. Keys that aren't buttons
+    // are passed over to be handled between frames.
+    std::atomic<InputResult> command(InputResult::Continue);
+    std::atomic<bool> quit(false);
+
+    std::thread emulation([&nes, &timer, &command, &quit, speed, stats]
     {
-        memset(screen, 0, sizeof(screen));
+        FramePacer pacer("emulation", 60.0);
+        pacer.SetSpeed(speed);
+        pacer.SetReporting(stats);
+
+        while (!quit)
+        {
+            switch (command.exchange(InputResult::Continue))
+            {
+            case InputResult::FastForward:
+                pacer.SetSpeed(NextSpeed(pacer.Speed()));
+                if (pacer.Speed() == 0)
+                {
+                    printf("speed: uncapped\n");
+                }
+                else
+                {
+                    printf("speed: %ux\n", pacer.Speed());
+                }
+                break;
+            case InputResult::SaveState:
+                nes->SaveState();
+                break;
+            case InputResult::LoadState:
+                nes->LoadState();
+                break;
+            case InputResult::ResetHard:
+                nes->Reset(true);
+                break;
+            default:
+                break;
+            }
 
+            // Sped up audio would only crackle, so it is muted instead
+            timer.Start();
+            nes->PublishFrame(pacer.Speed() == 1 ? NES_FRAME_DEFAULT : NES_FRAME_NO_AUDIO);
+            timer.Stop();
+
+            pacer.Wait();
+        }
+    });
+
+    // Without vsync the display is paced here, and always at 60 fps however fast the game runs
+    FramePacer displayPacer("display", 60.0);
+    displayPacer.SetReporting(stats);
+
+    for (;;)
+    {
         InputResult result = input.CheckInput();
 
         if (result == InputResult::Quit)
@@ -35,22 +198,25 @@ int main(int argc, char* argv[])
             break;
         }
 
-        switch (result)
+        if (result != InputResult::Continue)
         {
-        case InputResult::SaveState:
-            nes->SaveState();
-            break;
-        case InputResult::LoadState:
-            nes->LoadState();
-            break;
-        case InputResult::ResetHard:
-            nes->Reset(true);
-            break;
+            command = result;
+        }
+
+        const unsigned char* screen = nes->AcquireFrame(nullptr);
+        if (screen != nullptr)
+        {
+            gfx.Blit(screen);
         }
 
-        nes->DoFrame(screen);
-        gfx.Blit(screen);
+        if (!vsync || screen == nullptr)
+        {
+            displayPacer.Wait();
+        }
     }
 
+    quit = true;
+    emulation.join();
+
     nes->Dispose();
 }
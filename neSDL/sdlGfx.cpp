@@ -14,7 +14,7 @@ u8 grid_color = 0xff;
 #endif
 
 
-SdlGfx::SdlGfx(unsigned int scale)
+SdlGfx::SdlGfx(unsigned int scale, bool vsync)
     : _frameCounter(0)
 {
     SDL_InitSubSystem(SDL_INIT_VIDEO);
@@ -100,7 +100,7 @@ SdlGfx::SdlGfx(unsigned int scale)
     _renderer = SDL_CreateRenderer(
         _window,
         -1,
-        SDL_RENDERER_ACCELERATED// | SDL_RENDERER_PRESENTVSYNC
+        SDL_RENDERER_ACCELERATED | (vsync ? SDL_RENDERER_PRESENTVSYNC : 0)
         );
 
     _texture = SDL_CreateTexture(
@@ -111,7 +111,6 @@ SdlGfx::SdlGfx(unsigned int scale)
         SCREEN_HEIGHT
         );
 
-    _lastDrawTime = std::chrono::high_resolution_clock::now();
     _lastFpsTime = std::chrono::high_resolution_clock::now();
 }
 
@@ -125,7 +124,7 @@ SdlGfx::~SdlGfx()
 }
 
 #if defined(RENDER_GRID)
-void render_grid(u8 screen[])
+void render_grid(const u8 screen[])
 {
     ZeroMemory(grid_screen, SCREEN_HEIGHT * SCREEN_WIDTH * 3);
 
@@ -157,7 +156,7 @@ void render_grid(u8 screen[])
 }
 #endif
 
-void SdlGfx::Blit(unsigned char screen[])
+void SdlGfx::Blit(const unsigned char screen[])
 {
     void* screen_to_render = (void*)screen;
 #if defined(RENDER_GRID)
@@ -165,22 +164,13 @@ void SdlGfx::Blit(unsigned char screen[])
     screen_to_render = (void*)grid_screen;
 #endif
 
-    std::chrono::time_point<std::chrono::steady_clock> now;
-    long long duration;
-    do
-    {
-        now = std::chrono::high_resolution_clock::now();
-        duration = std::chrono::duration_cast<std::chrono::nanoseconds>(now - _lastDrawTime).count();
-    } while (duration < 16666667); // 60 fps
-    _lastDrawTime = now;
-
     SDL_UpdateTexture(_texture, NULL, (void*)screen_to_render, SCREEN_WIDTH * 4);
     SDL_RenderClear(_renderer);
     SDL_RenderCopy(_renderer, _texture, NULL, NULL);
     SDL_RenderPresent(_renderer);
 
     _frameCounter++;
-    now = std::chrono::high_resolution_clock::now();
+    std::chrono::time_point<std::chrono::steady_clock> now = std::chrono::steady_clock::now();
     if (std::chrono::duration_cast<std::chrono::seconds>(now - _lastFpsTime).count() >= 1)
     {
         printf("fps: %d\n", _frameCounter);
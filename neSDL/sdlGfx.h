@@ -13,16 +13,16 @@ struct SDL_Texture;
 class SdlGfx
 {
 public:
-    SdlGfx(unsigned int scale);
+    // vsync: Blit waits for the display to be refreshed
+    SdlGfx(unsigned int scale, bool vsync);
     ~SdlGfx();
 
-    void Blit(unsigned char screen[]);
+    void Blit(const unsigned char screen[]);
 private:
     SDL_Window* _window;
     SDL_Renderer* _renderer;
     SDL_Texture* _texture;
 
-    std::chrono::time_point<std::chrono::steady_clock> _lastDrawTime;
     std::chrono::time_point<std::chrono::steady_clock> _lastFpsTime;
 
     unsigned char _frameCounter;
@@ -10,6 +10,7 @@ enum class InputResult
     SaveState,
     LoadState,
     ResetHard,
+    FastForward,
     Quit
 };
 
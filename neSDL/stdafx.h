@@ -1,7 +1,10 @@
 #pragma once
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <atomic>
+#include <thread>
 #include <nes_api.h>
 
 #define SDL_MAIN_HANDLED
@@ -0,0 +1,547 @@
+// nesbatch : Runs many headless Nes instances at once
+//
+// Every job is a rom, an optional start state, an optional input movie, a
+// frame count and optional outputs. Jobs run as fast as the machine allows
+// on a work-stealing pool, with no window, audio or frame pacing.
+
+#include "../src/stdafx.h"
+#include "../src/nes.h"
+#include "../src/rom.h"
+#include "../src/heatmap.h"
+#include "../src/threadpool.h"
+
+#include <algorithm>
+#include <map>
+
+typedef std::chrono::steady_clock Clock;
+
+static const unsigned int ScreenWidth = 256;
+static const unsigned int ScreenHeight = 240;
+static const u32 DefaultFrames = 3600;
+static const u32 TraceInstructions = 1000;
+
+struct Job
+{
+    std::string rom;
+    std::string state;  // save state file to start from
+    std::string movie;  // one NesButtons byte per frame for controller 1
+    std::string screen; // last frame as a PPM image
+    std::string save;   // save state file at the end
+    std::string trace;  // the last instructions run, disassembled
+    std::string cdl;    // code/data log of the rom used, as a .cdl file
+    std::string logpoints; // see SetLogpoints
+    std::string log;    // what the logpoints logged and their hit counts
+    std::string heatmap; // prefix of the memory heatmap files, see WriteHeatmap
+    u32 frames = DefaultFrames;
+    u32 heatwindow = 0; // frames per heatmap, 0 for one of the whole run
+    u16 gdb = 0;        // gdb server port, the job waits for a client to let it go
+};
+
+struct JobResult
+{
+    bool ok = false;
+    u32 frames = 0;
+    double seconds = 0;
+    u64 hash = 0;
+};
+
+static bool ReadFile(const std::string& path, std::vector<u8>& data)
+{
+    std::ifstream stream(path, std::ios::binary);
+    if (!stream.is_open())
+    {
+        printf("Unable to open %s\n", path.c_str());
+        return false;
+    }
+
+    data.assign(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+    return true;
+}
+
+static bool WriteFile(const std::string& path, const u8* data, size_t size)
+{
+    std::ofstream stream(path, std::ios::binary | std::ios::trunc);
+    stream.write((const char*)data, size);
+    if (!stream.good())
+    {
+        printf("Unable to write %s\n", path.c_str());
+        return false;
+    }
+    return true;
+}
+
+static bool WritePpm(const std::string& path, const u8* screen)
+{
+    char header[32];
+    int headerSize = snprintf(header, sizeof(header), "P6\n%u %u\n255\n", ScreenWidth, ScreenHeight);
+
+    // The screen is RGBA
+    std::vector<u8> data(header, header + headerSize);
+    for (unsigned int i = 0; i < ScreenWidth * ScreenHeight; i++)
+    {
+        data.insert(data.end(), screen + i * 4, screen + i * 4 + 3);
+    }
+    return WriteFile(path, data.data(), data.size());
+}
+
+// The counts as <prefix><suffix>.txt, and images of the cpu and ppu address
+// spaces as <prefix><suffix>-cpu.ppm and <prefix><suffix>-ppu.ppm
+static bool WriteHeatmap(const std::string& prefix, const std::string& suffix, MemoryHeatmap* heatmap)
+{
+    bool ok = true;
+
+    std::stringstream table;
+    heatmap->WriteTable(table);
+    std::string text = table.str();
+    ok = WriteFile(prefix + suffix + ".txt", (const u8*)text.data(), text.size()) && ok;
+
+    std::stringstream cpu;
+    heatmap->WriteCpuImage(cpu);
+    text = cpu.str();
+    ok = WriteFile(prefix + suffix + "-cpu.ppm", (const u8*)text.data(), text.size()) && ok;
+
+    std::stringstream ppu;
+    heatmap->WritePpuImage(ppu);
+    text = ppu.str();
+    ok = WriteFile(prefix + suffix + "-ppu.ppm", (const u8*)text.data(), text.size()) && ok;
+
+    return ok;
+}
+
+// Keeps only the last frame of a run
+class LastFrameSink : public IFrameSink
+{
+public:
+    LastFrameSink(u8* screen)
+        : _screen(screen)
+    {
+    }
+
+    unsigned int FrameInterval() { return 0; }
+    unsigned char* GetFrameBuffer(unsigned int frame) { return _screen; }
+    void OnFrame(unsigned int frame) { }
+
+private:
+    u8* _screen;
+};
+
+// One logpoint per line, # starts a comment:
+//   exec $c123 if a == $3f && [$0075] > 4 log hp {[$75]} x {x}
+//   write $0075 log hp set to {value} on line {scanline}
+// The kind is read, write or exec, and the condition and text are as in
+// DebugService::SetBreakpoint. There is no debugger to stop in, so every
+// line must log. A later line for the same kind and address replaces an
+// earlier one.
+static bool SetLogpoints(const std::string& path, Nes* nes)
+{
+    std::ifstream stream(path);
+    if (!stream.is_open())
+    {
+        printf("Unable to open %s\n", path.c_str());
+        return false;
+    }
+
+    std::string line;
+    for (unsigned int lineNumber = 1; std::getline(stream, line); lineNumber++)
+    {
+        line = line.substr(0, line.find_first_of("#\r"));
+
+        std::istringstream words(line);
+        std::string kindName;
+        std::string address;
+        if (!(words >> kindName))
+        {
+            continue;
+        }
+        words >> address;
+
+        BreakpointKind kind;
+        if (kindName == "read") kind = DEBUG_BP_READ;
+        else if (kindName == "write") kind = DEBUG_BP_WRITE;
+        else if (kindName == "exec") kind = DEBUG_BP_EXECUTE;
+        else
+        {
+            printf("%s:%u: unknown kind '%s'\n", path.c_str(), lineNumber, kindName.c_str());
+            return false;
+        }
+
+        const char* digits = address.c_str();
+        int base = 10;
+        if (*digits == '$')
+        {
+            digits++;
+            base = 16;
+        }
+        char* end;
+        unsigned long addr = strtoul(digits, &end, base);
+        if (end == digits || *end != '\0' || addr > 0xffff)
+        {
+            printf("%s:%u: bad address '%s'\n", path.c_str(), lineNumber, address.c_str());
+            return false;
+        }
+
+        std::string rest;
+        std::getline(words, rest);
+        rest = " " + rest;
+        size_t logAt = rest.find(" log ");
+        if (logAt == std::string::npos)
+        {
+            printf("%s:%u: logpoint has no log text\n", path.c_str(), lineNumber);
+            return false;
+        }
+        std::string log = rest.substr(logAt + 5);
+
+        std::string condition = rest.substr(0, logAt);
+        size_t ifAt = condition.find(" if ");
+        if (ifAt != std::string::npos)
+        {
+            condition = condition.substr(ifAt + 4);
+        }
+        else if (condition.find_first_not_of(' ') != std::string::npos)
+        {
+            printf("%s:%u: expected if or log\n", path.c_str(), lineNumber);
+            return false;
+        }
+        else
+        {
+            condition.clear();
+        }
+
+        // The expressions say what is wrong with them
+        if (!nes->SetBreakpoint(kind, (u16)addr, condition.c_str(), log.c_str()))
+        {
+            printf("%s:%u: bad logpoint\n", path.c_str(), lineNumber);
+            return false;
+        }
+    }
+    return true;
+}
+
+static void RunJob(const Job& job, MemoryRomFile* romFile, JobResult& result)
+{
+    Clock::time_point start = Clock::now();
+
+    NPtr<Nes> nes;
+    if (!Nes::Create(static_cast<IRomFile*>(romFile), nullptr, &nes))
+    {
+        return;
+    }
+
+    std::vector<u8> data;
+    if (!job.state.empty())
+    {
+        if (!ReadFile(job.state, data) || !nes->LoadStateFile(data.data(), data.size()))
+        {
+            nes->Dispose();
+            return;
+        }
+    }
+
+    std::vector<u8> movie;
+    if (!job.movie.empty() && !ReadFile(job.movie, movie))
+    {
+        nes->Dispose();
+        return;
+    }
+
+    // Past the end of the movie nothing is pressed
+    movie.resize(job.frames, 0);
+
+    // Only the last frame is drawn, and only if someone wants it
+    std::vector<u8> screen;
+    if (!job.screen.empty())
+    {
+        screen.resize(ScreenWidth * ScreenHeight * 4);
+    }
+
+    if (!job.trace.empty())
+    {
+        nes->SetCpuTrace(TraceInstructions);
+    }
+
+    if (!job.cdl.empty())
+    {
+        nes->SetCodeDataLogging(true);
+    }
+
+    if (!job.logpoints.empty() && !SetLogpoints(job.logpoints, nes))
+    {
+        nes->Dispose();
+        return;
+    }
+
+    if (job.gdb != 0 && !nes->StartGdbServer(job.gdb))
+    {
+        nes->Dispose();
+        return;
+    }
+
+    if (!job.heatmap.empty())
+    {
+        nes->SetMemoryHeatmap(true);
+    }
+
+    // With a heatmap per window the run goes a window at a time, the file
+    // names saying which frame each starts at
+    u32 window = job.frames;
+    if (!job.heatmap.empty() && job.heatwindow != 0)
+    {
+        window = job.heatwindow;
+    }
+
+    bool written = true;
+    LastFrameSink sink(screen.data());
+    for (u32 frame = 0; frame < job.frames; frame += window)
+    {
+        u32 count = std::min(window, job.frames - frame);
+        bool last = frame + count == job.frames;
+        nes->RunFrames(count, movie.data() + frame, last && !screen.empty() ? &sink : nullptr, NES_FRAME_NO_AUDIO);
+
+        if (!job.heatmap.empty())
+        {
+            std::string suffix = window == job.frames ? "" : "-" + std::to_string(frame);
+            written = WriteHeatmap(job.heatmap, suffix, nes->GetMemoryHeatmap()) && written;
+            nes->GetMemoryHeatmap()->Clear();
+        }
+    }
+
+    result.ok = written;
+    result.frames = job.frames;
+    result.hash = nes->StateHash();
+
+    if (!job.save.empty())
+    {
+        nes->SaveStateFile(data);
+        result.ok = WriteFile(job.save, data.data(), data.size()) && result.ok;
+    }
+
+    if (!job.screen.empty())
+    {
+        result.ok = WritePpm(job.screen, screen.data()) && result.ok;
+    }
+
+    if (!job.trace.empty())
+    {
+        std::stringstream trace;
+        nes->WriteCpuTrace(trace, TraceInstructions);
+        std::string text = trace.str();
+        result.ok = WriteFile(job.trace, (const u8*)text.data(), text.size()) && result.ok;
+    }
+
+    if (!job.cdl.empty())
+    {
+        std::stringstream cdl;
+        nes->WriteCodeDataLog(cdl);
+        std::string log = cdl.str();
+        result.ok = WriteFile(job.cdl, (const u8*)log.data(), log.size()) && result.ok;
+    }
+
+    if (!job.log.empty())
+    {
+        std::stringstream log;
+        nes->WriteBreakpointLog(log);
+        std::string text = log.str();
+        result.ok = WriteFile(job.log, (const u8*)text.data(), text.size()) && result.ok;
+    }
+
+    nes->Dispose();
+    result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// One job per line as key=value pairs, # starts a comment:
+//   rom=game.nes state=start.ns movie=run.inp frames=600 screen=end.ppm save=end.ns trace=end.txt cdl=game.cdl
+//   logpoints=watch.txt log=watch.log gdb=2345 heatmap=heat/run heatwindow=600
+static bool ReadJobFile(const char* path, std::vector<Job>& jobs)
+{
+    std::ifstream stream(path);
+    if (!stream.is_open())
+    {
+        printf("Unable to open %s\n", path);
+        return false;
+    }
+
+    std::string line;
+    for (unsigned int lineNumber = 1; std::getline(stream, line); lineNumber++)
+    {
+        line = line.substr(0, line.find('#'));
+
+        Job job;
+        std::istringstream fields(line);
+        std::string field;
+        bool empty = true;
+        while (fields >> field)
+        {
+            empty = false;
+            size_t equals = field.find('=');
+            std::string key = field.substr(0, equals);
+            std::string value = equals == std::string::npos ? "" : field.substr(equals + 1);
+
+            if (key == "rom") job.rom = value;
+            else if (key == "state") job.state = value;
+            else if (key == "movie") job.movie = value;
+            else if (key == "screen") job.screen = value;
+            else if (key == "save") job.save = value;
+            else if (key == "trace") job.trace = value;
+            else if (key == "cdl") job.cdl = value;
+            else if (key == "logpoints") job.logpoints = value;
+            else if (key == "log") job.log = value;
+            else if (key == "heatmap") job.heatmap = value;
+            else if (key == "heatwindow") job.heatwindow = (u32)strtoul(value.c_str(), nullptr, 10);
+            else if (key == "gdb") job.gdb = (u16)strtoul(value.c_str(), nullptr, 10);
+            else if (key == "frames") job.frames = (u32)strtoul(value.c_str(), nullptr, 10);
+            else
+            {
+                printf("%s:%u: unknown field '%s'\n", path, lineNumber, key.c_str());
+                return false;
+            }
+        }
+
+        if (empty)
+        {
+            continue;
+        }
+
+        if (job.rom.empty())
+        {
+            printf("%s:%u: job has no rom\n", path, lineNumber);
+            return false;
+        }
+        jobs.push_back(job);
+    }
+    return true;
+}
+
+static void Usage()
+{
+    printf("usage: nesbatch [options] <rom>...\n");
+    printf("       nesbatch [options] --jobs <file>\n");
+    printf("options:\n");
+    printf("  --jobs <file>       One job per line: rom=<path> [state=<path>] [movie=<path>]\n");
+    printf("                      [frames=<count>] [screen=<ppm path>] [save=<path>]\n");
+    printf("                      [trace=<path>] [cdl=<path>]\n");
+    printf("                      [logpoints=<path>] [log=<path>] [gdb=<port>]\n");
+    printf("                      [heatmap=<prefix>] [heatwindow=<frames>]\n");
+    printf("  --frames <count>    Frames per rom given on the command line (default %u)\n", DefaultFrames);
+    printf("  --movie <file>      Input for roms given on the command line, one byte per frame\n");
+    printf("  --repeat <count>    Run each rom given on the command line this many times\n");
+    printf("  --threads <count>   Worker threads (default one per hardware thread)\n");
+    printf("  --quiet             Only print the totals\n");
+}
+
+int main(int argc, char* argv[])
+{
+    std::vector<Job> jobs;
+    std::vector<std::string> roms;
+    const char* jobFile = nullptr;
+    std::string movie;
+    u32 frames = DefaultFrames;
+    u32 repeat = 1;
+    unsigned int threads = 0;
+    bool quiet = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--jobs") == 0 && hasValue) jobFile = argv[++i];
+        else if (strcmp(argv[i], "--frames") == 0 && hasValue) frames = (u32)atoi(argv[++i]);
+        else if (strcmp(argv[i], "--movie") == 0 && hasValue) movie = argv[++i];
+        else if (strcmp(argv[i], "--repeat") == 0 && hasValue) repeat = (u32)atoi(argv[++i]);
+        else if (strcmp(argv[i], "--threads") == 0 && hasValue) threads = (unsigned int)atoi(argv[++i]);
+        else if (strcmp(argv[i], "--quiet") == 0) quiet = true;
+        else if (argv[i][0] == '-')
+        {
+            Usage();
+            return -1;
+        }
+        else roms.push_back(argv[i]);
+    }
+
+    if (jobFile != nullptr && !ReadJobFile(jobFile, jobs))
+    {
+        return -1;
+    }
+
+    for (const std::string& rom : roms)
+    {
+        for (u32 i = 0; i < repeat; i++)
+        {
+            Job job;
+            job.rom = rom;
+            job.movie = movie;
+            job.frames = frames;
+            jobs.push_back(job);
+        }
+    }
+
+    if (jobs.empty())
+    {
+        Usage();
+        return -1;
+    }
+
+    // Each rom is read once and shared by all of its jobs
+    std::map<std::string, NPtr<MemoryRomFile>> romFiles;
+    for (const Job& job : jobs)
+    {
+        NPtr<MemoryRomFile>& romFile = romFiles[job.rom];
+        if (romFile == nullptr && !MemoryRomFile::Create(job.rom.c_str(), &romFile))
+        {
+            printf("Unable to open %s\n", job.rom.c_str());
+            return -1;
+        }
+    }
+
+    std::vector<JobResult> results(jobs.size());
+    Clock::time_point start = Clock::now();
+    {
+        WorkStealingPool pool(threads);
+        threads = pool.ThreadCount();
+
+        for (size_t i = 0; i < jobs.size(); i++)
+        {
+            MemoryRomFile* romFile = romFiles[jobs[i].rom];
+            pool.Submit([&jobs, &results, romFile, i]
+            {
+                RunJob(jobs[i], romFile, results[i]);
+            });
+        }
+        pool.Wait();
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    u64 totalFrames = 0;
+    u32 failed = 0;
+    for (size_t i = 0; i < jobs.size(); i++)
+    {
+        const JobResult& result = results[i];
+        totalFrames += result.frames;
+        if (!result.ok)
+        {
+            failed++;
+        }
+
+        if (!quiet || !result.ok)
+        {
+            if (result.ok)
+            {
+                printf("job %zu: %s, %u frames in %.2fs, state hash %016llx\n",
+                    i, jobs[i].rom.c_str(), result.frames, result.seconds, result.hash);
+            }
+            else
+            {
+                printf("job %zu: %s failed\n", i, jobs[i].rom.c_str());
+            }
+        }
+    }
+
+    printf("%zu jobs (%u failed), %llu frames in %.2fs on %u threads: %.0f frames/s, %.0f per thread\n",
+        jobs.size(),
+        failed,
+        totalFrames,
+        seconds,
+        threads,
+        totalFrames / seconds,
+        totalFrames / seconds / threads);
+
+    return failed == 0 ? 0 : 1;
+}
\ No newline at end of file
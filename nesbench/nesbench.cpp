@@ -0,0 +1,1243 @@
+// nesbench : Offline benchmarks for the emulator core
+//
+
+#include "../src/stdafx.h"
+#include "../src/nes.h"
+#include "../src/savestate.h"
+#include "../src/cpu.h"
+#include "../src/debug.h"
+#include "../src/lockstep.h"
+#include "../src/netplay.h"
+#include "../src/rom.h"
+#include "../src/diassembler.h"
+
+#include <algorithm>
+
+typedef std::chrono::steady_clock Clock;
+
+static double Seconds(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static double MBPerSecond(size_t bytes, double seconds)
+{
+    return seconds > 0 ? bytes / seconds / (1024.0 * 1024.0) : 0;
+}
+
+// Made up input, one NesButtons byte per frame.
+// Input changes every few frames and start is pressed now and then so that
+// most games get past the title screen.
+static void MakeInput(unsigned int frames, std::vector<u8>& input)
+{
+    u32 random = 1;
+    u8 buttons = 0;
+    input.resize(frames);
+    for (unsigned int frame = 0; frame < frames; frame++)
+    {
+        if (frame % 8 == 0)
+        {
+            random = random * 1664525 + 1013904223;
+            buttons = (u8)((random >> 24) & ~(NES_BUTTON_SELECT | NES_BUTTON_START));
+            if (frame % 240 == 0)
+            {
+                buttons |= NES_BUTTON_START;
+            }
+        }
+        input[frame] = buttons;
+    }
+}
+
+// Play the game with made up input, keeping a raw state every interval frames.
+static void CollectStates(Nes* nes, unsigned int frames, unsigned int interval, std::vector<std::vector<u8>>& states)
+{
+    static u8 screen[256 * 240 * 4];
+    IStandardController* controller = nes->GetStandardController(0);
+
+    std::vector<u8> input;
+    MakeInput(frames, input);
+
+    MemoryStream state;
+    for (unsigned int frame = 0; frame < frames; frame++)
+    {
+        controller->SetButtons(input[frame]);
+
+        nes->DoFrame(screen, NES_FRAME_NO_AUDIO);
+
+        if ((frame + 1) % interval == 0)
+        {
+            state.Clear();
+            nes->SaveState(state);
+            states.emplace_back(state.Data(), state.Data() + state.Size());
+        }
+    }
+}
+
+// The same frames from the same state, drawn and then not drawn.
+// Frames that aren't drawn skip the pixel work but must leave the machine in
+// exactly the same state, sprite 0 hits and all, so the state hashes have to match.
+static void BenchmarkRendering(Nes* nes, unsigned int frames)
+{
+    IStandardController* controller = nes->GetStandardController(0);
+    std::vector<u8> screen(256 * 240 * 4);
+
+    std::vector<u8> input;
+    MakeInput(frames, input);
+
+    MemoryStream start;
+    nes->SaveState(start);
+
+    Clock::time_point begin = Clock::now();
+    for (unsigned int frame = 0; frame < frames; frame++)
+    {
+        controller->SetButtons(input[frame]);
+        nes->DoFrame(screen.data(), NES_FRAME_NO_AUDIO);
+    }
+    double drawnSeconds = Seconds(begin);
+    u64 drawnHash = nes->StateHash();
+
+    start.Rewind();
+    nes->LoadState(start);
+
+    begin = Clock::now();
+    for (unsigned int frame = 0; frame < frames; frame++)
+    {
+        controller->SetButtons(input[frame]);
+        nes->DoFrame(nullptr, NES_FRAME_NO_AUDIO | NES_FRAME_NO_RENDER);
+    }
+    double skippedSeconds = Seconds(begin);
+    u64 skippedHash = nes->StateHash();
+
+    printf("rendering: %u frames\n", frames);
+    printf("  drawn:   %.0f frames/s\n", frames / drawnSeconds);
+    printf("  skipped: %.0f frames/s, %.2fx\n", frames / skippedSeconds, drawnSeconds / skippedSeconds);
+    if (drawnHash != skippedHash)
+    {
+        printf("  skipped frames ended in a different state, %016llx vs %016llx\n", skippedHash, drawnHash);
+    }
+
+    start.Rewind();
+    nes->LoadState(start);
+}
+
+// Where the frames' time goes, per part of the core. Only has anything to
+// show in builds with NES_COUNTERS defined.
+static void BenchmarkCounters(Nes* nes, unsigned int frames)
+{
+    static const char* Names[NES_COUNTER_COUNT] =
+    {
+        "cpu step",
+        "apu step",
+        "ppu step",
+        "ppu draw scanline",
+        "mem load",
+        "mem store",
+        "mapper prg load",
+        "mapper chr load",
+        "audio callback",
+    };
+
+    NesCounters counters;
+    if (!nes->GetCounters(&counters))
+    {
+        return;
+    }
+
+    IStandardController* controller = nes->GetStandardController(0);
+    std::vector<u8> screen(256 * 240 * 4);
+
+    std::vector<u8> input;
+    MakeInput(frames, input);
+
+    MemoryStream start;
+    nes->SaveState(start);
+    nes->ResetCounters();
+
+    Clock::time_point begin = Clock::now();
+    for (unsigned int frame = 0; frame < frames; frame++)
+    {
+        controller->SetButtons(input[frame]);
+        nes->DoFrame(screen.data(), NES_FRAME_NO_AUDIO);
+    }
+    double seconds = Seconds(begin);
+    nes->GetCounters(&counters);
+
+    // Times include the calls they make, so they add up to more than the frame
+    printf("counters: %u frames, %.3f ms/frame\n", frames, seconds * 1000.0 / frames);
+    for (u32 i = 0; i < NES_COUNTER_COUNT; i++)
+    {
+        const NesCounter& counter = counters.total[i];
+        printf("  %-18s %10.0f calls/frame %8.3f ms/frame %7.1f ns/call\n",
+            Names[i],
+            (double)counter.calls / counters.frames,
+            counter.nanoseconds / 1000000.0 / counters.frames,
+            counter.calls > 0 ? (double)counter.nanoseconds / counter.calls : 0);
+    }
+
+    start.Rewind();
+    nes->LoadState(start);
+}
+
+// Where the cpu spends its cycles, by place in PrgRom and by opcode
+static void BenchmarkCpuProfile(Nes* nes, unsigned int frames, unsigned int top)
+{
+    IStandardController* controller = nes->GetStandardController(0);
+    std::vector<u8> screen(256 * 240 * 4);
+
+    std::vector<u8> input;
+    MakeInput(frames, input);
+
+    nes->SetCpuProfiling(true);
+    for (unsigned int frame = 0; frame < frames; frame++)
+    {
+        controller->SetButtons(input[frame]);
+        nes->DoFrame(screen.data(), NES_FRAME_NO_AUDIO);
+    }
+
+    std::stringstream report;
+    nes->WriteCpuProfile(report, top);
+    nes->SetCpuProfiling(false);
+
+    printf("%s", report.str().c_str());
+}
+
+// Runs frames from start with the scanlines drawn by threads threads (0 for
+// drawn as they are emulated), hashing every frame's pixels.
+// returns: seconds taken
+static double RunHashedFrames(Nes* nes, MemoryStream& start, const std::vector<u8>& input, unsigned int threads, std::vector<u64>& hashes)
+{
+    IStandardController* controller = nes->GetStandardController(0);
+    std::vector<u8> screen(256 * 240 * 4);
+    HashStream hash;
+
+    start.Rewind();
+    nes->LoadState(start);
+    nes->SetParallelRendering(threads);
+
+    hashes.clear();
+    double seconds = 0;
+    for (size_t frame = 0; frame < input.size(); frame++)
+    {
+        controller->SetButtons(input[frame]);
+
+        Clock::time_point begin = Clock::now();
+        nes->DoFrame(screen.data(), NES_FRAME_NO_AUDIO);
+        seconds += Seconds(begin);
+
+        hash.Clear();
+        hash.write((const char*)screen.data(), screen.size());
+        hashes.push_back(hash.Hash());
+    }
+
+    nes->SetParallelRendering(0);
+    return seconds;
+}
+
+// Frames drawn as they are emulated against frames whose scanlines are drawn
+// across threads afterwards. Every frame's pixels have to match.
+static void BenchmarkParallelRendering(Nes* nes, unsigned int frames)
+{
+    static const unsigned int Threads[] = { 1, 2, 4, 8 };
+
+    std::vector<u8> input;
+    MakeInput(frames, input);
+
+    MemoryStream start;
+    nes->SaveState(start);
+
+    std::vector<u64> serialHashes;
+    double serialSeconds = RunHashedFrames(nes, start, input, 0, serialHashes);
+
+    printf("parallel rendering: %u frames, %u hardware threads\n", frames, std::thread::hardware_concurrency());
+    printf("  serial:    %.0f frames/s\n", frames / serialSeconds);
+
+    std::vector<u64> hashes;
+    for (unsigned int threads : Threads)
+    {
+        double seconds = RunHashedFrames(nes, start, input, threads, hashes);
+
+        u32 mismatched = 0;
+        for (unsigned int frame = 0; frame < frames; frame++)
+        {
+            mismatched += hashes[frame] != serialHashes[frame] ? 1 : 0;
+        }
+
+        printf("  %u threads: %.0f frames/s, %.2fx", threads, frames / seconds, serialSeconds / seconds);
+        if (mismatched != 0)
+        {
+            printf(", %u frames drawn differently", mismatched);
+        }
+        printf("\n");
+    }
+
+    start.Rewind();
+    nes->LoadState(start);
+}
+
+// Save state file size and speed over a spread of states from one game.
+// Encode includes serializing the machine and decode includes loading it,
+// since that is what saving and loading a file costs.
+static void BenchmarkSaveStates(Nes* nes, unsigned int frames)
+{
+    const unsigned int Interval = 30;
+    const unsigned int Repeat = 50;
+
+    std::vector<std::vector<u8>> states;
+    CollectStates(nes, frames, Interval, states);
+    if (states.empty())
+    {
+        printf("No states collected, run more frames.\n");
+        return;
+    }
+
+    size_t rawBytes = 0;
+    size_t fileBytes = 0;
+    double encodeSeconds = 0;
+    double decodeSeconds = 0;
+    std::vector<u8> file;
+    MemoryStream state;
+
+    for (std::vector<u8>& raw : states)
+    {
+        state.Clear();
+        state.write((char*)raw.data(), raw.size());
+        nes->LoadState(state);
+
+        Clock::time_point start = Clock::now();
+        for (unsigned int i = 0; i < Repeat; i++)
+        {
+            nes->SaveStateFile(file);
+        }
+        encodeSeconds += Seconds(start);
+
+        start = Clock::now();
+        for (unsigned int i = 0; i < Repeat; i++)
+        {
+            if (!nes->LoadStateFile(file.data(), file.size()))
+            {
+                return;
+            }
+        }
+        decodeSeconds += Seconds(start);
+
+        rawBytes += raw.size();
+        fileBytes += file.size();
+    }
+
+    // The codec on its own, over the same states
+    size_t compressedBytes = 0;
+    double compressSeconds = 0;
+    double decompressSeconds = 0;
+    std::vector<u8> compressed;
+    std::vector<u8> decompressed;
+
+    for (std::vector<u8>& raw : states)
+    {
+        Clock::time_point start = Clock::now();
+        for (unsigned int i = 0; i < Repeat; i++)
+        {
+            compressed.clear();
+            LzCodec::Compress(raw.data(), raw.size(), compressed);
+        }
+        compressSeconds += Seconds(start);
+
+        decompressed.resize(raw.size());
+        start = Clock::now();
+        for (unsigned int i = 0; i < Repeat; i++)
+        {
+            LzCodec::Decompress(compressed.data(), compressed.size(), decompressed.data(), decompressed.size());
+        }
+        decompressSeconds += Seconds(start);
+
+        if (decompressed != raw)
+        {
+            printf("Codec round trip failed.\n");
+            return;
+        }
+        compressedBytes += compressed.size();
+    }
+
+    size_t count = states.size();
+    printf("save states: %zu taken over %u frames, %zu bytes raw\n", count, frames, rawBytes / count);
+    printf("  file:  %zu bytes, ratio %.1f, encode %.0f MB/s, decode %.0f MB/s\n",
+        fileBytes / count,
+        (double)rawBytes / fileBytes,
+        MBPerSecond(rawBytes * Repeat, encodeSeconds),
+        MBPerSecond(rawBytes * Repeat, decodeSeconds));
+    printf("  codec: %zu bytes, ratio %.1f, compress %.0f MB/s, decompress %.0f MB/s\n",
+        compressedBytes / count,
+        (double)rawBytes / compressedBytes,
+        MBPerSecond(rawBytes * Repeat, compressSeconds),
+        MBPerSecond(rawBytes * Repeat, decompressSeconds));
+}
+
+// The parts of the machine the lockstep benchmark leaves to each instance.
+// The status register flips on every read so vblank and sprite 0 waits end.
+class BenchIo : public IMem, public NesObject
+{
+public:
+    BenchIo()
+        : Buttons(0)
+        , _status(0)
+        , _ctrl(0)
+        , _shift(0)
+        , _prgRam(PRG_RAM_UNIT_SIZE)
+    {
+    }
+
+public:
+    DELEGATE_NESOBJECT_REFCOUNTING();
+
+    u8 loadb(u16 addr)
+    {
+        if (addr == 0x2002)
+        {
+            _status ^= 0xc0;
+            return _status;
+        }
+        else if (addr == 0x4016)
+        {
+            u8 bit = _shift & 1;
+            _shift = (_shift >> 1) | 0x80;
+            return bit;
+        }
+        else if (addr >= 0x6000 && addr < 0x8000)
+        {
+            return _prgRam[addr - 0x6000];
+        }
+        return 0;
+    }
+
+    void storeb(u16 addr, u8 val)
+    {
+        if (addr == 0x2000)
+        {
+            _ctrl = val;
+        }
+        else if (addr == 0x4016 && (val & 1) != 0)
+        {
+            _shift = Buttons;
+        }
+        else if (addr >= 0x6000 && addr < 0x8000)
+        {
+            _prgRam[addr - 0x6000] = val;
+        }
+    }
+
+    bool NmiEnabled() { return (_ctrl & 0x80) != 0; }
+
+public:
+    u8 Buttons;
+
+private:
+    u8 _status;
+    u8 _ctrl;
+    u8 _shift;
+    std::vector<u8> _prgRam;
+};
+
+// Work ram and prg rom in front of a BenchIo, the memory map LockstepCpu has built in
+class BenchBus : public IMem, public NesObject
+{
+public:
+    BenchBus(const std::vector<u8>& prg, BenchIo* io)
+        : _prg(prg)
+        , _io(io)
+    {
+        memset(Ram, 0, sizeof(Ram));
+    }
+
+public:
+    DELEGATE_NESOBJECT_REFCOUNTING();
+
+    u8 loadb(u16 addr)
+    {
+        if (addr < 0x2000)
+        {
+            return Ram[addr & 0x7ff];
+        }
+        else if (addr >= 0x8000)
+        {
+            return _prg[addr & (_prg.size() - 1)];
+        }
+        return _io->loadb(addr);
+    }
+
+    void storeb(u16 addr, u8 val)
+    {
+        if (addr < 0x2000)
+        {
+            Ram[addr & 0x7ff] = val;
+        }
+        else
+        {
+            _io->storeb(addr, val);
+        }
+    }
+
+public:
+    u8 Ram[0x800];
+
+private:
+    const std::vector<u8>& _prg;
+    NPtr<BenchIo> _io;
+};
+
+// Lanes copies of the game's cpu, run as separate Cpus and as one
+// LockstepCpu for the same frames with the same input, which is either the
+// same in every lane or different per lane to show what divergence costs.
+// Only the cpu runs, the rest of the machine is BenchIo.
+template <u32 Lanes>
+static void BenchmarkLockstep(const std::vector<u8>& prg, unsigned int frames, bool sameInput)
+{
+    const u32 CyclesPerFrame = 29781;
+
+    NPtr<DebugService> debugger(new DebugService());
+    std::vector<NPtr<BenchIo>> scalarIo(Lanes);
+    std::vector<NPtr<BenchBus>> buses(Lanes);
+    std::vector<NPtr<Cpu>> cpus(Lanes);
+    std::vector<NPtr<BenchIo>> lockstepIo(Lanes);
+    IMem* io[Lanes];
+
+    for (u32 i = 0; i < Lanes; i++)
+    {
+        scalarIo[i] = new BenchIo();
+        buses[i] = new BenchBus(prg, scalarIo[i]);
+        cpus[i] = new Cpu(buses[i], debugger);
+        lockstepIo[i] = new BenchIo();
+        io[i] = lockstepIo[i];
+    }
+    std::unique_ptr<LockstepCpu<Lanes>> lockstep(new LockstepCpu<Lanes>(prg.data(), (u32)prg.size(), io));
+
+    // The same made up input as CollectStates, from one seed or a seed per lane
+    std::vector<u32> random(Lanes);
+    for (u32 i = 0; i < Lanes; i++)
+    {
+        random[i] = sameInput ? 1 : i + 1;
+    }
+
+    double scalarSeconds = 0;
+    double lockstepSeconds = 0;
+    for (unsigned int frame = 0; frame < frames; frame++)
+    {
+        if (frame % 8 == 0)
+        {
+            for (u32 i = 0; i < Lanes; i++)
+            {
+                random[i] = random[i] * 1664525 + 1013904223;
+                u8 buttons = (u8)((random[i] >> 24) & ~(NES_BUTTON_SELECT | NES_BUTTON_START));
+                if (frame % 240 == 0)
+                {
+                    buttons |= NES_BUTTON_START;
+                }
+                scalarIo[i]->Buttons = buttons;
+                lockstepIo[i]->Buttons = buttons;
+            }
+        }
+
+        u32 end = (frame + 1) * CyclesPerFrame;
+
+        Clock::time_point start = Clock::now();
+        for (u32 i = 0; i < Lanes; i++)
+        {
+            while (cpus[i]->Cycles < end)
+            {
+                cpus[i]->Step();
+            }
+
+            if (scalarIo[i]->NmiEnabled())
+            {
+                cpus[i]->Nmi();
+            }
+        }
+        scalarSeconds += Seconds(start);
+
+        start = Clock::now();
+        lockstep->Run(end);
+        for (u32 i = 0; i < Lanes; i++)
+        {
+            if (lockstepIo[i]->NmiEnabled())
+            {
+                lockstep->Nmi(i);
+            }
+        }
+        lockstepSeconds += Seconds(start);
+    }
+
+    // Both must have done exactly the same thing
+    u32 mismatched = 0;
+    for (u32 i = 0; i < Lanes; i++)
+    {
+        const CpuRegs& scalar = cpus[i]->Regs();
+        CpuRegs regs = lockstep->Regs(i);
+        bool match = scalar.A == regs.A
+            && scalar.X == regs.X
+            && scalar.Y == regs.Y
+            && scalar.P == regs.P
+            && scalar.S == regs.S
+            && scalar.PC == regs.PC
+            && cpus[i]->Cycles == lockstep->Cycles(i);
+
+        for (u16 addr = 0; addr < 0x800 && match; addr++)
+        {
+            match = buses[i]->Ram[addr] == lockstep->PeekRam(i, addr);
+        }
+
+        if (!match)
+        {
+            mismatched++;
+        }
+    }
+
+    const typename LockstepCpu<Lanes>::Stats& stats = lockstep->GetStats();
+    printf("lockstep: %u lanes, %s input, %u frames\n", Lanes, sameInput ? "same" : "different", frames);
+    printf("  scalar:   %.0f frames/s\n", Lanes * frames / scalarSeconds);
+    printf("  lockstep: %.0f frames/s, %.2fx, %.1f lanes per step, %.1f%% of steps ran every lane\n",
+        Lanes * frames / lockstepSeconds,
+        scalarSeconds / lockstepSeconds,
+        (double)stats.LaneInstructions / stats.Steps,
+        100.0 * stats.FullSteps / stats.Steps);
+    if (mismatched > 0)
+    {
+        printf("  %u lanes ended in a different state than their Cpu\n", mismatched);
+    }
+}
+
+// Soaks up audio as fast as it is made. The callback runs on the emulation
+// thread after every frame, so generating samples counts against the frame.
+class BenchAudioProvider : public IAudioProvider, public NesObject
+{
+public:
+    BenchAudioProvider()
+        : _callback(nullptr)
+        , _callbackData(nullptr)
+        , _samples(SampleRate / 60)
+    {
+    }
+
+public:
+    DELEGATE_NESOBJECT_REFCOUNTING();
+
+    void Initialize(AudioCallback* callback, void* callbackData)
+    {
+        _callback = callback;
+        _callbackData = callbackData;
+    }
+
+    void PauseAudio() { }
+    void UnpauseAudio() { }
+    int GetSampleRate() { return SampleRate; }
+    int GetBitsPerSample() { return 8; }
+    int GetSilenceValue() { return 0; }
+
+    // A frame's worth of samples, a little more than the game makes so the
+    // audio events never pile up
+    void PlayFrame()
+    {
+        if (_callback != nullptr)
+        {
+            _callback(_callbackData, _samples.data(), (int)_samples.size());
+        }
+    }
+
+private:
+    static const int SampleRate = 44100;
+
+    AudioCallback* _callback;
+    void* _callbackData;
+    std::vector<u8> _samples;
+};
+
+// One rom of the suite, see ReadSuite
+struct SuiteEntry
+{
+    std::string rom;
+    std::string movie;
+    unsigned int frames;
+
+    // Loaded before anything is run
+    NPtr<MemoryRomFile> romFile;
+    std::vector<u8> input;
+};
+
+struct SuiteRun
+{
+    double seconds;
+    u64 instructions;
+    u64 dots;
+    u64 hash;
+};
+
+// One entry per line as key=value pairs, # starts a comment:
+//   rom=game.nes movie=run.inp frames=3000
+// Without a movie the rom gets MakeInput's made up input
+static bool ReadSuite(const char* path, unsigned int frames, std::vector<SuiteEntry>& entries)
+{
+    std::ifstream stream(path);
+    if (!stream.is_open())
+    {
+        fprintf(stderr, "Unable to open %s\n", path);
+        return false;
+    }
+
+    std::string line;
+    for (unsigned int lineNumber = 1; std::getline(stream, line); lineNumber++)
+    {
+        line = line.substr(0, line.find('#'));
+
+        SuiteEntry entry;
+        entry.frames = frames;
+        std::istringstream fields(line);
+        std::string field;
+        bool empty = true;
+        while (fields >> field)
+        {
+            empty = false;
+            size_t equals = field.find('=');
+            std::string key = field.substr(0, equals);
+            std::string value = equals == std::string::npos ? "" : field.substr(equals + 1);
+
+            if (key == "rom") entry.rom = value;
+            else if (key == "movie") entry.movie = value;
+            else if (key == "frames") entry.frames = (unsigned int)strtoul(value.c_str(), nullptr, 10);
+            else
+            {
+                fprintf(stderr, "%s:%u: unknown field '%s'\n", path, lineNumber, key.c_str());
+                return false;
+            }
+        }
+
+        if (empty)
+        {
+            continue;
+        }
+
+        if (entry.rom.empty())
+        {
+            fprintf(stderr, "%s:%u: entry has no rom\n", path, lineNumber);
+            return false;
+        }
+        entries.push_back(entry);
+    }
+    return true;
+}
+
+// Opens the entry's rom and movie, and checks the rom will run
+static bool LoadSuiteEntry(SuiteEntry& entry)
+{
+    NPtr<Nes> nes;
+    if (!MemoryRomFile::Create(entry.rom.c_str(), &entry.romFile) ||
+        !Nes::Create(static_cast<IRomFile*>(entry.romFile), nullptr, &nes))
+    {
+        fprintf(stderr, "Unable to load %s\n", entry.rom.c_str());
+        return false;
+    }
+    nes->Dispose();
+
+    if (entry.movie.empty())
+    {
+        MakeInput(entry.frames, entry.input);
+        return true;
+    }
+
+    std::ifstream movie(entry.movie, std::ios::binary);
+    if (!movie.is_open())
+    {
+        fprintf(stderr, "Unable to open %s\n", entry.movie.c_str());
+        return false;
+    }
+    entry.input.assign(std::istreambuf_iterator<char>(movie), std::istreambuf_iterator<char>());
+
+    // Past the end of the movie nothing is pressed
+    entry.input.resize(entry.frames, 0);
+    return true;
+}
+
+// Play the entry's input from power on, drawing every frame
+static bool RunSuiteEntry(MemoryRomFile* romFile, const std::vector<u8>& input, bool audio, SuiteRun& run)
+{
+    NPtr<BenchAudioProvider> audioProvider(audio ? new BenchAudioProvider() : nullptr);
+    NPtr<Nes> nes;
+    if (!Nes::Create(static_cast<IRomFile*>(romFile), audioProvider, &nes))
+    {
+        return false;
+    }
+
+    IStandardController* controller = nes->GetStandardController(0);
+    std::vector<u8> screen(256 * 240 * 4);
+    unsigned int flags = audio ? NES_FRAME_DEFAULT : NES_FRAME_NO_AUDIO;
+
+    Clock::time_point begin = Clock::now();
+    for (u8 buttons : input)
+    {
+        controller->SetButtons(buttons);
+        nes->DoFrame(screen.data(), flags);
+        if (audio)
+        {
+            audioProvider->PlayFrame();
+        }
+    }
+    run.seconds = Seconds(begin);
+    run.instructions = nes->InstructionCount();
+    run.dots = nes->PpuDotCount();
+    run.hash = nes->StateHash();
+
+    nes->Dispose();
+    return true;
+}
+
+static void Statistics(std::vector<double> values, double& median, double& stddev)
+{
+    std::sort(values.begin(), values.end());
+    size_t count = values.size();
+    median = count % 2 == 1 ? values[count / 2] : (values[count / 2 - 1] + values[count / 2]) / 2;
+
+    double mean = 0;
+    for (double value : values)
+    {
+        mean += value;
+    }
+    mean /= count;
+
+    double variance = 0;
+    for (double value : values)
+    {
+        variance += (value - mean) * (value - mean);
+    }
+    stddev = count > 1 ? sqrt(variance / (count - 1)) : 0;
+}
+
+static void PrintJsonStatistics(const char* name, const std::vector<double>& values, bool last)
+{
+    double median;
+    double stddev;
+    Statistics(values, median, stddev);
+    printf("      \"%s\": { \"median\": %.6g, \"stddev\": %.6g }%s\n", name, median, stddev, last ? "" : ",");
+}
+
+static std::string JsonString(const std::string& value)
+{
+    std::string quoted = "\"";
+    for (char c : value)
+    {
+        if (c == '"' || c == '\\')
+        {
+            quoted += '\\';
+        }
+        quoted += c;
+    }
+    return quoted + "\"";
+}
+
+// Every rom in the suite runs runs times from power on, each time in a new
+// Nes, and the timings are reported as JSON on stdout. The state hash at the
+// end has to be the same every run, and is worth comparing between builds:
+// a change that alters it changed what the emulator does, not just how fast.
+static bool BenchmarkSuite(const char* suitePath, unsigned int frames, unsigned int runs, bool audio)
+{
+    std::vector<SuiteEntry> entries;
+    if (!ReadSuite(suitePath, frames, entries))
+    {
+        return false;
+    }
+
+    if (entries.empty() || runs == 0)
+    {
+        fprintf(stderr, "Nothing to run.\n");
+        return false;
+    }
+
+    // Everything is opened first, so a bad entry leaves no partial JSON
+    for (SuiteEntry& entry : entries)
+    {
+        if (!LoadSuiteEntry(entry))
+        {
+            return false;
+        }
+    }
+
+    printf("{\n");
+    printf("  \"suite\": %s,\n", JsonString(suitePath).c_str());
+    printf("  \"runs\": %u,\n", runs);
+    printf("  \"audio\": %s,\n", audio ? "true" : "false");
+    printf("  \"roms\": [\n");
+
+    bool ok = true;
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        const SuiteEntry& entry = entries[i];
+
+        std::vector<SuiteRun> results(runs);
+        for (SuiteRun& run : results)
+        {
+            if (!RunSuiteEntry(entry.romFile, entry.input, audio, run))
+            {
+                fprintf(stderr, "Unable to run %s\n", entry.rom.c_str());
+                return false;
+            }
+        }
+
+        bool deterministic = true;
+        std::vector<double> seconds;
+        std::vector<double> framesPerSecond;
+        std::vector<double> instructionsPerSecond;
+        std::vector<double> dotsPerSecond;
+        for (const SuiteRun& run : results)
+        {
+            deterministic = deterministic && run.hash == results[0].hash;
+            seconds.push_back(run.seconds);
+            framesPerSecond.push_back(entry.frames / run.seconds);
+            instructionsPerSecond.push_back(run.instructions / run.seconds);
+            dotsPerSecond.push_back(run.dots / run.seconds);
+        }
+        ok = ok && deterministic;
+
+        printf("    {\n");
+        printf("      \"rom\": %s,\n", JsonString(entry.rom).c_str());
+        printf("      \"movie\": %s,\n", entry.movie.empty() ? "null" : JsonString(entry.movie).c_str());
+        printf("      \"frames\": %u,\n", entry.frames);
+        printf("      \"instructions\": %llu,\n", results[0].instructions);
+        printf("      \"ppuDots\": %llu,\n", results[0].dots);
+        printf("      \"stateHash\": \"%016llx\",\n", results[0].hash);
+        printf("      \"deterministic\": %s,\n", deterministic ? "true" : "false");
+        PrintJsonStatistics("wallSeconds", seconds, false);
+        PrintJsonStatistics("framesPerSecond", framesPerSecond, false);
+        PrintJsonStatistics("instructionsPerSecond", instructionsPerSecond, false);
+        PrintJsonStatistics("ppuDotsPerSecond", dotsPerSecond, true);
+        printf("    }%s\n", i + 1 < entries.size() ? "," : "");
+    }
+
+    printf("  ]\n");
+    printf("}\n");
+    return ok;
+}
+
+// Follows the code in every 16KB bank of PRG ROM and lists them, the last
+// bank at $C000 where it sits at power on and the rest at $8000. Banks
+// other than the last are only followed from their first byte. The
+// listing is written to listingPath if there is one.
+static bool BenchmarkDisassembly(const char* romPath, const char* listingPath)
+{
+    static const u32 BankSize = 0x4000;
+
+    NPtr<MemoryRomFile> romFile;
+    NPtr<Rom> rom;
+    if (!MemoryRomFile::Create(romPath, &romFile) || !Rom::Create(romFile, &rom))
+    {
+        printf("Unable to load %s\n", romPath);
+        return false;
+    }
+
+    const std::vector<u8>& prg = rom->PrgRom;
+    u32 banks = (u32)(prg.size() / BankSize);
+    std::vector<u8> code(prg.size());
+    std::string listing;
+    std::vector<char> bankListing(BankSize * LIST_SIZE_PER_BYTE);
+
+    // Enough passes to time
+    u32 passes = 0;
+    size_t codeBytes = 0;
+    Clock::time_point start = Clock::now();
+    do
+    {
+        memset(code.data(), 0, code.size());
+        listing.clear();
+
+        for (u32 bank = 0; bank < banks; bank++)
+        {
+            u16 base = bank == banks - 1 ? 0xc000 : 0x8000;
+            const u8* bankPrg = prg.data() + bank * BankSize;
+            u8* bankCode = code.data() + bank * BankSize;
+
+            Disassembler::TraceCode(bankPrg, BankSize, base, &base, 1, bankCode);
+            size_t listed = Disassembler::List(bankPrg, BankSize, base, bankCode, bankListing.data());
+
+            char header[32];
+            snprintf(header, sizeof(header), "; bank %u\n", bank);
+            listing += header;
+            listing.append(bankListing.data(), listed);
+        }
+        passes++;
+    } while (Seconds(start) < 0.25);
+    double seconds = Seconds(start) / passes;
+
+    for (u32 i = 0; i < code.size(); i++)
+    {
+        codeBytes += code[i] == CODE_INSTRUCTION ? Disassembler::Opcode(prg[i]).Length : 0;
+    }
+
+    printf("disassembly: %u banks, %.1f%% reached as code, %zu bytes of listing, %.0f MB/s of PRG ROM\n",
+        banks,
+        100.0 * codeBytes / prg.size(),
+        listing.size(),
+        MBPerSecond(prg.size(), seconds));
+
+    if (listingPath != nullptr)
+    {
+        std::ofstream stream(listingPath, std::ios::binary | std::ios::trunc);
+        stream.write(listing.data(), listing.size());
+        if (!stream.good())
+        {
+            printf("Unable to write %s\n", listingPath);
+            return false;
+        }
+    }
+    return true;
+}
+
+static const u16 NetplayUdpPorts[2] = { 7780, 7781 };
+
+static void PrintNetplayStats(unsigned int player, const NetplayStats& stats)
+{
+    printf("  player %u: %u frames, %u rollbacks (%u frames run again, longest %u), %u stalls\n",
+        player, stats.frame, stats.rollbacks, stats.framesResimulated, stats.longestRollback, stats.stalls);
+    printf("            %u packets sent, %u received, %u state hashes compared\n",
+        stats.packetsSent, stats.packetsReceived, stats.hashesCompared);
+}
+
+// Plays frames on both ends of a link, a frame a side every 60th of a second
+// as a game would, with different made up input for each player. A side
+// that gets there first keeps going, so the other still hears from it.
+// returns: false if the two sides went out of sync
+static bool RunNetplayPair(const char* romPath, INetplayTransport* first, INetplayTransport* second, unsigned int frames)
+{
+    static const std::chrono::microseconds FrameTime(16667);
+
+    NPtr<Nes> nes[2];
+    NPtr<NetplaySession> sessions[2];
+    INetplayTransport* transports[2] = { first, second };
+    for (unsigned int player = 0; player < 2; player++)
+    {
+        if (!Nes::Create(romPath, nullptr, &nes[player]))
+        {
+            printf("Unable to load %s\n", romPath);
+            return false;
+        }
+
+        NetplayConfig config;
+        config.localPort = player;
+        sessions[player] = new NetplaySession(nes[player], transports[player], config);
+    }
+
+    std::vector<u8> input;
+    MakeInput(frames, input);
+    std::vector<u8> screen(256 * 240 * 4);
+
+    Clock::time_point tick = Clock::now();
+    while (sessions[0]->Stats().frame < frames || sessions[1]->Stats().frame < frames)
+    {
+        for (unsigned int player = 0; player < 2; player++)
+        {
+            u32 frame = sessions[player]->Stats().frame;
+            sessions[player]->DoFrame(input[(frame + player * frames / 2) % frames], screen.data());
+        }
+
+        tick += FrameTime;
+        std::this_thread::sleep_until(tick);
+    }
+
+    PrintNetplayStats(1, sessions[0]->Stats());
+    PrintNetplayStats(2, sessions[1]->Stats());
+
+    bool inSync = true;
+    for (unsigned int player = 0; player < 2; player++)
+    {
+        u32 desyncFrame = sessions[player]->DesyncFrame();
+        if (desyncFrame != NetplaySession::NoFrame)
+        {
+            printf("  player %u saw a desync at frame %u\n", player + 1, desyncFrame);
+            inSync = false;
+        }
+        sessions[player].Release();
+        nes[player]->Dispose();
+    }
+    if (inSync)
+    {
+        printf("  no desync\n");
+    }
+    return inSync;
+}
+
+// Two players on one machine, in real time: first over an in-process link
+// that holds packets back for delayMs and drops them at lossRate, then over
+// UDP on 127.0.0.1, which adds neither.
+static bool BenchmarkNetplay(const char* romPath, unsigned int frames, u32 delayMs, float lossRate)
+{
+    if (frames == 0)
+    {
+        return true;
+    }
+
+    NPtr<LoopbackTransport> loopback[2];
+    LoopbackTransport::CreatePair(delayMs, lossRate, &loopback[0], &loopback[1]);
+    printf("netplay over loopback, %u ms delay, %.0f%% loss, %u frames\n", delayMs, lossRate * 100, frames);
+    bool ok = RunNetplayPair(romPath, loopback[0], loopback[1], frames);
+
+    NPtr<UdpTransport> udp[2];
+    if (!UdpTransport::Create(NetplayUdpPorts[0], "127.0.0.1", NetplayUdpPorts[1], &udp[0])
+        || !UdpTransport::Create(NetplayUdpPorts[1], "127.0.0.1", NetplayUdpPorts[0], &udp[1]))
+    {
+        return false;
+    }
+    printf("netplay over udp on 127.0.0.1:%u and :%u, %u frames\n", NetplayUdpPorts[0], NetplayUdpPorts[1], frames);
+    return RunNetplayPair(romPath, udp[0], udp[1], frames) && ok;
+}
+
+static bool BenchmarkLockstep(const char* romPath, unsigned int lanes, unsigned int frames)
+{
+    NPtr<MemoryRomFile> romFile;
+    NPtr<Rom> rom;
+    if (!MemoryRomFile::Create(romPath, &romFile) || !Rom::Create(romFile, &rom))
+    {
+        printf("Unable to load %s\n", romPath);
+        return false;
+    }
+
+    // LockstepCpu has no mapper
+    if (rom->Header.MapperNumber() != 0)
+    {
+        printf("Lockstep needs a mapper 0 rom.\n");
+        return false;
+    }
+
+    if (lanes == 8)
+    {
+        BenchmarkLockstep<8>(rom->PrgRom, frames, true);
+        BenchmarkLockstep<8>(rom->PrgRom, frames, false);
+    }
+    else if (lanes == 16)
+    {
+        BenchmarkLockstep<16>(rom->PrgRom, frames, true);
+        BenchmarkLockstep<16>(rom->PrgRom, frames, false);
+    }
+    else
+    {
+        printf("Lockstep runs 8 or 16 lanes.\n");
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    const char* romPath = nullptr;
+    const char* suitePath = nullptr;
+    unsigned int frames = 3000;
+    unsigned int lanes = 0;
+    unsigned int runs = 5;
+    unsigned int profileTop = 0;
+    const char* listingPath = nullptr;
+    bool parallel = false;
+    bool audio = false;
+    bool netplay = false;
+    u32 netplayDelay = 0;
+    float netplayLoss = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--suite") == 0 && i + 1 < argc)
+        {
+            suitePath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc)
+        {
+            runs = (unsigned int)atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--audio") == 0)
+        {
+            audio = true;
+        }
+        else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+        {
+            frames = (unsigned int)atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--lockstep") == 0 && i + 1 < argc)
+        {
+            lanes = (unsigned int)atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--parallel") == 0)
+        {
+            parallel = true;
+        }
+        else if (strcmp(argv[i], "--netplay") == 0)
+        {
+            netplay = true;
+        }
+        else if (strcmp(argv[i], "--delay") == 0 && i + 1 < argc)
+        {
+            netplayDelay = (u32)atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--loss") == 0 && i + 1 < argc)
+        {
+            netplayLoss = (float)atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--listing") == 0 && i + 1 < argc)
+        {
+            listingPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc)
+        {
+            profileTop = (unsigned int)atoi(argv[++i]);
+        }
+        else if (argv[i][0] != '-' && romPath == nullptr)
+        {
+            romPath = argv[i];
+        }
+    }
+
+    if (suitePath != nullptr)
+    {
+        return BenchmarkSuite(suitePath, frames, runs, audio) ? 0 : -1;
+    }
+
+    if (romPath == nullptr)
+    {
+        printf("Must provide path to ROM file.\n");
+        printf("usage: nesbench <rom> [--frames <count>] [--lockstep <8|16>] [--parallel]\n");
+        printf("       nesbench <rom> --profile <top> [--frames <count>]\n");
+        printf("       nesbench <rom> --listing <file>\n");
+        printf("       nesbench <rom> --netplay [--delay <ms>] [--loss <0-1>] [--frames <count>]\n");
+        printf("       nesbench --suite <file> [--frames <count>] [--runs <count>] [--audio]\n");
+        return -1;
+    }
+
+    if (lanes != 0)
+    {
+        return BenchmarkLockstep(romPath, lanes, frames) ? 0 : -1;
+    }
+
+    if (listingPath != nullptr)
+    {
+        return BenchmarkDisassembly(romPath, listingPath) ? 0 : -1;
+    }
+
+    if (netplay)
+    {
+        return BenchmarkNetplay(romPath, frames, netplayDelay, netplayLoss) ? 0 : -1;
+    }
+
+    NPtr<Nes> nes;
+    if (!Nes::Create(romPath, nullptr, &nes))
+    {
+        printf("Unable to load %s\n", romPath);
+        return -1;
+    }
+
+    if (profileTop != 0)
+    {
+        BenchmarkCpuProfile(nes, frames, profileTop);
+    }
+    else if (parallel)
+    {
+        BenchmarkParallelRendering(nes, frames);
+    }
+    else
+    {
+        BenchmarkRendering(nes, frames);
+        BenchmarkCounters(nes, frames);
+        BenchmarkSaveStates(nes, frames);
+        BenchmarkDisassembly(romPath, nullptr);
+    }
+
+    nes->Dispose();
+    return 0;
+}
\ No newline at end of file
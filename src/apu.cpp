@@ -1,6 +1,7 @@
 #include "stdafx.h"
 #include "audio.h"
 #include "apu.h"
+#include "counters.h"
 
 //#define APU_LOGGING
 
@@ -52,6 +53,7 @@ struct ApuPulseState
     bool sweepReset;
     bool negate;
     u32 volume;
+    int dutyCycle;
 
     // Last states written to audio engine
     // We don't save/load these because we don't directly save the audio engine state
@@ -64,7 +66,7 @@ struct ApuPulseState
     int dutyCycleSetting;
     int phaseResetSetting;
 
-    void SaveState(std::ofstream& ofs)
+    void SaveState(std::ostream& ofs)
     {
         Util::WriteBytes(lengthCounter, ofs);
         Util::WriteBytes(wavelength, ofs);
@@ -76,9 +78,10 @@ struct ApuPulseState
         Util::WriteBytes(sweepReset, ofs);
         Util::WriteBytes(negate, ofs);
         Util::WriteBytes(volume, ofs);
+        Util::WriteBytes(dutyCycle, ofs);
     }
 
-    void LoadState(std::ifstream& ifs)
+    void LoadState(std::istream& ifs)
     {
         Util::ReadBytes(lengthCounter, ifs);
         Util::ReadBytes(wavelength, ifs);
@@ -90,6 +93,7 @@ struct ApuPulseState
         Util::ReadBytes(sweepReset, ifs);
         Util::ReadBytes(negate, ifs);
         Util::ReadBytes(volume, ifs);
+        Util::ReadBytes(dutyCycle, ifs);
     }
 };
 
@@ -103,7 +107,7 @@ struct ApuTriangleState
     bool haltCounter;
     bool reloadCounter;
 
-    void SaveState(std::ofstream& ofs)
+    void SaveState(std::ostream& ofs)
     {
         Util::WriteBytes(lengthCounter, ofs);
         Util::WriteBytes(linearCounter, ofs);
@@ -114,7 +118,7 @@ struct ApuTriangleState
         Util::WriteBytes(reloadCounter, ofs);
     }
 
-    void LoadState(std::ifstream& ifs)
+    void LoadState(std::istream& ifs)
     {
         Util::ReadBytes(lengthCounter, ifs);
         Util::ReadBytes(linearCounter, ifs);
@@ -137,7 +141,7 @@ struct ApuNoiseState
     u32 lastPeriod;
     u32 lastVolume;
 
-    void SaveState(std::ofstream& ofs)
+    void SaveState(std::ostream& ofs)
     {
         Util::WriteBytes(lengthCounter, ofs);
         Util::WriteBytes(lengthDisabled, ofs);
@@ -145,7 +149,7 @@ struct ApuNoiseState
         Util::WriteBytes(volume, ofs);
     }
 
-    void LoadState(std::ifstream& ifs)
+    void LoadState(std::istream& ifs)
     {
         Util::ReadBytes(lengthCounter, ifs);
         Util::ReadBytes(lengthDisabled, ifs);
@@ -172,7 +176,7 @@ struct ApuDmcState
     u8 shiftRegister;
     u8 outputLevel;
 
-    void SaveState(std::ofstream& ofs)
+    void SaveState(std::ostream& ofs)
     {
         Util::WriteBytes(enabled, ofs);
         Util::WriteBytes(interrupt, ofs);
@@ -191,7 +195,7 @@ struct ApuDmcState
         Util::WriteBytes(outputLevel, ofs);
     }
 
-    void LoadState(std::ifstream& ifs)
+    void LoadState(std::istream& ifs)
     {
         Util::ReadBytes(enabled, ifs);
         Util::ReadBytes(interrupt, ifs);
@@ -221,7 +225,7 @@ struct ApuEnvelop
     bool haltCounter;
     bool constantVolume;
 
-    void SaveState(std::ofstream& ofs)
+    void SaveState(std::ostream& ofs)
     {
         Util::WriteBytes(envelopDivider, ofs);
         Util::WriteBytes(dividerCounter, ofs);
@@ -232,7 +236,7 @@ struct ApuEnvelop
         Util::WriteBytes(constantVolume, ofs);
     }
 
-    void LoadState(std::ifstream& ifs)
+    void LoadState(std::istream& ifs)
     {
         Util::ReadBytes(envelopDivider, ifs);
         Util::ReadBytes(dividerCounter, ifs);
@@ -255,6 +259,8 @@ Apu::Apu(bool isPal, IAudioProvider* audioProvider)
     , _nextSubframeTimer(0)
     , _isPal(isPal)
     , _lastTriangleFreq(0)
+    , _audioSuppressed(false)
+    , _audioEventsDropped(false)
 {
     _pulseState1 = new ApuPulseState();
     _pulseState2 = new ApuPulseState();
@@ -419,6 +425,8 @@ void Apu::storeb(u16 addr, u8 val)
 
 void Apu::Step(u32 &cycles, bool isDmaRunning, ApuStepResult& result)
 {
+    COUNT_CALL(NES_COUNTER_APU_STEP);
+
     u32 totalStealCycles = 0;
     for (u32 count = 0; count < cycles; count++)
     {
@@ -442,10 +450,8 @@ void Apu::Step(bool isDmaRunning, ApuStepResult& result, u32 &stealCycleCount)
         _nextSubframeTimer--;
 }
 
-void Apu::SaveState(std::ofstream& ofs)
+void Apu::SaveState(std::ostream& ofs)
 {
-    PauseAudio();
-
     Util::WriteBytes(_frameCounterMode1, ofs);
     Util::WriteBytes(_frameInterrupt, ofs);
     Util::WriteBytes(_frameInterruptInhibit, ofs);
@@ -457,17 +463,15 @@ void Apu::SaveState(std::ofstream& ofs)
     _pulseState1->SaveState(ofs);
     _pulseState2->SaveState(ofs);
     _triangleState->SaveState(ofs);
+    _noiseState->SaveState(ofs);
     _dmcState->SaveState(ofs);
     _pulseEnvelop1->SaveState(ofs);
     _pulseEnvelop2->SaveState(ofs);
-
-    UnpauseAudio();
+    _noiseEnvelop->SaveState(ofs);
 }
 
-void Apu::LoadState(std::ifstream& ifs)
+void Apu::LoadState(std::istream& ifs)
 {
-    PauseAudio();
-
     Util::ReadBytes(_frameCounterMode1, ifs);
     Util::ReadBytes(_frameInterrupt, ifs);
     Util::ReadBytes(_frameInterruptInhibit, ifs);
@@ -479,21 +483,56 @@ void Apu::LoadState(std::ifstream& ifs)
     _pulseState1->LoadState(ifs);
     _pulseState2->LoadState(ifs);
     _triangleState->LoadState(ifs);
+    _noiseState->LoadState(ifs);
     _dmcState->LoadState(ifs);
     _pulseEnvelop1->LoadState(ifs);
     _pulseEnvelop2->LoadState(ifs);
+    _noiseEnvelop->LoadState(ifs);
 
     // Force frame reset and Send loaded settings to audio engine
     QueueAudioEvent(NESAUDIO_FRAME_RESET, 0);
+    SyncAudioEngine();
+}
+
+#if defined(NES_COUNTERS)
+void Apu::SetCounters(CounterSet* counters)
+{
+    _audioEngine->SetCounters(counters);
+}
+#endif
+
+void Apu::SuppressAudio(bool suppress)
+{
+    _audioSuppressed = suppress;
+
+    if (!_audioSuppressed && _audioEventsDropped)
+    {
+        // The audio engine missed everything that happened while we were suppressed.
+        // Bring it back in line with the current channel state.
+        _audioEventsDropped = false;
+        SyncAudioEngine();
+    }
+}
+
+void Apu::SyncAudioEngine()
+{
     QueueAudioEvent(NESAUDIO_DMC_VALUE, _dmcState->outputLevel);
-    QueueAudioEvent(NESAUDIO_PULSE1_DUTYCYCLE, _pulseState1->dutyCycleSetting);
-    QueueAudioEvent(NESAUDIO_PULSE2_DUTYCYCLE, _pulseState2->dutyCycleSetting);
+    QueueAudioEvent(NESAUDIO_PULSE1_DUTYCYCLE, _pulseState1->dutyCycle);
+    QueueAudioEvent(NESAUDIO_PULSE2_DUTYCYCLE, _pulseState2->dutyCycle);
+
+    // Invalidate the last values sent so that the Update functions resend everything
+    _pulseState1->lastFrequency = 0xffffffff;
+    _pulseState1->lastVolume = 0xffffffff;
+    _pulseState2->lastFrequency = 0xffffffff;
+    _pulseState2->lastVolume = 0xffffffff;
+    _noiseState->lastPeriod = 0xffffffff;
+    _noiseState->lastVolume = 0xffffffff;
+    _lastTriangleFreq = 0xffffffff;
+
     UpdatePulse(_pulseState1);
     UpdatePulse(_pulseState2);
     UpdateTriangle();
     UpdateNoise();
-
-    UnpauseAudio();
 }
 
 u8 Apu::ReadApuStatus()
@@ -586,6 +625,7 @@ void Apu::WriteApuPulse0(u8 val, ApuEnvelop* envelop, ApuPulseState* state)
     envelop->envelopDivider = volumeOrDivider;
     envelop->constantVolume = constantVolumeFlag;
 
+    state->dutyCycle = dutyCycle;
     QueueAudioEvent(state->dutyCycleSetting, dutyCycle);
 }
 
@@ -1091,6 +1131,12 @@ void Apu::UpdateNoise()
 
 void Apu::QueueAudioEvent(int setting, u32 newValue)
 {
+    if (_audioSuppressed)
+    {
+        _audioEventsDropped = true;
+        return;
+    }
+
     _audioEngine->QueueAudioEvent(_frameCycleCount, setting, newValue);
 }
 
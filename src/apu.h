@@ -3,6 +3,7 @@
 #include "mem.h"
 
 class AudioEngine;
+struct CounterSet;
 struct IAudioProvider;
 struct ApuPulseState;
 struct ApuTriangleState;
@@ -37,6 +38,14 @@ public:
     void PauseAudio();
     void UnpauseAudio();
 
+    // While suppressed no audio events are sent to the audio engine.
+    // Used for frames that are emulated but never heard (run-ahead).
+    void SuppressAudio(bool suppress);
+
+#if defined(NES_COUNTERS)
+    void SetCounters(CounterSet* counters);
+#endif
+
     // Emulator interface
     virtual u8 loadb(u16 addr);
     virtual void storeb(u16 addr, u8 val);
@@ -45,8 +54,8 @@ public:
     void Step(bool isDmaRunning, ApuStepResult& result, u32 &stealCycleCount);
 
     // SaveState / LoadState
-    void SaveState(std::ofstream& ofs);
-    void LoadState(std::ifstream& ifs);
+    void SaveState(std::ostream& ofs);
+    void LoadState(std::istream& ifs);
 private:
 
     // Registers
@@ -92,6 +101,7 @@ private:
     void UpdatePulse(ApuPulseState* state);
     void UpdateNoise();
     void QueueAudioEvent(int setting, u32 newValue);
+    void SyncAudioEngine();
     u32 WavelengthToFrequency(bool isTriangle, int wavelength);
 
     // APU state information:
@@ -112,6 +122,8 @@ private:
     ApuEnvelop* _pulseEnvelop2;
     ApuEnvelop* _noiseEnvelop;
     u32 _lastTriangleFreq;
+    bool _audioSuppressed;
+    bool _audioEventsDropped;
 
     // Emulator information:
     bool _isPal;
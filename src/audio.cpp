@@ -1,5 +1,6 @@
 #include "stdafx.h"
 #include "audio.h"
+#include "counters.h"
 
 //#define SOUND_EVENT_TRACE
 
@@ -11,7 +12,7 @@
 
 #define MAX_FRAME_CYCLE_COUNT 38000 // Larger than max frame clock cycle count, but can't exceed max unsigned 16-bit integer
 
-static void AudioGenerateCallback(void *userdata, u8 *stream, int len)
+void AudioGenerateCallback(void *userdata, u8 *stream, int len)
 {
     ((AudioEngine*)userdata)->ExecuteCallback(stream, len);
 }
@@ -139,6 +140,10 @@ AudioEngine::AudioEngine(IAudioProvider* audioProvider)
     , _cycleCounter(0)
     , _wavetableMemory(nullptr)
 {
+#if defined(NES_COUNTERS)
+    _counters = nullptr;
+#endif
+
     memset(&_nextEvent, 0, sizeof(AudioEvent));
     memset(&_pulseChannel1, 0, sizeof(WavetableChannel));
     memset(&_pulseChannel2, 0, sizeof(WavetableChannel));
@@ -418,6 +423,10 @@ void AudioEngine::GenarateOtherPulseTables()
 
 void AudioEngine::ExecuteCallback(u8 *stream, int len)
 {
+#if defined(NES_COUNTERS)
+    AudioCounterScope counting(_counters);
+#endif
+
     for (;;)
     {
         // Generate samples
@@ -4,6 +4,7 @@
 #include "interfaces.h"
 
 struct IAudioProvider;
+struct CounterSet;
 class FilterChain;
 
 enum WavetableIndex
@@ -88,6 +89,10 @@ public:
 
     void QueueAudioEvent(int cycleCount, int setting, u32 newValue);
 
+#if defined(NES_COUNTERS)
+    void SetCounters(CounterSet* counters) { _counters = counters; }
+#endif
+
 private:
     void InitializeTables();
     void InitializeChannels();
@@ -111,6 +116,9 @@ private:
 private:
     // Audio device info
     NPtr<IAudioProvider> _audioProvider;
+#if defined(NES_COUNTERS)
+    CounterSet* _counters;
+#endif
     bool _audioStarted;
     int _sampleRate;
     u8 _silenceValue;
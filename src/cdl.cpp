@@ -0,0 +1,22 @@
+#include "stdafx.h"
+#include "cdl.h"
+#include "rom.h"
+
+CodeDataLog::CodeDataLog(Rom* rom, IMapper* mapper)
+    : _prg(rom->PrgRom.size(), 0)
+    , _chr(rom->ChrRom.size(), 0)
+    , _mapper(mapper)
+{
+}
+
+void CodeDataLog::Clear()
+{
+    std::fill(_prg.begin(), _prg.end(), 0);
+    std::fill(_chr.begin(), _chr.end(), 0);
+}
+
+void CodeDataLog::Write(std::ostream& out)
+{
+    out.write((const char*)_prg.data(), _prg.size());
+    out.write((const char*)_chr.data(), _chr.size());
+}
\ No newline at end of file
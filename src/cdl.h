@@ -0,0 +1,99 @@
+#pragma once
+
+#include "interfaces.h"
+
+class Rom;
+
+// Marks in a code/data log, in the layout other emulators and tools read
+// (.cdl files): a byte per byte of PrgRom, then a byte per byte of ChrRom.
+enum : u8
+{
+    // PrgRom
+    CDL_PRG_CODE = 0x01,    // run as an opcode or operand
+    CDL_PRG_DATA = 0x02,    // read by an instruction
+    CDL_PRG_SLOT = 0x0c,    // which 8KB of $8000-$ffff it was last marked at, 0-3
+
+    // ChrRom
+    CDL_CHR_RENDERED = 0x01,    // fetched by the ppu to draw a line
+    CDL_CHR_READ = 0x02,        // read by the cpu through $2007
+};
+
+// Which bytes of the rom a game has used and how, for coverage tools and
+// telling code from data in static analysis. Bytes are marked by where they
+// are in the rom, with the banks as they were when they were used, so a
+// mark is an OR into a byte map plus the mapper's offset lookup.
+// Nothing is marked for cart ram or chr ram.
+class CodeDataLog : public NesObject
+{
+public:
+    CodeDataLog(Rom* rom, IMapper* mapper);
+
+public:
+    DELEGATE_NESOBJECT_REFCOUNTING();
+
+    // An instruction of length bytes at pc, before it runs
+    void LogCode(u16 pc, u32 length)
+    {
+        if (pc < 0x8000)
+        {
+            return;
+        }
+
+        // Banks are no smaller than 8KB, so an instruction inside one 8KB
+        // slot is all in one bank
+        u8 mark = CDL_PRG_CODE | Slot(pc);
+        if ((pc & 0x1fff) + length <= 0x2000)
+        {
+            u8* bytes = &_prg[_mapper->prg_rom_offset(pc)];
+            for (u32 i = 0; i < length; i++)
+            {
+                bytes[i] |= mark;
+            }
+        }
+        else
+        {
+            for (u32 i = 0; i < length && (u16)(pc + i) >= 0x8000; i++)
+            {
+                u16 addr = (u16)(pc + i);
+                _prg[_mapper->prg_rom_offset(addr)] |= CDL_PRG_CODE | Slot(addr);
+            }
+        }
+    }
+
+    // A read by an instruction, or dma
+    void LogData(u16 addr)
+    {
+        if (addr >= 0x8000)
+        {
+            _prg[_mapper->prg_rom_offset(addr)] |= CDL_PRG_DATA | Slot(addr);
+        }
+    }
+
+    // A ppu read below $2000, mark is CDL_CHR_RENDERED or CDL_CHR_READ
+    void LogChr(u16 addr, u8 mark)
+    {
+        if (!_chr.empty())
+        {
+            _chr[_mapper->chr_rom_offset(addr)] |= mark;
+        }
+    }
+
+    void Clear();
+
+    const std::vector<u8>& Prg() { return _prg; }
+    const std::vector<u8>& Chr() { return _chr; }
+
+    // The log as a .cdl file
+    void Write(std::ostream& out);
+
+private:
+    static u8 Slot(u16 addr)
+    {
+        return (addr >> 11) & CDL_PRG_SLOT;
+    }
+
+private:
+    std::vector<u8> _prg;
+    std::vector<u8> _chr;
+    NPtr<IMapper> _mapper;
+};
\ No newline at end of file
@@ -0,0 +1,55 @@
+#include "stdafx.h"
+#include "counters.h"
+
+#if defined(NES_COUNTERS)
+
+thread_local CounterSet* CounterScope::Current = nullptr;
+
+CounterSet::CounterSet()
+    : AudioCalls(0)
+    , AudioNanoseconds(0)
+{
+    Reset();
+}
+
+void CounterSet::Reset()
+{
+    memset(Frame, 0, sizeof(Frame));
+    memset(Total, 0, sizeof(Total));
+    Frames = 0;
+
+    // The audio thread may be adding as this runs, so skip what it has done
+    // rather than clear it
+    AudioCallsCounted = AudioCalls;
+    AudioNanosecondsCounted = AudioNanoseconds;
+}
+
+CounterFrame::CounterFrame(CounterSet& set)
+    : _set(set)
+    , _previous(CounterScope::Current)
+{
+    memset(_set.Frame, 0, sizeof(_set.Frame));
+    CounterScope::Current = &_set;
+}
+
+CounterFrame::~CounterFrame()
+{
+    CounterScope::Current = _previous;
+
+    // Whatever the audio thread did since the last frame
+    u64 audioCalls = _set.AudioCalls;
+    u64 audioNanoseconds = _set.AudioNanoseconds;
+    _set.Frame[NES_COUNTER_AUDIO_CALLBACK].calls = audioCalls - _set.AudioCallsCounted;
+    _set.Frame[NES_COUNTER_AUDIO_CALLBACK].nanoseconds = audioNanoseconds - _set.AudioNanosecondsCounted;
+    _set.AudioCallsCounted = audioCalls;
+    _set.AudioNanosecondsCounted = audioNanoseconds;
+
+    for (u32 i = 0; i < NES_COUNTER_COUNT; i++)
+    {
+        _set.Total[i].calls += _set.Frame[i].calls;
+        _set.Total[i].nanoseconds += _set.Frame[i].nanoseconds;
+    }
+    _set.Frames++;
+}
+
+#endif
\ No newline at end of file
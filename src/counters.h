@@ -0,0 +1,104 @@
+#pragma once
+
+#include "../include/nes_interfaces.h"
+
+// Calls to and time spent in the busiest parts of the core, see INes::GetCounters.
+// Only built with NES_COUNTERS defined. Without it COUNT_CALL is nothing and
+// none of this is compiled.
+//
+// Counting is done for whichever Nes is running a frame on the current
+// thread, so many machines can run on a pool at once. The audio callback
+// runs on the audio thread and counts straight into its machine's set.
+#if defined(NES_COUNTERS)
+
+struct CounterSet
+{
+    CounterSet();
+
+    void Reset();
+
+    NesCounter Frame[NES_COUNTER_COUNT];
+    NesCounter Total[NES_COUNTER_COUNT];
+    u64 Frames;
+
+    // Kept apart from the rest as another thread adds to them
+    std::atomic<u64> AudioCalls;
+    std::atomic<u64> AudioNanoseconds;
+    u64 AudioCallsCounted;
+    u64 AudioNanosecondsCounted;
+};
+
+// Counts one call and its time, from construction to destruction
+class CounterScope
+{
+public:
+    CounterScope(NesCounterId id)
+        : _counter(Current != nullptr ? &Current->Frame[id] : nullptr)
+    {
+        if (_counter != nullptr)
+        {
+            _start = std::chrono::steady_clock::now();
+        }
+    }
+
+    ~CounterScope()
+    {
+        if (_counter != nullptr)
+        {
+            _counter->calls++;
+            _counter->nanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - _start).count();
+        }
+    }
+
+    // The set being counted into on this thread
+    static thread_local CounterSet* Current;
+
+private:
+    NesCounter* _counter;
+    std::chrono::steady_clock::time_point _start;
+};
+
+// Counts everything on this thread into set for as long as it lives, and
+// adds that to the set's totals at the end as one frame
+class CounterFrame
+{
+public:
+    CounterFrame(CounterSet& set);
+    ~CounterFrame();
+
+private:
+    CounterSet& _set;
+    CounterSet* _previous;
+};
+
+// The audio callback, from the audio thread
+class AudioCounterScope
+{
+public:
+    AudioCounterScope(CounterSet* set)
+        : _set(set)
+        , _start(std::chrono::steady_clock::now())
+    {
+    }
+
+    ~AudioCounterScope()
+    {
+        if (_set != nullptr)
+        {
+            _set->AudioCalls++;
+            _set->AudioNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - _start).count();
+        }
+    }
+
+private:
+    CounterSet* _set;
+    std::chrono::steady_clock::time_point _start;
+};
+
+#define COUNT_CALL(id) CounterScope counterScope(id)
+
+#else
+
+#define COUNT_CALL(id)
+
+#endif
\ No newline at end of file
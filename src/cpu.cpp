@@ -3,6 +3,9 @@
 #include "debug.h"
 #include "decode.h"
 #include "diassembler.h"
+#include "counters.h"
+#include "profiler.h"
+#include "trace.h"
 
 using namespace std;
 
@@ -10,8 +13,13 @@ Cpu::Cpu(
     IMem* mem,
     DebugService* debugger
     )
-    : _mem(mem)
+    : Instructions(0)
+    , _mem(mem)
     , _debugger(debugger)
+    , _bus(mem)
+    , _debugBus(new DebugBus(mem, debugger))
+    , _debugging(false)
+    , _fetchedCount(0)
     , _accumulatorAM(*this)
     , _immediateAM(*this)
     , _memoryAM(*this, 0)
@@ -29,6 +37,7 @@ void Cpu::Reset(bool hard)
     {
         Cycles = 0;
         _dmaBytesRemaining = 0;
+        _dmaReadAddress = 0;
         _regs.Reset(hard);
         _regs.PC = loadw(RESET_VECTOR);
     }
@@ -41,23 +50,23 @@ void Cpu::Reset(bool hard)
 // IMem
 u8 Cpu::loadb(u16 addr)
 {
-    return _mem->loadb(addr);
+    return _bus->loadb(addr);
 }
 
 void Cpu::storeb(u16 addr, u8 val)
 {
+    // $4014 goes through the bus too, for write breakpoints and the
+    // heatmap. Nothing behind it takes the write.
+    _bus->storeb(addr, val);
+
     if (addr == 0x4014)
     {
         Dma(val);
     }
-    else
-    {
-        _mem->storeb(addr, val);
-    }
 }
 
 // ISaveState
-void Cpu::SaveState(std::ofstream& ofs)
+void Cpu::SaveState(std::ostream& ofs)
 {
     Util::WriteBytes(_regs.A, ofs);
     Util::WriteBytes(_regs.X, ofs);
@@ -65,10 +74,12 @@ void Cpu::SaveState(std::ofstream& ofs)
     Util::WriteBytes(_regs.P, ofs);
     Util::WriteBytes(_regs.S, ofs);
     Util::WriteBytes(_regs.PC, ofs);
-    _mem->SaveState(ofs);
+    Util::WriteBytes(Cycles, ofs); // An interrupt taken at the end of a frame leaves cycles pending
+    Util::WriteBytes(_dmaBytesRemaining, ofs);
+    Util::WriteBytes(_dmaReadAddress, ofs);
 }
 
-void Cpu::LoadState(std::ifstream& ifs)
+void Cpu::LoadState(std::istream& ifs)
 {
     Util::ReadBytes(_regs.A, ifs);
     Util::ReadBytes(_regs.X, ifs);
@@ -76,7 +87,9 @@ void Cpu::LoadState(std::ifstream& ifs)
     Util::ReadBytes(_regs.P, ifs);
     Util::ReadBytes(_regs.S, ifs);
     Util::ReadBytes(_regs.PC, ifs);
-    _mem->LoadState(ifs);
+    Util::ReadBytes(Cycles, ifs);
+    Util::ReadBytes(_dmaBytesRemaining, ifs);
+    Util::ReadBytes(_dmaReadAddress, ifs);
 }
 
 void Cpu::Dma(u8 val)
@@ -85,29 +98,93 @@ void Cpu::Dma(u8 val)
     _dmaBytesRemaining = 0x0100;
 }
 
-void Cpu::Step()
+void Cpu::UpdateDebugging()
 {
-#if defined(TRACE)
-    Trace();
-#endif
+    _debugging = _debugger->Active();
+    _bus = _debugging ? static_cast<IMem*>(_debugBus) : static_cast<IMem*>(_mem);
+}
+
+template <class Policy>
+void Cpu::StepWith()
+{
+    COUNT_CALL(NES_COUNTER_CPU_STEP);
 
     if (_dmaBytesRemaining > 0)
     {
         // DMA is in progress.
         // The CPU is paused during the DMA process, but the APU and PPU continue to run.
-        storeb(0x2004, loadb(_dmaReadAddress++));
+        storeb(0x2004, LoadData(_dmaReadAddress++));
         _dmaBytesRemaining--;
         Cycles += 2;
 
         return;
     }
 
-    _debugger->OnBeforeExecuteInstruction(_regs.PC);
+    if (Policy::Debugging)
+    {
+        _debugger->OnBeforeExecuteInstruction(_regs.PC);
+
+        // Single step is over, or a breakpoint handler cleared them all
+        if (!_debugger->Active())
+        {
+            UpdateDebugging();
+        }
+    }
+
+    if (_trace != nullptr)
+    {
+        _trace->Record(_regs, Cycles);
+    }
+
+    u16 pc = _regs.PC;
+    u32 startCycles = Cycles;
+    u32 place = _profiler != nullptr ? _profiler->PlaceOf(pc) : 0;
+
+    if (Policy::Debugging)
+    {
+        _debugger->OnInstruction(pc);
+    }
+
+    _fetchedCount = 0;
     _op = LoadBBumpPC();
 
+    if (_cdl != nullptr)
+    {
+        _cdl->LogCode(pc, Disassembler::Opcode(_op).Length);
+    }
+
     DECODE(_op)
 
     Cycles += CYCLE_TABLE[_op];
+    Instructions++;
+
+    if (_trace != nullptr)
+    {
+        _trace->RecordBytes(_fetched);
+    }
+
+    if (_profiler != nullptr)
+    {
+        _profiler->Record(place, pc, _op, Cycles - startCycles);
+    }
+}
+
+template void Cpu::StepWith<Cpu::NoDebugPolicy>();
+template void Cpu::StepWith<Cpu::DebugPolicy>();
+
+void Cpu::SetProfiler(CpuProfiler* profiler)
+{
+    _profiler = profiler;
+}
+
+void Cpu::SetTrace(CpuTrace* trace)
+{
+    _trace = trace;
+}
+
+void Cpu::SetCodeDataLog(CodeDataLog* log)
+{
+    _cdl = log;
 }
 
 void Cpu::Nmi()
@@ -132,29 +209,15 @@ void Cpu::Irq()
     Cycles += 7;
 }
 
-#if defined(TRACE)
-void Cpu::Trace()
+void Cpu::unimplemented(u8 op)
 {
-    Disassembler disassembler(_regs.PC, _mem);
-
-    DisassembledInstruction* instruction = nullptr;
-    disassembler.Disassemble(&instruction);
-
-    printf("%04X %-10s %-12s A:%02x X:%02X Y:%02X P:%02X S:%02X CY:%d\n",
-        _regs.PC,
-        instruction->GetFormattedBytes().c_str(),
-        instruction->GetDisassemblyString().c_str(),
-        _regs.A,
-        _regs.X,
-        _regs.Y,
-        _regs.P,
-        _regs.S,
-        Cycles
-        );
-
-    if (instruction != nullptr)
+    printf("Unimplemented instruction: 0x%02x\n", op);
+    if (_trace != nullptr)
     {
-        delete instruction;
+        _trace->RecordBytes(_fetched);
+        std::stringstream lines;
+        _trace->Write(lines, 32);
+        printf("%s", lines.str().c_str());
     }
-}
-#endif
\ No newline at end of file
+    __debugbreak();
+}
\ No newline at end of file
@@ -1,8 +1,12 @@
 #pragma once
 
 #include "interfaces.h"
+#include "cdl.h"
 
 class DebugService;
+class DebugBus;
+class CpuProfiler;
+class CpuTrace;
 
 // Base Cycle Counts 
 static u8 CYCLE_TABLE[0x100] = {
@@ -42,6 +46,126 @@ enum class Flag : u8
     Negative    = 1 << 7
 };
 
+// What the instructions compute and how they set the flags, on a status
+// byte p. Cpu and LockstepCpu (lockstep.h) both run their instructions
+// through these, so there is one copy of the 6502's semantics.
+class CpuAlu
+{
+public:
+    static bool GetFlag(u8 p, Flag flag)
+    {
+        return (p & (u8)flag) != 0;
+    }
+
+    static void SetFlag(u8& p, Flag flag, bool on)
+    {
+        p = on ? (p | (u8)flag) : (p & ~(u8)flag);
+    }
+
+    static u8 SetZN(u8& p, u8 val)
+    {
+        SetFlag(p, Flag::Zero, val == 0);
+        SetFlag(p, Flag::Negative, (val & 0x80) != 0);
+        return val;
+    }
+
+    static u8 Adc(u8& p, u8 a, u8 val)
+    {
+        u32 result = (u32)a + (u32)val + (GetFlag(p, Flag::Carry) ? 1 : 0);
+        SetFlag(p, Flag::Carry, (result & 0x100) != 0);
+
+        u8 resultByte = result & 0xff;
+        SetFlag(p, Flag::Overflow, (((a ^ val) & 0x80) == 0) && (((a ^ resultByte) & 0x80) == 0x80));
+        return SetZN(p, resultByte);
+    }
+
+    static u8 Sbc(u8& p, u8 a, u8 val)
+    {
+        u32 result = (u32)a - (u32)val - (GetFlag(p, Flag::Carry) ? 0 : 1);
+        SetFlag(p, Flag::Carry, (result & 0x100) == 0);
+
+        u8 resultByte = result & 0xff;
+        SetFlag(p, Flag::Overflow, (((a ^ resultByte) & 0x80) != 0) && ((a ^ val) & 0x80) == 0x80);
+        return SetZN(p, resultByte);
+    }
+
+    // cmp, cpx and cpy
+    static void Compare(u8& p, u8 reg, u8 val)
+    {
+        u32 result = (u32)reg - (u32)val;
+        SetFlag(p, Flag::Carry, (result & 0x100) == 0);
+        SetZN(p, (u8)result);
+    }
+
+    static void Bit(u8& p, u8 a, u8 val)
+    {
+        SetFlag(p, Flag::Zero, (val & a) == 0);
+        SetFlag(p, Flag::Negative, (val & (1 << 7)) != 0);
+        SetFlag(p, Flag::Overflow, (val & (1 << 6)) != 0);
+    }
+
+    // asl, or rol if rotate (the old carry goes in)
+    static u8 ShiftLeft(u8& p, u8 val, bool rotate)
+    {
+        bool lsb = rotate && GetFlag(p, Flag::Carry);
+        SetFlag(p, Flag::Carry, (val & 0x80) != 0);
+        return SetZN(p, (u8)(val << 1) | (lsb ? 1 : 0));
+    }
+
+    // lsr, or ror if rotate
+    static u8 ShiftRight(u8& p, u8 val, bool rotate)
+    {
+        bool msb = rotate && GetFlag(p, Flag::Carry);
+        SetFlag(p, Flag::Carry, (val & 0x01) != 0);
+        return SetZN(p, (val >> 1) | (msb ? 0x80 : 0));
+    }
+
+    // pc is the address after the branch
+    static u16 BranchTarget(u16 pc, u8 disp)
+    {
+        return (u16)((i32)pc + (i32)(i8)disp);
+    }
+
+    // An extra cycle for indexing or branching into another page
+    static bool PageCrossed(u16 lhs, u16 rhs)
+    {
+        return (lhs & 0xff00) != (rhs & 0xff00);
+    }
+
+    // Absolute,X and absolute,Y instructions that pay for crossing a page
+    static bool AbsoluteXCrossCosts(u8 op)
+    {
+        return op != 0x1e // asl
+            && op != 0xde // dec
+            && op != 0x5e // lsr
+            && op != 0x3e // rol
+            && op != 0x7e // ror
+            && op != 0x9d; // sta
+    }
+
+    static bool AbsoluteYCrossCosts(u8 op)
+    {
+        return op != 0x99; // sta
+    }
+
+    // jmp ($xxff) takes its high byte from $xx00, a bug in the processor
+    static u16 IndirectHighAddress(u16 addr)
+    {
+        return (addr & 0xff00) | ((addr + 1) & 0x00ff);
+    }
+
+    // What brk and php push, and what rti makes of the byte it pulls
+    static u8 PushedStatus(u8 p)
+    {
+        return p | (u8)Flag::Break | (u8)Flag::Unused;
+    }
+
+    static u8 ReturnStatus(u8 pulled)
+    {
+        return pulled & ~((u8)Flag::Break);
+    }
+};
+
 struct CpuRegs
 {
     u8 A;    // Accumulator
@@ -76,23 +200,15 @@ struct CpuRegs
 
     bool GetFlag(Flag flag)
     {
-        return (P & (u8)flag) != 0;
+        return CpuAlu::GetFlag(P, flag);
     }
     void SetFlag(Flag flag, bool on)
     {
-        if (on)
-        {
-            P |= (u8)flag;
-        }
-        else
-        {
-            P &= ~((u8)flag);
-        }
+        CpuAlu::SetFlag(P, flag, on);
     }
-    u8 SetZN(u8 val) {
-        SetFlag(Flag::Zero, val == 0);
-        SetFlag(Flag::Negative, (val & 0x80) != 0);
-        return val;
+    u8 SetZN(u8 val)
+    {
+        return CpuAlu::SetZN(P, val);
     }
 };
 
@@ -130,7 +246,7 @@ private:
     {
     public:
         MemoryAddressingMode(Cpu& cpu, u16 addr) : IAddressingMode(cpu), Addr(addr) { }
-        u8 Load() { return _cpu.loadb(Addr); }
+        u8 Load() { return _cpu.LoadData(Addr); }
         void Store(u8 val) { _cpu.storeb(Addr, val); }
         u16 Addr;
     };
@@ -147,11 +263,26 @@ public:
     void storeb(u16 addr, u8 val);
 
     // ISaveState
-    void SaveState(std::ofstream& ofs);
-    void LoadState(std::ifstream& ifs);
+    void SaveState(std::ostream& ofs);
+    void LoadState(std::istream& ifs);
 
     void Reset(bool hard);
-    void Step();
+
+    void Step()
+    {
+        if (_debugging)
+        {
+            StepWith<DebugPolicy>();
+        }
+        else
+        {
+            StepWith<NoDebugPolicy>();
+        }
+    }
+
+    // Switches to stepping with or without the debugger's checks, as it
+    // needs. Call when its breakpoints or single step change.
+    void UpdateDebugging();
     void Nmi();
     void Irq();
 
@@ -160,15 +291,51 @@ public:
         return _dmaBytesRemaining > 0;
     }
 
+    const CpuRegs& Regs()
+    {
+        return _regs;
+    }
+
+    // For debuggers, between instructions
+    void SetRegs(const CpuRegs& regs)
+    {
+        _regs = regs;
+    }
+
+    // Counts every instruction run into profiler, or stops counting if null
+    void SetProfiler(CpuProfiler* profiler);
+
+    // Keeps every instruction run in trace, or stops if null
+    void SetTrace(CpuTrace* trace);
+
+    // Marks the rom the cpu runs and reads in log, or stops if null
+    void SetCodeDataLog(CodeDataLog* log);
+
 public:
     u32 Cycles;
 
+    // Instructions run since the cpu was created, not saved
+    u64 Instructions;
+
 private:
     CpuRegs _regs;
     NPtr<IMem> _mem;
     NPtr<DebugService> _debugger;
 
+    // Data loads and stores go to _bus, which is _mem, or _debugBus while
+    // debugging. The instruction stream is always fetched from _mem.
+    IMem* _bus;
+    NPtr<DebugBus> _debugBus;
+    bool _debugging;
+    NPtr<CpuProfiler> _profiler;
+    NPtr<CpuTrace> _trace;
+    NPtr<CodeDataLog> _cdl;
+
     u8 _op;
+
+    // The bytes of the instruction running, as they were fetched
+    u8 _fetched[4];
+    u32 _fetchedCount;
     u32 _dmaBytesRemaining;
     u32 _dmaReadAddress;
 
@@ -178,8 +345,22 @@ private:
     MemoryAddressingMode _memoryAM;
 
 private:
+    // How Step is built. Without the debugger there are no checks at all.
+    struct NoDebugPolicy
+    {
+        static const bool Debugging = false;
+    };
+
+    struct DebugPolicy
+    {
+        static const bool Debugging = true;
+    };
+
+    template <class Policy>
+    void StepWith();
+
     void Dma(u8 val);
-    void Trace();
+    void unimplemented(u8 op);
 
     void Immediate() { _am = static_cast<IAddressingMode*>(&_immediateAM); }
     void Accumulator() { _am = static_cast<IAddressingMode*>(&_accumulatorAM); }
@@ -213,13 +394,7 @@ private:
         u16 addr = LoadWBumpPC();
         u16 indexedAddr = addr + (u16)_regs.X;
 
-        if (_op != 0x1e // asl
-            && _op != 0xde // dec
-            && _op != 0x5e // lsr
-            && _op != 0x3e // rol
-            && _op != 0x7e // ror
-            && _op != 0x9d // sta
-            )
+        if (CpuAlu::AbsoluteXCrossCosts(_op))
         {
             checkPageCross(addr, indexedAddr);
         }
@@ -233,7 +408,7 @@ private:
         u16 addr = LoadWBumpPC();
         u16 indexedAddr = addr + (u16)_regs.Y;
 
-        if (_op != 0x99) // sta
+        if (CpuAlu::AbsoluteYCrossCosts(_op))
         {
             checkPageCross(addr, indexedAddr);
         }
@@ -258,17 +433,38 @@ private:
     }
 
     // Memory Acess Helpers
-    u8 LoadBBumpPC() { return loadb(_regs.PC++); }
+
+    // A load from the instruction stream, which read breakpoints don't see
+    u8 FetchB(u16 addr)
+    {
+        u8 val = _mem->loadb(addr);
+        _fetched[_fetchedCount++ & 3] = val;
+        return val;
+    }
+
+    u8 LoadBBumpPC() { return FetchB(_regs.PC++); }
+
+    // A load that isn't part of the instruction stream
+    u8 LoadData(u16 addr)
+    {
+        if (_cdl != nullptr)
+        {
+            _cdl->LogData(addr);
+        }
+        return loadb(addr);
+    }
+
     u16 LoadWBumpPC()
     {
-        u16 val = loadw(_regs.PC);
+        u16 lo = (u16)FetchB(_regs.PC);
+        u16 hi = (u16)FetchB(_regs.PC + 1);
         _regs.PC += 2;
-        return val;
+        return (hi << 8) | lo;
     }
 
     void checkPageCross(u16 lhs, u16 rhs)
     {
-        if ((lhs & 0xff00) != (rhs & 0xff00))
+        if (CpuAlu::PageCrossed(lhs, rhs))
         {
             Cycles++;
         }
@@ -315,84 +511,25 @@ private:
     void sty() { _am->Store(_regs.Y); }
 
     // Arithemtic
-    void adc()
-    {
-        u8 val = _am->Load();
-        u32 result = (u32)_regs.A + (u32)val;
-        if (_regs.GetFlag(Flag::Carry)) result += 1;
-        _regs.SetFlag(Flag::Carry, (result & 0x100) != 0);
-
-        u8 resultByte = result & 0xff;
-        u8 a = _regs.A;
-        _regs.SetFlag(Flag::Overflow, (((a ^ val) & 0x80) == 0) && (((a ^ resultByte) & 0x80) == 0x80));
-        _regs.A = _regs.SetZN(resultByte);
-    }
-
-    void sbc()
-    {
-        u8 val = _am->Load();
-        u32 result = (u32)_regs.A - (u32)val;
-        if (!_regs.GetFlag(Flag::Carry)) result -= 1;
-        _regs.SetFlag(Flag::Carry, (result & 0x100) == 0);
-
-        u8 resultByte = result & 0xff;
-        u8 a = _regs.A;
-        _regs.SetFlag(Flag::Overflow, (((a ^ resultByte) & 0x80) != 0) && ((a ^ val) & 0x80) == 0x80);
-        _regs.A = _regs.SetZN(resultByte);
-    }
+    void adc() { _regs.A = CpuAlu::Adc(_regs.P, _regs.A, _am->Load()); }
+    void sbc() { _regs.A = CpuAlu::Sbc(_regs.P, _regs.A, _am->Load()); }
 
     // Comparisons
-    void cmp_base(u8 val)
-    {
-        u32 result = (u32)val - (u32)_am->Load();
-        _regs.SetFlag(Flag::Carry, (result & 0x100) == 0);
-        _regs.SetZN((u8)result);
-    }
-    void cmp() { cmp_base(_regs.A); }
-    void cpx() { cmp_base(_regs.X); }
-    void cpy() { cmp_base(_regs.Y); }
+    void cmp() { CpuAlu::Compare(_regs.P, _regs.A, _am->Load()); }
+    void cpx() { CpuAlu::Compare(_regs.P, _regs.X, _am->Load()); }
+    void cpy() { CpuAlu::Compare(_regs.P, _regs.Y, _am->Load()); }
 
     // Bitwise Operations
     void and() { _regs.A = _regs.SetZN(_regs.A & _am->Load()); }
     void ora() { _regs.A = _regs.SetZN(_regs.A | _am->Load()); }
     void eor() { _regs.A = _regs.SetZN(_regs.A ^ _am->Load()); }
-    void bit() 
-    {
-        u8 val = _am->Load();
-        _regs.SetFlag(Flag::Zero, (val &_regs.A) == 0);
-        _regs.SetFlag(Flag::Negative, (val & (1 << 7)) != 0);
-        _regs.SetFlag(Flag::Overflow, (val & (1 << 6)) != 0);
-    }
+    void bit() { CpuAlu::Bit(_regs.P, _regs.A, _am->Load()); }
 
     // Shifts and Rotates
-    void shl_base(bool lsb)
-    {
-        u8 val = _am->Load();
-        bool newCarry = (val & 0x80) != 0;
-        u8 result = (val << 1) | (lsb ? 1 : 0);
-        _regs.SetFlag(Flag::Carry, newCarry);
-        _am->Store(_regs.SetZN(result));
-    }
-    void shr_base(bool msb)
-    {
-        u8 val = _am->Load();
-        bool newCarry = (val & 0x01) != 0;
-        u8 result = (val >> 1) | (msb ? 0x80 : 0);
-        _regs.SetFlag(Flag::Carry, newCarry);
-        _am->Store(_regs.SetZN(result));
-    }
-    void rol()
-    {
-        bool oldCarry = _regs.GetFlag(Flag::Carry);
-        shl_base(oldCarry);
-    }
-    void ror()
-    {
-        bool oldCarry = _regs.GetFlag(Flag::Carry);
-        shr_base(oldCarry);
-    }
-    void asl() { shl_base(false); }
-    void lsr() { shr_base(false); }
+    void rol() { _am->Store(CpuAlu::ShiftLeft(_regs.P, _am->Load(), true)); }
+    void ror() { _am->Store(CpuAlu::ShiftRight(_regs.P, _am->Load(), true)); }
+    void asl() { _am->Store(CpuAlu::ShiftLeft(_regs.P, _am->Load(), false)); }
+    void lsr() { _am->Store(CpuAlu::ShiftRight(_regs.P, _am->Load(), false)); }
 
     // Increments and Decrements
     void inc() { _am->Store(_regs.SetZN(_am->Load() + 1)); }
@@ -424,11 +561,11 @@ private:
     // Branches
     void branch_base(bool cond)
     {
-        i8 disp = (i8)LoadBBumpPC();
+        u8 disp = LoadBBumpPC();
         if (cond)
         {
             Cycles++;
-            u16 newPC = (u16)((i32)_regs.PC + (i32)disp);
+            u16 newPC = CpuAlu::BranchTarget(_regs.PC, disp);
             checkPageCross(_regs.PC, newPC);
 
             _regs.PC = newPC;
@@ -451,10 +588,8 @@ private:
     void jmpi()
     {
         u16 addr = LoadWBumpPC();
-
-        // recreate processor bug
-        u16 lo = (u16)loadb(addr);
-        u16 hi = (u16)loadb((addr & 0xff00) | ((addr + 1) & 0x00ff));
+        u16 lo = (u16)LoadData(addr);
+        u16 hi = (u16)LoadData(CpuAlu::IndirectHighAddress(addr));
         
         _regs.PC = (hi << 8) | lo;
     }
@@ -475,21 +610,21 @@ private:
     void brk()
     {
         PushW(_regs.PC + 1);
-        PushB(_regs.P | (u8)Flag::Break | (u8)Flag::Unused);
+        PushB(CpuAlu::PushedStatus(_regs.P));
         _regs.SetFlag(Flag::IRQ, true);
         _regs.SetFlag(Flag::Unused, true);
         _regs.PC = loadw(IRQ_VECTOR);
     }
     void rti()
     {
-        _regs.P = PopB() & ~((u8)Flag::Break);
+        _regs.P = CpuAlu::ReturnStatus(PopB());
         _regs.PC = PopW();
     }
 
     // Stack Operations
     void pha() { PushB(_regs.A); }
     void pla() { _regs.A = _regs.SetZN(PopB()); }
-    void php() { PushB(_regs.P | (u8)Flag::Break | (u8)Flag::Unused); } // FIXME: is b_flag right here?
+    void php() { PushB(CpuAlu::PushedStatus(_regs.P)); } // FIXME: is b_flag right here?
     void plp() { _regs.P = PopB(); }
 
     // No Operation
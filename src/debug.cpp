@@ -1,11 +1,29 @@
 
 #include "stdafx.h"
 #include "debug.h"
+#include "cpu.h"
+#include "ppu.h"
+
+#include <algorithm>
 
 int g_dbgEvent = 0;
 int g_dbgParam = 0;
 int g_dbgEnableLoadEvent = 0;
 
+// Logpoint records kept before WriteLog, past this they are only counted
+static const u32 MAX_LOG_RECORDS = 1 << 20;
+
+static const char* KindName(BreakpointKind kind)
+{
+    switch (kind)
+    {
+    case DEBUG_BP_READ: return "read";
+    case DEBUG_BP_WRITE: return "write";
+    case DEBUG_BP_EXECUTE: return "exec";
+    }
+    return "?";
+}
+
 void __declspec(noinline) DebuggerNotify(int dbgEvent, int param)
 {
     g_dbgEvent = dbgEvent;
@@ -15,6 +33,15 @@ void __declspec(noinline) DebuggerNotify(int dbgEvent, int param)
 
 DebugService::DebugService()
     : _singleStep(false)
+    , _cpu(nullptr)
+    , _mem(nullptr)
+    , _ppu(nullptr)
+    , _logDropped(0)
+    , _handler(nullptr)
+    , _pauseRequested(false)
+    , _pendingEvent(0)
+    , _pendingAddr(0)
+    , _instructionPC(0)
 {
     memset(&_bpMapRead, 0, sizeof(_bpMapRead));
     memset(&_bpMapWrite, 0, sizeof(_bpMapWrite));
@@ -22,43 +49,190 @@ DebugService::DebugService()
 
     if (g_dbgEnableLoadEvent)
     {
-        DebuggerNotify(DEBUG_EVENT_LOAD_ROM, (int)this);
+        DebuggerNotify(DEBUG_EVENT_LOAD_ROM, (int)(intptr_t)this);
     }
 }
 
-void DebugService::SetBreakpoint(BreakpointKind kind, u16 address)
+void DebugService::SetMachine(Cpu* cpu, MemoryMap* mem, Ppu* ppu)
+{
+    _cpu = cpu;
+    _mem = mem;
+    _ppu = ppu;
+}
+
+void DebugService::EnableSingleStep()
+{
+    _singleStep = true;
+}
+
+void DebugService::ClearBreakpoints()
+{
+    memset(&_bpMapRead, 0, sizeof(_bpMapRead));
+    memset(&_bpMapWrite, 0, sizeof(_bpMapWrite));
+    memset(&_bpMapExecute, 0, sizeof(_bpMapExecute));
+    _breakpoints.clear();
+}
+
+void DebugService::SetHandler(IDebugHandler* handler)
+{
+    _handler = handler;
+    _pauseRequested = false;
+    _pendingEvent = 0;
+}
+
+u8* DebugService::BreakpointMap(BreakpointKind kind)
 {
-    u16 index = BreakpointIndex(address);
-    u8 bit = BreakpointBit(address);
     switch (kind)
     {
     case DEBUG_BP_READ:
-        _bpMapRead[index] |= bit;
-        break;
+        return _bpMapRead;
     case DEBUG_BP_WRITE:
-        _bpMapWrite[index] |= bit;
-        break;
+        return _bpMapWrite;
     case DEBUG_BP_EXECUTE:
-        _bpMapExecute[index] |= bit;
-        break;
+        return _bpMapExecute;
+    }
+    return nullptr;
+}
+
+void DebugService::SetBreakpoint(BreakpointKind kind, u16 address)
+{
+    SetBreakpoint(kind, address, nullptr, nullptr);
+}
+
+bool DebugService::SetBreakpoint(BreakpointKind kind, u16 address, const char* condition, const char* log)
+{
+    u8* map = BreakpointMap(kind);
+    if (map == nullptr)
+    {
+        return false;
     }
+
+    Breakpoint breakpoint;
+    breakpoint.Kind = kind;
+    breakpoint.Address = address;
+    breakpoint.Hits = 0;
+    if (condition != nullptr && *condition != '\0' && !breakpoint.Condition.Parse(condition))
+    {
+        return false;
+    }
+    if (log != nullptr)
+    {
+        breakpoint.Log = std::make_shared<DebugLogFormat>();
+        if (!breakpoint.Log->Parse(log))
+        {
+            return false;
+        }
+    }
+
+    map[BreakpointIndex(address)] |= BreakpointBit(address);
+    _breakpoints[Key(kind, address)] = std::move(breakpoint);
+    return true;
 }
 
 void DebugService::ClearBreakpoint(BreakpointKind kind, u16 address)
 {
-    u16 index = BreakpointIndex(address);
-    u8 mask = ~BreakpointBit(address);
-    switch (kind)
+    u8* map = BreakpointMap(kind);
+    if (map != nullptr)
     {
-    case DEBUG_BP_READ:
-        _bpMapRead[index] &= mask;
-        break;
-    case DEBUG_BP_WRITE:
-        _bpMapWrite[index] &= mask;
-        break;
-    case DEBUG_BP_EXECUTE:
-        _bpMapExecute[index] &= mask;
-        break;
+        map[BreakpointIndex(address)] &= ~BreakpointBit(address);
+        _breakpoints.erase(Key(kind, address));
+    }
+}
+
+u64 DebugService::BreakpointHits(BreakpointKind kind, u16 address)
+{
+    auto found = _breakpoints.find(Key(kind, address));
+    return found != _breakpoints.end() ? found->second.Hits : 0;
+}
+
+bool DebugService::Hit(BreakpointKind kind, u16 addr, u8 val)
+{
+    auto found = _breakpoints.find(Key(kind, addr));
+    if (found == _breakpoints.end())
+    {
+        return true;
+    }
+    Breakpoint& breakpoint = found->second;
+
+    DebugContext context;
+    context.Regs = &_cpu->Regs();
+    context.PC = kind == DEBUG_BP_EXECUTE ? addr : _instructionPC;
+    context.Mem = _mem;
+    context.Video = _ppu;
+    context.Addr = addr;
+    context.Value = val;
+
+    if (!breakpoint.Condition.Empty() && breakpoint.Condition.Evaluate(context) == 0)
+    {
+        return false;
+    }
+    breakpoint.Hits++;
+
+    if (breakpoint.Log == nullptr)
+    {
+        return true;
+    }
+
+    if (_log.size() >= MAX_LOG_RECORDS)
+    {
+        _logDropped++;
+        return false;
+    }
+
+    LogRecord record;
+    record.Log = breakpoint.Log;
+    record.PC = context.PC;
+    record.Scanline = _ppu->Scanline();
+    record.Dot = _ppu->Dot();
+    record.FirstValue = (u32)_logValues.size();
+    _logValues.resize(_logValues.size() + breakpoint.Log->ValueCount());
+    breakpoint.Log->Evaluate(context, &_logValues[record.FirstValue]);
+    _log.push_back(std::move(record));
+    return false;
+}
+
+void DebugService::WriteLog(std::ostream& out)
+{
+    std::string text;
+    char line[64];
+    for (const LogRecord& record : _log)
+    {
+        record.Log->Format(_logValues.data() + record.FirstValue, text);
+        snprintf(line, sizeof(line), "%04X SL:%u DOT:%u ", record.PC, record.Scanline, record.Dot);
+        out << line << text << '\n';
+    }
+    if (_logDropped > 0)
+    {
+        out << _logDropped << " more records not kept\n";
+    }
+    _log.clear();
+    _logValues.clear();
+    _logDropped = 0;
+
+    // The map keeps them in no order
+    std::vector<const Breakpoint*> breakpoints;
+    for (const auto& entry : _breakpoints)
+    {
+        breakpoints.push_back(&entry.second);
+    }
+    std::sort(breakpoints.begin(), breakpoints.end(), [](const Breakpoint* a, const Breakpoint* b)
+    {
+        return Key(a->Kind, a->Address) < Key(b->Kind, b->Address);
+    });
+
+    for (const Breakpoint* breakpoint : breakpoints)
+    {
+        snprintf(line, sizeof(line), "%s $%04X: %llu hits", KindName(breakpoint->Kind), breakpoint->Address, breakpoint->Hits);
+        out << line;
+        if (!breakpoint->Condition.Empty())
+        {
+            out << " if " << breakpoint->Condition.Text();
+        }
+        if (breakpoint->Log != nullptr)
+        {
+            out << " log " << breakpoint->Log->Text();
+        }
+        out << '\n';
     }
 }
 
@@ -67,14 +241,63 @@ void DebugService::OnBeforeExecuteInstruction(u16 pc)
     u16 index = BreakpointIndex(pc);
     u8 bit = BreakpointBit(pc);
 
+    if (_handler != nullptr)
+    {
+        int dbgEvent = 0;
+        u16 addr = pc;
+        if (_pendingEvent != 0)
+        {
+            dbgEvent = _pendingEvent;
+            addr = _pendingAddr;
+            _pendingEvent = 0;
+        }
+        else if ((_bpMapExecute[index] & bit) && Hit(DEBUG_BP_EXECUTE, pc, 0))
+        {
+            dbgEvent = DEBUG_EVENT_BP_EXECUTE;
+        }
+        else if (_singleStep)
+        {
+            dbgEvent = DEBUG_EVENT_SINGLE_STEP;
+        }
+        else if (_pauseRequested)
+        {
+            dbgEvent = DEBUG_EVENT_PAUSE;
+        }
+
+        if (dbgEvent != 0)
+        {
+            _singleStep = false;
+            _pauseRequested = false;
+            _handler->OnStop(dbgEvent, addr);
+        }
+        return;
+    }
+
     if (_singleStep)
     {
         DebuggerNotify(DEBUG_EVENT_SINGLE_STEP, 0);
         _singleStep = false;
     }
 
-    if (_bpMapExecute[index] & bit)
+    if ((_bpMapExecute[index] & bit) && Hit(DEBUG_BP_EXECUTE, pc, 0))
     {
         DebuggerNotify(DEBUG_EVENT_BP_EXECUTE, pc);
     }
+}
+
+void DebugService::OnBreakpoint(BreakpointKind kind, u16 addr, u8 val)
+{
+    if (!Hit(kind, addr, val))
+    {
+        return;
+    }
+
+    int dbgEvent = kind == DEBUG_BP_READ ? DEBUG_EVENT_BP_READ : DEBUG_EVENT_BP_WRITE;
+    if (_handler != nullptr)
+    {
+        _pendingEvent = dbgEvent;
+        _pendingAddr = addr;
+        return;
+    }
+    DebuggerNotify(dbgEvent, addr);
 }
\ No newline at end of file
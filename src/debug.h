@@ -1,6 +1,9 @@
 #pragma once
 
-#include "..\include\nes_interfaces.h"
+#include "interfaces.h"
+#include "debugexpr.h"
+
+#include <unordered_map>
 
 #define BP_MAP_SIZE (0x10000 / 8) // $FFFF address space divided by 8 bits per index
 
@@ -23,29 +26,157 @@ enum
     DEBUG_EVENT_BP_EXECUTE = 3,
     DEBUG_EVENT_LOAD_ROM = 4,
     DEBUG_EVENT_SINGLE_STEP = 5,
-    DEBUG_EVENT_ILLEGAL_INSTRUCTION = 5
+    DEBUG_EVENT_ILLEGAL_INSTRUCTION = 5,
+    DEBUG_EVENT_PAUSE = 6
+};
+
+// Takes the debug events instead of a native debugger, see DebugService::SetHandler
+struct IDebugHandler
+{
+    // On the emulation thread, between instructions. The cpu carries on
+    // when this returns. addr is the pc, or the address read or written.
+    virtual void OnStop(int dbgEvent, u16 addr) = 0;
 };
 
+class Cpu;
+
 class DebugService : public IBaseInterface, public NesObject
 {
+private:
+    struct Breakpoint
+    {
+        BreakpointKind Kind;
+        u16 Address;
+        DebugExpression Condition;  // empty to always stop
+        std::shared_ptr<DebugLogFormat> Log;  // set for logpoints, which never stop
+        u64 Hits;   // times the condition was true
+    };
+
+    // A logpoint hit, its values are in _logValues
+    struct LogRecord
+    {
+        std::shared_ptr<DebugLogFormat> Log;
+        u16 PC;
+        u16 Scanline;
+        u16 Dot;
+        u32 FirstValue;
+    };
+
 public:
     DebugService();
 
 public:
     DELEGATE_NESOBJECT_REFCOUNTING();
 
+    // What conditions and logpoints look at. The machine owns the debug
+    // service, so these aren't held.
+    void SetMachine(Cpu* cpu, MemoryMap* mem, Ppu* ppu);
+
     void EnableSingleStep();
     void SetBreakpoint(BreakpointKind kind, u16 address);
     void ClearBreakpoint(BreakpointKind kind, u16 address);
+    void ClearBreakpoints();
+
+    // A breakpoint that only stops when condition (see DebugExpression) is
+    // true, or with log set a logpoint, which records log's text with its
+    // values (see DebugLogFormat) instead of stopping. Either may be null.
+    // Replaces any breakpoint of the kind at address. Conditions are only
+    // evaluated when the address is hit.
+    // returns: false if condition or log doesn't parse
+    bool SetBreakpoint(BreakpointKind kind, u16 address, const char* condition, const char* log);
+
+    // Times the breakpoint's condition was true, whether or not it stopped
+    u64 BreakpointHits(BreakpointKind kind, u16 address);
+
+    // The logpoints' records, oldest first, then every breakpoint's hits.
+    // Clears the records.
+    void WriteLog(std::ostream& out);
+
+    // Send events to handler rather than a native debugger, or stop if null.
+    // While there is a handler the cpu is always debugging, and read and
+    // write breakpoints stop it before the next instruction.
+    void SetHandler(IDebugHandler* handler);
+
+    // Stop before the next instruction, from any thread. Only for handlers.
+    void RequestPause()
+    {
+        _pauseRequested = true;
+    }
+
+    void CancelPause()
+    {
+        _pauseRequested = false;
+    }
+
+    // Whether there is anything the cpu has to stop for. While there isn't
+    // the cpu runs without checking (see Cpu::UpdateDebugging).
+    bool Active()
+    {
+        return !_breakpoints.empty() || _singleStep || _handler != nullptr;
+    }
 
     void OnBeforeExecuteInstruction(u16 pc);
 
+    // The instruction about to run, which read and write hits report
+    // rather than the pc, which has moved past its operands by then
+    void OnInstruction(u16 pc)
+    {
+        _instructionPC = pc;
+    }
+
+    void OnRead(u16 addr, u8 val)
+    {
+        if (_bpMapRead[BreakpointIndex(addr)] & BreakpointBit(addr))
+        {
+            OnBreakpoint(DEBUG_BP_READ, addr, val);
+        }
+    }
+
+    void OnWrite(u16 addr, u8 val)
+    {
+        if (_bpMapWrite[BreakpointIndex(addr)] & BreakpointBit(addr))
+        {
+            OnBreakpoint(DEBUG_BP_WRITE, addr, val);
+        }
+    }
+
+private:
+    void OnBreakpoint(BreakpointKind kind, u16 addr, u8 val);
+
+    // Counts and logs a hit on the breakpoint the maps say is there.
+    // returns: whether to stop
+    bool Hit(BreakpointKind kind, u16 addr, u8 val);
+
+    // The map for kind, or null
+    u8* BreakpointMap(BreakpointKind kind);
+
 private:
     u8 _bpMapRead[BP_MAP_SIZE];
     u8 _bpMapWrite[BP_MAP_SIZE];
     u8 _bpMapExecute[BP_MAP_SIZE];
     bool _singleStep;
 
+    // Everything in the maps, by Key
+    std::unordered_map<u32, Breakpoint> _breakpoints;
+
+    Cpu* _cpu;
+    MemoryMap* _mem;
+    Ppu* _ppu;
+
+    std::vector<LogRecord> _log;
+    std::vector<i32> _logValues;
+    u64 _logDropped;
+
+    IDebugHandler* _handler;
+    std::atomic<bool> _pauseRequested;
+
+    // A read or write breakpoint hit part way through an instruction, for
+    // the handler at the end of it
+    int _pendingEvent;
+    u16 _pendingAddr;
+
+    u16 _instructionPC;
+
     static u16 BreakpointIndex(u16 address)
     {
         return address / 8;
@@ -55,6 +186,44 @@ private:
     {
         return 1 << (address & 7);
     }
+
+    static u32 Key(BreakpointKind kind, u16 address)
+    {
+        return ((u32)kind << 16) | address;
+    }
+};
+
+// The cpu's bus while the debugger is active, checks read and write
+// breakpoints on the way through. Only data and stack accesses come this way,
+// instruction fetches don't. Instances without breakpoints never see it.
+class DebugBus : public IMem, public NesObject
+{
+public:
+    DebugBus(IMem* mem, DebugService* debugger)
+        : _mem(mem)
+        , _debugger(debugger)
+    {
+    }
+
+public:
+    DELEGATE_NESOBJECT_REFCOUNTING();
+
+    u8 loadb(u16 addr)
+    {
+        u8 val = _mem->loadb(addr);
+        _debugger->OnRead(addr, val);
+        return val;
+    }
+
+    void storeb(u16 addr, u8 val)
+    {
+        _debugger->OnWrite(addr, val);
+        _mem->storeb(addr, val);
+    }
+
+private:
+    NPtr<IMem> _mem;
+    NPtr<DebugService> _debugger;
 };
 
 #undef BP_MAP_SIZE
\ No newline at end of file
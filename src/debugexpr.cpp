@@ -0,0 +1,461 @@
+#include "stdafx.h"
+#include "debugexpr.h"
+#include "cpu.h"
+#include "mem.h"
+#include "ppu.h"
+
+#include <algorithm>
+
+// The bytecode, each op pushes a value or replaces the top values with one
+enum class ExprOp : u8
+{
+    Const8,     // then the value
+    Const32,    // then the value, little endian
+    A,
+    X,
+    Y,
+    P,
+    S,
+    PC,
+    Scanline,
+    Dot,
+    Addr,
+    Value,
+    Peek,
+    Negate,
+    Not,
+    Complement,
+    Multiply,
+    Divide,
+    Modulo,
+    Add,
+    Subtract,
+    ShiftLeft,
+    ShiftRight,
+    Less,
+    LessEqual,
+    Greater,
+    GreaterEqual,
+    Equal,
+    NotEqual,
+    BitAnd,
+    BitXor,
+    BitOr,
+    LogicalAnd,
+    LogicalOr,
+};
+
+// Deepest the stack may get, checked when parsing
+static const u32 MAX_DEPTH = 32;
+
+struct BinaryOperator
+{
+    const char* Text;
+    u32 Level;  // 0 binds loosest
+    ExprOp Op;
+};
+
+// Longest first, so | never matches the start of ||
+static const BinaryOperator BINARY_OPERATORS[] =
+{
+    { "||", 0, ExprOp::LogicalOr },
+    { "&&", 1, ExprOp::LogicalAnd },
+    { "==", 5, ExprOp::Equal },
+    { "!=", 5, ExprOp::NotEqual },
+    { "<=", 6, ExprOp::LessEqual },
+    { ">=", 6, ExprOp::GreaterEqual },
+    { "<<", 7, ExprOp::ShiftLeft },
+    { ">>", 7, ExprOp::ShiftRight },
+    { "|", 2, ExprOp::BitOr },
+    { "^", 3, ExprOp::BitXor },
+    { "&", 4, ExprOp::BitAnd },
+    { "<", 6, ExprOp::Less },
+    { ">", 6, ExprOp::Greater },
+    { "+", 8, ExprOp::Add },
+    { "-", 8, ExprOp::Subtract },
+    { "*", 9, ExprOp::Multiply },
+    { "/", 9, ExprOp::Divide },
+    { "%", 9, ExprOp::Modulo },
+};
+
+static const u32 BINARY_LEVELS = 10;
+
+struct Variable
+{
+    const char* Name;
+    ExprOp Op;
+};
+
+static const Variable VARIABLES[] =
+{
+    { "a", ExprOp::A },
+    { "x", ExprOp::X },
+    { "y", ExprOp::Y },
+    { "p", ExprOp::P },
+    { "s", ExprOp::S },
+    { "pc", ExprOp::PC },
+    { "scanline", ExprOp::Scanline },
+    { "dot", ExprOp::Dot },
+    { "addr", ExprOp::Addr },
+    { "value", ExprOp::Value },
+};
+
+// Recursive descent, writing the bytecode as it goes
+class ExpressionParser
+{
+public:
+    ExpressionParser(const char* text, std::vector<u8>& code)
+        : _text(text)
+        , _p(text)
+        , _code(code)
+        , _depth(0)
+    {
+    }
+
+    bool Parse()
+    {
+        if (!Binary(0))
+        {
+            return false;
+        }
+        SkipSpace();
+        return *_p == '\0' || Error("unexpected text");
+    }
+
+private:
+    bool Binary(u32 level)
+    {
+        if (level == BINARY_LEVELS)
+        {
+            return Unary();
+        }
+        if (!Binary(level + 1))
+        {
+            return false;
+        }
+
+        for (;;)
+        {
+            SkipSpace();
+            const BinaryOperator* op = MatchBinary();
+            if (op == nullptr || op->Level != level)
+            {
+                return true;
+            }
+            _p += strlen(op->Text);
+
+            if (!Binary(level + 1))
+            {
+                return false;
+            }
+            Emit(op->Op);
+            _depth--;
+        }
+    }
+
+    bool Unary()
+    {
+        SkipSpace();
+        ExprOp op;
+        switch (*_p)
+        {
+        case '-': op = ExprOp::Negate; break;
+        case '!': op = ExprOp::Not; break;
+        case '~': op = ExprOp::Complement; break;
+        default:
+            return Primary();
+        }
+        _p++;
+
+        if (!Unary())
+        {
+            return false;
+        }
+        Emit(op);
+        return true;
+    }
+
+    bool Primary()
+    {
+        SkipSpace();
+        if (*_p == '(' || *_p == '[')
+        {
+            char close = *_p == '(' ? ')' : ']';
+            bool peek = *_p == '[';
+            _p++;
+
+            if (!Binary(0))
+            {
+                return false;
+            }
+            SkipSpace();
+            if (*_p != close)
+            {
+                return Error(close == ')' ? "expected )" : "expected ]");
+            }
+            _p++;
+
+            if (peek)
+            {
+                Emit(ExprOp::Peek);
+            }
+            return true;
+        }
+
+        if (isalpha((u8)*_p))
+        {
+            const char* start = _p;
+            while (isalnum((u8)*_p))
+            {
+                _p++;
+            }
+
+            std::string name(start, _p);
+            std::transform(name.begin(), name.end(), name.begin(), [](char c) { return (char)tolower((u8)c); });
+            for (const Variable& variable : VARIABLES)
+            {
+                if (name == variable.Name)
+                {
+                    return Push(variable.Op);
+                }
+            }
+            _p = start;
+            return Error("unknown name");
+        }
+
+        int base = 10;
+        if (*_p == '$')
+        {
+            base = 16;
+            _p++;
+        }
+        else if (*_p == '%')
+        {
+            base = 2;
+            _p++;
+        }
+        else if (_p[0] == '0' && (_p[1] == 'x' || _p[1] == 'X'))
+        {
+            base = 16;
+            _p += 2;
+        }
+
+        char* end;
+        unsigned long val = strtoul(_p, &end, base);
+        if (end == _p || *_p == '-' || *_p == '+' || isspace((u8)*_p))
+        {
+            return Error("expected a value");
+        }
+        _p = end;
+
+        if (val <= 0xff)
+        {
+            if (!Push(ExprOp::Const8))
+            {
+                return false;
+            }
+            _code.push_back((u8)val);
+        }
+        else
+        {
+            if (!Push(ExprOp::Const32))
+            {
+                return false;
+            }
+            for (u32 i = 0; i < 4; i++)
+            {
+                _code.push_back((u8)(val >> (i * 8)));
+            }
+        }
+        return true;
+    }
+
+    const BinaryOperator* MatchBinary()
+    {
+        for (const BinaryOperator& op : BINARY_OPERATORS)
+        {
+            if (strncmp(_p, op.Text, strlen(op.Text)) == 0)
+            {
+                return &op;
+            }
+        }
+        return nullptr;
+    }
+
+    bool Push(ExprOp op)
+    {
+        if (++_depth > MAX_DEPTH)
+        {
+            return Error("too deeply nested");
+        }
+        Emit(op);
+        return true;
+    }
+
+    void Emit(ExprOp op)
+    {
+        _code.push_back((u8)op);
+    }
+
+    void SkipSpace()
+    {
+        while (isspace((u8)*_p))
+        {
+            _p++;
+        }
+    }
+
+    bool Error(const char* what)
+    {
+        printf("Bad expression '%s': %s at column %u\n", _text, what, (u32)(_p - _text) + 1);
+        return false;
+    }
+
+private:
+    const char* _text;
+    const char* _p;
+    std::vector<u8>& _code;
+    u32 _depth;
+};
+
+DebugExpression::DebugExpression()
+{
+}
+
+bool DebugExpression::Parse(const char* text)
+{
+    _code.clear();
+    _text = text;
+
+    ExpressionParser parser(text, _code);
+    if (!parser.Parse())
+    {
+        _code.clear();
+        return false;
+    }
+    return true;
+}
+
+i32 DebugExpression::Evaluate(const DebugContext& context) const
+{
+    i32 stack[MAX_DEPTH];
+    i32* top = stack; // the next free slot
+
+    const u8* p = _code.data();
+    const u8* end = p + _code.size();
+    while (p < end)
+    {
+        i32 right;
+        switch ((ExprOp)*p++)
+        {
+        case ExprOp::Const8: *top++ = *p++; break;
+        case ExprOp::Const32:
+            *top++ = (i32)(p[0] | (p[1] << 8) | (p[2] << 16) | ((u32)p[3] << 24));
+            p += 4;
+            break;
+
+        case ExprOp::A: *top++ = context.Regs->A; break;
+        case ExprOp::X: *top++ = context.Regs->X; break;
+        case ExprOp::Y: *top++ = context.Regs->Y; break;
+        case ExprOp::P: *top++ = context.Regs->P; break;
+        case ExprOp::S: *top++ = context.Regs->S; break;
+        case ExprOp::PC: *top++ = context.PC; break;
+        case ExprOp::Scanline: *top++ = context.Video->Scanline(); break;
+        case ExprOp::Dot: *top++ = context.Video->Dot(); break;
+        case ExprOp::Addr: *top++ = context.Addr; break;
+        case ExprOp::Value: *top++ = context.Value; break;
+
+        case ExprOp::Peek: top[-1] = context.Mem->PeekCode((u16)top[-1]); break;
+        case ExprOp::Negate: top[-1] = (i32)(0u - (u32)top[-1]); break;
+        case ExprOp::Not: top[-1] = !top[-1]; break;
+        case ExprOp::Complement: top[-1] = ~top[-1]; break;
+
+#define BINARY(expr) right = *--top; top[-1] = (expr); break;
+        case ExprOp::Multiply: BINARY((i32)((u32)top[-1] * (u32)right))
+        case ExprOp::Divide: BINARY(right == 0 || (right == -1 && top[-1] == INT32_MIN) ? 0 : top[-1] / right)
+        case ExprOp::Modulo: BINARY(right == 0 || right == -1 ? 0 : top[-1] % right)
+        case ExprOp::Add: BINARY((i32)((u32)top[-1] + (u32)right))
+        case ExprOp::Subtract: BINARY((i32)((u32)top[-1] - (u32)right))
+        case ExprOp::ShiftLeft: BINARY((i32)((u32)top[-1] << (right & 31)))
+        case ExprOp::ShiftRight: BINARY(top[-1] >> (right & 31))
+        case ExprOp::Less: BINARY(top[-1] < right)
+        case ExprOp::LessEqual: BINARY(top[-1] <= right)
+        case ExprOp::Greater: BINARY(top[-1] > right)
+        case ExprOp::GreaterEqual: BINARY(top[-1] >= right)
+        case ExprOp::Equal: BINARY(top[-1] == right)
+        case ExprOp::NotEqual: BINARY(top[-1] != right)
+        case ExprOp::BitAnd: BINARY(top[-1] & right)
+        case ExprOp::BitXor: BINARY(top[-1] ^ right)
+        case ExprOp::BitOr: BINARY(top[-1] | right)
+        case ExprOp::LogicalAnd: BINARY(top[-1] != 0 && right != 0)
+        case ExprOp::LogicalOr: BINARY(top[-1] != 0 || right != 0)
+#undef BINARY
+        }
+    }
+
+    return top > stack ? top[-1] : 0;
+}
+
+bool DebugLogFormat::Parse(const char* text)
+{
+    _literals.assign(1, std::string());
+    _values.clear();
+    _text = text;
+
+    for (const char* p = text; *p != '\0'; p++)
+    {
+        if (*p != '{')
+        {
+            _literals.back() += *p;
+            continue;
+        }
+
+        const char* close = strchr(p, '}');
+        if (close == nullptr)
+        {
+            printf("Bad log text '%s': { without }\n", text);
+            return false;
+        }
+
+        _values.emplace_back();
+        if (!_values.back().Parse(std::string(p + 1, close).c_str()))
+        {
+            return false;
+        }
+        _literals.emplace_back();
+        p = close;
+    }
+    return true;
+}
+
+void DebugLogFormat::Evaluate(const DebugContext& context, i32* values) const
+{
+    for (const DebugExpression& value : _values)
+    {
+        *values++ = value.Evaluate(context);
+    }
+}
+
+void DebugLogFormat::Format(const i32* values, std::string& line) const
+{
+    line = _literals[0];
+    for (size_t i = 0; i < _values.size(); i++)
+    {
+        char text[16];
+        i32 val = values[i];
+        if (val >= 0 && val <= 0xff)
+        {
+            snprintf(text, sizeof(text), "$%02X", val);
+        }
+        else if (val >= 0 && val <= 0xffff)
+        {
+            snprintf(text, sizeof(text), "$%04X", val);
+        }
+        else
+        {
+            snprintf(text, sizeof(text), "%d", val);
+        }
+        line += text;
+        line += _literals[i + 1];
+    }
+}
\ No newline at end of file
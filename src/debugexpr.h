@@ -0,0 +1,69 @@
+#pragma once
+
+#include "interfaces.h"
+
+struct CpuRegs;
+class MemoryMap;
+class Ppu;
+
+// What an expression can look at when a breakpoint is hit
+struct DebugContext
+{
+    const CpuRegs* Regs;
+    u16 PC;     // the start of the instruction running, not Regs->PC
+    MemoryMap* Mem;
+    Ppu* Video;
+    u16 Addr;   // the pc, or the address read or written
+    u8 Value;   // the value read or written
+};
+
+// An expression for breakpoint conditions and logpoints, parsed once into a
+// small stack machine bytecode so a hit costs no more than running it.
+//
+//   a x y p s pc        registers, pc is the instruction's address
+//   scanline dot        where the ppu is
+//   addr value          the address hit and the value read or written
+//   $3f 0x3f 63 %111111 numbers
+//   [expr]              the byte at expr (the i/o registers read as 0)
+//
+// with C's operators and precedence: unary ! ~ -, * / %, + -, << >>,
+// < <= > >=, == !=, &, ^, |, && and ||. Values are 32 bit and signed,
+// division by 0 is 0, and both sides of && and || are evaluated (nothing
+// an expression reads has side effects).
+class DebugExpression
+{
+public:
+    DebugExpression();
+
+    // Prints what is wrong and returns false if text doesn't parse
+    bool Parse(const char* text);
+
+    bool Empty() const { return _code.empty(); }
+    const std::string& Text() const { return _text; }
+
+    i32 Evaluate(const DebugContext& context) const;
+
+private:
+    std::vector<u8> _code;
+    std::string _text;
+};
+
+// Text with {expression}s in it, for logpoints, e.g. "hp {[$75]} at {scanline}"
+class DebugLogFormat
+{
+public:
+    bool Parse(const char* text);
+
+    const std::string& Text() const { return _text; }
+    u32 ValueCount() const { return (u32)_values.size(); }
+
+    void Evaluate(const DebugContext& context, i32* values) const;
+
+    // The text with the values in it, as hex
+    void Format(const i32* values, std::string& line) const;
+
+private:
+    std::vector<std::string> _literals;     // one more than the values
+    std::vector<DebugExpression> _values;
+    std::string _text;
+};
\ No newline at end of file
@@ -1,290 +1,115 @@
 #pragma once
 
-#if defined(TRACE)
+#include "decode.h"
 
-#include "mem.h"
+// 6502 disassembly driven by a table of the opcodes the cpu runs. Everything
+// formats into buffers the caller owns and nothing allocates per
+// instruction, so it is cheap enough for traces, profiles and whole banks.
 
-#include <vector>
-
-class DisassembledInstruction 
+enum class AddressingMode : u8
 {
-public:
-    DisassembledInstruction() 
-        : _ss(std::ios_base::out | std::ios_base::ate)
-    { 
-    }
-    ~DisassembledInstruction() { }
-
-    std::string GetFormattedBytes()
-    {
-        std::stringstream ss;
-        ss << std::uppercase << std::hex;
-
-        std::vector<u8>::iterator it = _bytes.begin();
-        do
-        {
-            ss << std::setfill('0') << std::setw(2) << (i32)*it << ' ';
-            it++;
-        } while (it != _bytes.end());
-
-        return ss.str();
-    }
-
-    std::string GetDisassemblyString()
-    {
-        return _ss.str();
-    }
-
-private:
-    friend class Disassembler;
-    std::stringstream _ss;
-    std::vector<u8> _bytes;
+    Implied,
+    Accumulator,
+    Immediate,
+    ZeroPage,
+    ZeroPageX,
+    ZeroPageY,
+    Absolute,
+    AbsoluteX,
+    AbsoluteY,
+    Indirect,
+    IndexedIndirectX,
+    IndirectIndexedY,
+    Relative
 };
 
-
-class Disassembler
+struct OpcodeInfo
 {
-public:
-    Disassembler(u16 PC, IMem* mem);
-    ~Disassembler();
-
-    void Disassemble(DisassembledInstruction** disassembledInstruction);
-
-private:
-    u16 _PC;
-    NPtr<IMem> _mem;
-
-    // Helpers
-    u8 LoadBBumpPC()
-    {
-        return _mem->loadb(_PC++);
-    }
-
-    u16 LoadWBumpPC()
-    {
-        u16 val = _mem->loadw(_PC);
-        _PC += 2;
-        return val;
-    }
-
-    u16 GetBranchTarget()
-    {
-        i8 disp = (i8)LoadBBumpPC();
-        return (u16)((i32)_PC + (i32)disp);
-    }
-
-    std::string DisBBumpPC()
-    {
-        std::stringstream ss;
-        ss << '$' << std::hex << std::uppercase << std::setw(2) << std::setfill('0') << (int)LoadBBumpPC();
-        return ss.str();
-    }
-
-    std::string DisWBumpPC()
-    {
-        std::stringstream ss;
-        ss << '$' << std::hex << std::uppercase << std::setw(4) << std::setfill('0') << (int)LoadWBumpPC();
-        return ss.str();
-    }
-
-    std::string DisBranchTarget()
-    {
-        std::stringstream ss;
-        ss << '$' << std::hex << std::uppercase << std::setw(4) << std::setfill('0') << (int)GetBranchTarget();
-        return ss.str();
-    }
-
-    u8 PeekPC(int offset = 0)
-    {
-        return _mem->loadb(_PC + offset);
-    }
-
-    // Addressing Modes
-    void Immediate(DisassembledInstruction* instr) 
-    { 
-        instr->_bytes.push_back(PeekPC());
-        instr->_ss << '#' << DisBBumpPC(); 
-    }
-
-    void Accumulator(DisassembledInstruction* instr) { }
+    const char* Mnemonic; // null for opcodes the cpu doesn't run
+    AddressingMode Mode;
+    u8 Length;
+};
 
-    void ZeroPage(DisassembledInstruction* instr) 
-    {
-        instr->_bytes.push_back(PeekPC());
-        instr->_ss << DisBBumpPC(); 
-    }
+struct OpcodeEntry
+{
+    u8 Op;
+    const char* Mnemonic;
+    AddressingMode Mode;
+};
 
-    void ZeroPageX(DisassembledInstruction* instr) 
-    {
-        instr->_bytes.push_back(PeekPC()); 
-        instr->_ss << DisBBumpPC() << ",X"; 
-    }
+#define OPCODE_ENTRY(code, mode, instruction, mnemonic) { code, #mnemonic, AddressingMode::mode },
 
-    void ZeroPageY(DisassembledInstruction* instr) 
-    {
-        instr->_bytes.push_back(PeekPC());
-        instr->_ss << DisBBumpPC() << ",Y"; 
-    }
+// Every opcode in DECODE, from the same list
+static constexpr OpcodeEntry OPCODE_LIST[] =
+{
+    OPCODES(OPCODE_ENTRY, OPCODE_ENTRY)
+};
 
-    void Absolute(DisassembledInstruction* instr) 
-    {
-        instr->_bytes.push_back(PeekPC());
-        instr->_bytes.push_back(PeekPC(1));
-        instr->_ss << DisWBumpPC(); 
-    }
+#undef OPCODE_ENTRY
 
-    void AbsoluteX(DisassembledInstruction* instr) 
-    {
-        instr->_bytes.push_back(PeekPC());
-        instr->_bytes.push_back(PeekPC(1));
-        instr->_ss << DisWBumpPC() << ",X"; 
-    }
+struct OpcodeTable
+{
+    OpcodeInfo Opcodes[0x100];
+};
 
-    void AbsoluteY(DisassembledInstruction* instr)
-    {
-        instr->_bytes.push_back(PeekPC());
-        instr->_bytes.push_back(PeekPC(1));
-        instr->_ss << DisWBumpPC() << ",Y"; 
-    }
+constexpr u8 AddressingModeLength(AddressingMode mode)
+{
+    return mode == AddressingMode::Implied || mode == AddressingMode::Accumulator ? 1
+        : mode == AddressingMode::Absolute || mode == AddressingMode::AbsoluteX || mode == AddressingMode::AbsoluteY || mode == AddressingMode::Indirect ? 3
+        : 2;
+}
 
-    void IndexedIndirectX(DisassembledInstruction* instr) 
+constexpr OpcodeTable MakeOpcodeTable()
+{
+    OpcodeTable table = {};
+    for (u32 op = 0; op < 0x100; op++)
     {
-        instr->_bytes.push_back(PeekPC());
-        instr->_ss << '(' << DisBBumpPC() << ",X)"; 
+        table.Opcodes[op] = { nullptr, AddressingMode::Implied, 1 };
     }
-
-    void IndirectIndexedY(DisassembledInstruction* instr) 
+    for (const OpcodeEntry& entry : OPCODE_LIST)
     {
-        instr->_bytes.push_back(PeekPC());
-        instr->_ss << '(' << DisBBumpPC() << "),Y"; 
+        table.Opcodes[entry.Op] = { entry.Mnemonic, entry.Mode, AddressingModeLength(entry.Mode) };
     }
-
-    // Instructions
-#define INSTRUCTION(codeName, displayName) \
-void codeName(DisassembledInstruction* instr) \
-{ \
-    std::string address = instr->_ss.str(); \
-    instr->_ss.str(displayName); \
-    instr->_ss << ' ' << address; \
-} 
-
-#define IMPLIED(codeName, displayName) \
-void codeName(DisassembledInstruction* instr) { \
-    instr->_ss << displayName; \
+    return table;
 }
 
-#define BRANCH(codeName, displayName) \
-void codeName(DisassembledInstruction* instr) \
-{ \
-    instr->_bytes.push_back(PeekPC()); \
-    instr->_ss << displayName << ' ' << DisBranchTarget(); \
-}
-
-    // Loads
-    INSTRUCTION(lda, "LDA")
-    INSTRUCTION(ldx, "LDX")
-    INSTRUCTION(ldy, "LDY")
-
-    // Stores
-    INSTRUCTION(sta, "STA")
-    INSTRUCTION(stx, "STX")
-    INSTRUCTION(sty, "STY")
-
-    // Arithmetic
-    INSTRUCTION(adc, "ADC")
-    INSTRUCTION(sbc, "SBD")
-
-    // Comparisons
-    INSTRUCTION(cmp, "CMP")
-    INSTRUCTION(cpx, "CPX")
-    INSTRUCTION(cpy, "CPY")
-
-    // Bitwise Operations
-    INSTRUCTION(and, "AND")
-    INSTRUCTION(ora, "ORA")
-    INSTRUCTION(eor, "EOR")
-    INSTRUCTION(bit, "BIT")
+static constexpr OpcodeTable OPCODE_TABLE = MakeOpcodeTable();
 
-    // Shifts and Rotates
-    INSTRUCTION(rol, "ROL")
-    INSTRUCTION(ror, "ROR")
-    INSTRUCTION(asl, "ASL")
-    INSTRUCTION(lsr, "LSR")
+// Big enough for any instruction's text or bytes, with the terminator
+const u32 DISASSEMBLY_TEXT_SIZE = 16;
 
-    // Increments and Decrements
-    INSTRUCTION(inc, "INC")
-    INSTRUCTION(dec, "DEC")
-    IMPLIED(inx, "INX")
-    IMPLIED(dex, "DEX")
-    IMPLIED(iny, "INY")
-    IMPLIED(dey, "DEY")
+// The most Disassembler::List writes per byte of prg, for a one byte instruction
+const u32 LIST_SIZE_PER_BYTE = 24;
 
-    // Register Moves
-    IMPLIED(tax, "TAX")
-    IMPLIED(tay, "TAY")
-    IMPLIED(txa, "TXA")
-    IMPLIED(tya, "TYA")
-    IMPLIED(txs, "TXS")
-    IMPLIED(tsx, "TSX")
+// What TraceCode marks the first byte of each instruction it reaches with
+const u8 CODE_INSTRUCTION = 1;
 
-    // Flag Operations
-    IMPLIED(clc, "CLC")
-    IMPLIED(sec, "SEC")
-    IMPLIED(cli, "CLI")
-    IMPLIED(sei, "SEI")
-    IMPLIED(clv, "CLV")
-    IMPLIED(cld, "CLD")
-    IMPLIED(sed, "SED")
-
-    // Branches
-    BRANCH(bpl, "BPL")
-    BRANCH(bmi, "BMI")
-    BRANCH(bvc, "BVC")
-    BRANCH(bvs, "BVS")
-    BRANCH(bcc, "BCC")
-    BRANCH(bcs, "BCS")
-    BRANCH(bne, "BNE")
-    BRANCH(beq, "BEQ")
-
-    // Jumps
-    void jmp(DisassembledInstruction* instr)
-    {
-        instr->_bytes.push_back(PeekPC());
-        instr->_bytes.push_back(PeekPC(1));
-
-        instr->_ss << "JMP " << DisWBumpPC();
-    }
-
-    void jmpi(DisassembledInstruction* instr)
+class Disassembler
+{
+public:
+    static const OpcodeInfo& Opcode(u8 op)
     {
-        instr->_bytes.push_back(PeekPC());
-        instr->_bytes.push_back(PeekPC(1));
-
-        u16 val = _mem->loadw(LoadWBumpPC());
-
-        instr->_ss << "JMP ($" << std::hex << std::uppercase << std::setw(4) << std::setfill('0') << val << ')';
+        return OPCODE_TABLE.Opcodes[op];
     }
 
-    // Procedure Calls
-    void jsr(DisassembledInstruction* instr)
-    {
-        instr->_bytes.push_back(PeekPC());
-        instr->_bytes.push_back(PeekPC(1));
+    // Writes the instruction that starts bytes and sits at pc into text as
+    // "LDA ($12),Y", and returns its length. bytes must hold the whole
+    // instruction. Opcodes the cpu doesn't run are "???" and one byte long.
+    static u32 Format(u16 pc, const u8* bytes, char text[DISASSEMBLY_TEXT_SIZE]);
 
-        instr->_ss << "JSR " << DisWBumpPC();
-    }
-    IMPLIED(rts, "RTS")
-    IMPLIED(brk, "BRK")
-    IMPLIED(rti, "RTI")
+    // Writes the instruction's bytes into text as "B1 12 ", and returns its length
+    static u32 FormatBytes(const u8* bytes, char text[DISASSEMBLY_TEXT_SIZE]);
 
-    // Stack Operations
-    IMPLIED(pha, "PHA")
-    IMPLIED(pla, "PLA")
-    IMPLIED(php, "PHP")
-    IMPLIED(plp, "PLP")
-
-    // No Operation
-    IMPLIED(nop, "NOP")
-};
+    // Follows the code in size bytes of prg, which the cpu sees at base, from
+    // entries and any interrupt vectors prg holds, through branches, jumps and
+    // calls that stay inside it. Marks code (size bytes) with CODE_INSTRUCTION
+    // at the first byte of every instruction reached. Marks already in code
+    // are kept, and followed no further.
+    static void TraceCode(const u8* prg, u32 size, u16 base, const u16* entries, u32 entryCount, u8* code);
 
-#endif
\ No newline at end of file
+    // Lists prg as instructions where code is marked and bytes of data
+    // elsewhere, one line each, into out. out must have room for
+    // size * LIST_SIZE_PER_BYTE chars. Returns how many it wrote, there
+    // is no terminator.
+    static size_t List(const u8* prg, u32 size, u16 base, const u8* code, char* out);
+};
\ No newline at end of file
@@ -1,29 +1,211 @@
 #include "stdafx.h"
 #include "diassembler.h"
-#include "decode.h"
+#include "cpu.h"
 
-#if defined(TRACE)
+static const char HEX_DIGITS[] = "0123456789ABCDEF";
 
-Disassembler::Disassembler(u16 PC, IMem* mem)
-    : _PC(PC)
-    , _mem(mem)
+static const u32 LIST_DATA_PER_LINE = 8;
+
+static char* WriteHex8(char* p, u8 val)
+{
+    p[0] = HEX_DIGITS[val >> 4];
+    p[1] = HEX_DIGITS[val & 0xf];
+    return p + 2;
+}
+
+static char* WriteHex16(char* p, u16 val)
+{
+    p = WriteHex8(p, (u8)(val >> 8));
+    return WriteHex8(p, (u8)val);
+}
+
+// Copies text without its terminator, sized at compile time
+template <size_t Size>
+static char* WriteText(char* p, const char (&text)[Size])
 {
+    memcpy(p, text, Size - 1);
+    return p + Size - 1;
 }
 
-Disassembler::~Disassembler()
+static u16 Word(const u8* bytes)
 {
+    return (u16)(bytes[1] | (bytes[2] << 8));
 }
 
-void Disassembler::Disassemble(DisassembledInstruction** ppDisassembledInstruction)
+// Text as in Format, without the terminator
+static char* WriteInstruction(char* p, u16 pc, const u8* bytes, const OpcodeInfo& info)
 {
-    DisassembledInstruction* am = new DisassembledInstruction();
+    if (info.Mnemonic == nullptr)
+    {
+        return WriteText(p, "???");
+    }
 
-    u8 op = LoadBBumpPC();
-    am->_bytes.push_back(op);
+    // Every mnemonic is three letters
+    memcpy(p, info.Mnemonic, 3);
+    p += 3;
 
-    DECODE(op)
+    switch (info.Mode)
+    {
+    case AddressingMode::Implied:
+    case AddressingMode::Accumulator:
+        break;
+    case AddressingMode::Immediate:
+        p = WriteHex8(WriteText(p, " #$"), bytes[1]);
+        break;
+    case AddressingMode::ZeroPage:
+        p = WriteHex8(WriteText(p, " $"), bytes[1]);
+        break;
+    case AddressingMode::ZeroPageX:
+        p = WriteText(WriteHex8(WriteText(p, " $"), bytes[1]), ",X");
+        break;
+    case AddressingMode::ZeroPageY:
+        p = WriteText(WriteHex8(WriteText(p, " $"), bytes[1]), ",Y");
+        break;
+    case AddressingMode::Absolute:
+        p = WriteHex16(WriteText(p, " $"), Word(bytes));
+        break;
+    case AddressingMode::AbsoluteX:
+        p = WriteText(WriteHex16(WriteText(p, " $"), Word(bytes)), ",X");
+        break;
+    case AddressingMode::AbsoluteY:
+        p = WriteText(WriteHex16(WriteText(p, " $"), Word(bytes)), ",Y");
+        break;
+    case AddressingMode::Indirect:
+        p = WriteText(WriteHex16(WriteText(p, " ($"), Word(bytes)), ")");
+        break;
+    case AddressingMode::IndexedIndirectX:
+        p = WriteText(WriteHex8(WriteText(p, " ($"), bytes[1]), ",X)");
+        break;
+    case AddressingMode::IndirectIndexedY:
+        p = WriteText(WriteHex8(WriteText(p, " ($"), bytes[1]), "),Y");
+        break;
+    case AddressingMode::Relative:
+        p = WriteHex16(WriteText(p, " $"), (u16)(pc + 2 + (i8)bytes[1]));
+        break;
+    }
+    return p;
+}
 
-    *ppDisassembledInstruction = am;
+static char* WriteBytes(char* p, const u8* bytes, u32 length)
+{
+    for (u32 i = 0; i < length; i++)
+    {
+        p = WriteHex8(p, bytes[i]);
+        *p++ = ' ';
+    }
+    return p;
 }
 
-#endif
\ No newline at end of file
+u32 Disassembler::Format(u16 pc, const u8* bytes, char text[DISASSEMBLY_TEXT_SIZE])
+{
+    const OpcodeInfo& info = Opcode(bytes[0]);
+    *WriteInstruction(text, pc, bytes, info) = '\0';
+    return info.Length;
+}
+
+u32 Disassembler::FormatBytes(const u8* bytes, char text[DISASSEMBLY_TEXT_SIZE])
+{
+    const OpcodeInfo& info = Opcode(bytes[0]);
+    *WriteBytes(text, bytes, info.Length) = '\0';
+    return info.Length;
+}
+
+void Disassembler::TraceCode(const u8* prg, u32 size, u16 base, const u16* entries, u32 entryCount, u8* code)
+{
+    std::vector<u16> pending(entries, entries + entryCount);
+
+    // The vectors, when prg is where the cpu reads them from
+    u32 end = base + size;
+    if (base <= NMI_VECTOR && end >= 0x10000)
+    {
+        for (u16 vector : { NMI_VECTOR, RESET_VECTOR, IRQ_VECTOR })
+        {
+            u32 offset = vector - base;
+            pending.push_back((u16)(prg[offset] | (prg[offset + 1] << 8)));
+        }
+    }
+
+    while (!pending.empty())
+    {
+        u16 pc = pending.back();
+        pending.pop_back();
+
+        while (pc >= base && pc < end)
+        {
+            u32 offset = pc - base;
+            const OpcodeInfo& info = Opcode(prg[offset]);
+            if (code[offset] == CODE_INSTRUCTION || info.Mnemonic == nullptr || offset + info.Length > size)
+            {
+                break;
+            }
+            code[offset] = CODE_INSTRUCTION;
+
+            u8 op = prg[offset];
+            u16 target = info.Length == 3 ? Word(prg + offset) : 0;
+            if (info.Mode == AddressingMode::Relative)
+            {
+                pending.push_back((u16)(pc + 2 + (i8)prg[offset + 1]));
+            }
+            else if (op == 0x20)
+            {
+                // jsr, which comes back
+                pending.push_back(target);
+            }
+            else if (op == 0x4c)
+            {
+                pc = target;
+                continue;
+            }
+            else if (op == 0x6c || op == 0x60 || op == 0x40 || op == 0x00)
+            {
+                // jmp (indirect), rts, rti and brk go somewhere only running can tell
+                break;
+            }
+
+            pc += info.Length;
+        }
+    }
+}
+
+size_t Disassembler::List(const u8* prg, u32 size, u16 base, const u8* code, char* out)
+{
+    char* p = out;
+
+    u32 offset = 0;
+    while (offset < size)
+    {
+        u16 pc = (u16)(base + offset);
+        p = WriteHex16(p, pc);
+        *p++ = ' ';
+        *p++ = ' ';
+
+        const OpcodeInfo& info = Opcode(prg[offset]);
+        if (code[offset] == CODE_INSTRUCTION && offset + info.Length <= size)
+        {
+            // The bytes padded to the longest instruction's
+            memcpy(p, "          ", 10);
+            WriteBytes(p, prg + offset, info.Length);
+            p = WriteInstruction(p + 10, pc, prg + offset, info);
+            offset += info.Length;
+        }
+        else
+        {
+            p = WriteText(p, ".byte ");
+            u32 count = 0;
+            do
+            {
+                if (count > 0)
+                {
+                    *p++ = ',';
+                }
+                *p++ = '$';
+                p = WriteHex8(p, prg[offset]);
+                offset++;
+                count++;
+            } while (count < LIST_DATA_PER_LINE && offset < size && code[offset] != CODE_INSTRUCTION);
+        }
+        *p++ = '\n';
+    }
+
+    return p - out;
+}
\ No newline at end of file
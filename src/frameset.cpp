@@ -0,0 +1,42 @@
+#include "stdafx.h"
+#include "frameset.h"
+
+static const u32 FrameSize = 256 * 240 * 4;
+
+FrameSet::FrameSet()
+    : _frames()
+    , _back(0)
+    , _front(1)
+    , _middle(2)
+    , _published(0)
+{
+}
+
+u8* FrameSet::Back()
+{
+    if (_pixels.empty())
+    {
+        _pixels.resize(3 * FrameSize);
+    }
+    return &_pixels[_back * FrameSize];
+}
+
+void FrameSet::Publish()
+{
+    _frames[_back] = ++_published;
+
+    // Release the drawn pixels to whoever acquires them, and acquire the
+    // buffer the showing thread gave up last so drawing over it is safe
+    _back = _middle.exchange(_back | Fresh, std::memory_order_acq_rel) & ~Fresh;
+}
+
+const u8* FrameSet::Acquire(u64* frame)
+{
+    if ((_middle.load(std::memory_order_relaxed) & Fresh) != 0)
+    {
+        _front = _middle.exchange(_front, std::memory_order_acq_rel) & ~Fresh;
+    }
+
+    *frame = _frames[_front];
+    return *frame == 0 ? nullptr : &_pixels[_front * FrameSize];
+}
\ No newline at end of file
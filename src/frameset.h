@@ -0,0 +1,44 @@
+#pragma once
+
+// Three screens shared by one thread that draws frames and one that shows them.
+// The drawing thread owns one buffer, the showing thread owns another and the
+// third sits between them. Publishing swaps the drawn buffer with the one in
+// the middle and acquiring swaps the middle one back out if it holds a frame
+// that hasn't been acquired, so neither side ever waits for the other and the
+// showing thread always gets the newest finished frame. Frames it never got
+// round to showing are simply drawn over.
+class FrameSet
+{
+public:
+    FrameSet();
+
+    FrameSet(const FrameSet&) = delete;
+    FrameSet& operator=(const FrameSet&) = delete;
+
+    // Drawing thread: the buffer to draw the next frame into. Its contents
+    // are whatever was drawn into it last.
+    u8* Back();
+
+    // Drawing thread: hand the frame in Back over to the showing thread
+    void Publish();
+
+    // Showing thread: the newest published frame, which stays put until the
+    // next Acquire. frame gets its number, counting published frames from 1,
+    // and the same number again means nothing new has been published.
+    // returns: null if nothing has been published yet
+    const u8* Acquire(u64* frame);
+
+private:
+    // Set in _middle when the middle buffer has a frame that hasn't been acquired
+    static const u32 Fresh = 4;
+
+    // Allocated by the first Back, as most machines never publish a frame.
+    // The showing thread only gets to it through a published buffer.
+    std::vector<u8> _pixels;
+    u64 _frames[3];
+
+    u32 _back;  // drawing thread only
+    u32 _front; // showing thread only
+    std::atomic<u32> _middle;
+    u64 _published;
+};
\ No newline at end of file
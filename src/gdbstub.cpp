@@ -0,0 +1,673 @@
+#include "stdafx.h"
+#include "gdbstub.h"
+#include "cpu.h"
+#include "mem.h"
+
+#if defined(_WIN32)
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "Ws2_32.lib")
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+#if defined(_WIN32)
+static void CloseSocket(SOCKET s)
+{
+    closesocket(s);
+}
+
+static void ShutdownSocket(SOCKET s)
+{
+    shutdown(s, SD_BOTH);
+}
+#else
+static const int INVALID_SOCKET = -1;
+
+static void CloseSocket(int s)
+{
+    close(s);
+}
+
+static void ShutdownSocket(int s)
+{
+    shutdown(s, SHUT_RDWR);
+}
+#endif
+
+// Registers in the order g and G send them
+static const u32 REGISTER_COUNT = 6;
+
+static const char TARGET_XML[] =
+    "<?xml version=\"1.0\"?>"
+    "<!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+    "<target version=\"1.0\">"
+    "<feature name=\"org.nes.6502.core\">"
+    "<reg name=\"a\" bitsize=\"8\" type=\"uint8\" regnum=\"0\"/>"
+    "<reg name=\"x\" bitsize=\"8\" type=\"uint8\"/>"
+    "<reg name=\"y\" bitsize=\"8\" type=\"uint8\"/>"
+    "<reg name=\"p\" bitsize=\"8\" type=\"uint8\"/>"
+    "<reg name=\"s\" bitsize=\"8\" type=\"uint8\"/>"
+    "<reg name=\"pc\" bitsize=\"16\" type=\"code_ptr\"/>"
+    "</feature>"
+    "</target>";
+
+static int HexValue(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static void AppendHex(std::string& text, u8 val)
+{
+    static const char Digits[] = "0123456789abcdef";
+    text += Digits[val >> 4];
+    text += Digits[val & 0xf];
+}
+
+// Reads hex digits from text at pos up to the first that isn't one
+static u32 ParseHex(const std::string& text, size_t& pos)
+{
+    u32 val = 0;
+    for (; pos < text.size() && HexValue(text[pos]) >= 0; pos++)
+    {
+        val = (val << 4) | HexValue(text[pos]);
+    }
+    return val;
+}
+
+static bool ParseHexBytes(const std::string& text, size_t pos, std::vector<u8>& bytes)
+{
+    bytes.clear();
+    for (; pos + 1 < text.size(); pos += 2)
+    {
+        int hi = HexValue(text[pos]);
+        int lo = HexValue(text[pos + 1]);
+        if (hi < 0 || lo < 0)
+        {
+            return false;
+        }
+        bytes.push_back((u8)((hi << 4) | lo));
+    }
+    return pos == text.size();
+}
+
+static u8* RegisterPointer(CpuRegs& regs, u32 index)
+{
+    switch (index)
+    {
+    case 0: return &regs.A;
+    case 1: return &regs.X;
+    case 2: return &regs.Y;
+    case 3: return &regs.P;
+    case 4: return &regs.S;
+    }
+    return nullptr;
+}
+
+GdbServer::GdbServer(Socket listener, Cpu* cpu, MemoryMap* mem, DebugService* debugger)
+    : _listener(listener)
+    , _client(INVALID_SOCKET)
+    , _cpu(cpu)
+    , _mem(mem)
+    , _debugger(debugger)
+    , _stopped(false)
+    , _resume(false)
+    , _exit(false)
+    , _clientWaiting(false)
+    , _stopReply("S05")
+    , _thread(&GdbServer::Run, this)
+{
+}
+
+GdbServer::~GdbServer()
+{
+    Stop();
+}
+
+bool GdbServer::Create(u16 port, Cpu* cpu, MemoryMap* mem, DebugService* debugger, GdbServer** server)
+{
+    *server = nullptr;
+
+#if defined(_WIN32)
+    WSADATA wsaData;
+    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+    {
+        printf("Unable to start winsock\n");
+        return false;
+    }
+#endif
+
+    Socket s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (s == INVALID_SOCKET)
+    {
+        printf("Unable to create socket\n");
+        return false;
+    }
+
+    int reuse = 1;
+    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+
+    // Only this machine, there is no authentication
+    sockaddr_in local = {};
+    local.sin_family = AF_INET;
+    local.sin_port = htons(port);
+    local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(s, (sockaddr*)&local, sizeof(local)) != 0 || listen(s, 1) != 0)
+    {
+        printf("Unable to listen on port %d\n", port);
+        CloseSocket(s);
+        return false;
+    }
+
+    *server = new GdbServer(s, cpu, mem, debugger);
+    debugger->SetHandler(*server);
+    debugger->RequestPause();
+
+    printf("gdb server listening on 127.0.0.1:%d\n", port);
+    return true;
+}
+
+void GdbServer::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_exit)
+        {
+            return;
+        }
+        _exit = true;
+        _changed.notify_all();
+
+        // Wake the server thread out of accept or recv
+        ShutdownSocket(_listener);
+        if (_client != INVALID_SOCKET)
+        {
+            ShutdownSocket(_client);
+        }
+    }
+
+    _thread.join();
+    CloseSocket(_listener);
+
+    // Nothing the client set may go to a native debugger
+    _debugger->SetHandler(nullptr);
+    _debugger->ClearBreakpoints();
+#if defined(_WIN32)
+    WSACleanup();
+#endif
+}
+
+void GdbServer::OnStop(int dbgEvent, u16 addr)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (_exit)
+    {
+        return;
+    }
+
+    char reply[32];
+    switch (dbgEvent)
+    {
+    case DEBUG_EVENT_BP_READ:
+        snprintf(reply, sizeof(reply), "T05rwatch:%04x;", addr);
+        break;
+    case DEBUG_EVENT_BP_WRITE:
+        snprintf(reply, sizeof(reply), "T05watch:%04x;", addr);
+        break;
+    case DEBUG_EVENT_PAUSE:
+        snprintf(reply, sizeof(reply), "S02");
+        break;
+    default:
+        snprintf(reply, sizeof(reply), "S05");
+        break;
+    }
+    _stopReply = reply;
+
+    _stopped = true;
+    if (_clientWaiting)
+    {
+        _clientWaiting = false;
+        SendPacket(_stopReply);
+    }
+    _changed.notify_all();
+
+    _changed.wait(lock, [this] { return _resume || _exit; });
+    _resume = false;
+    _stopped = false;
+}
+
+void GdbServer::Run()
+{
+    for (;;)
+    {
+        Socket client = accept(_listener, nullptr, nullptr);
+        if (client == INVALID_SOCKET)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_exit)
+            {
+                return;
+            }
+            continue;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_exit)
+            {
+                CloseSocket(client);
+                return;
+            }
+            _client = client;
+            _received.clear();
+        }
+
+        Serve(client);
+
+        // Whatever the client left set goes with it, and the machine runs on
+        std::unique_lock<std::mutex> lock(_mutex);
+        _client = INVALID_SOCKET;
+        _clientWaiting = false;
+        CloseSocket(client);
+
+        if (!_exit)
+        {
+            _debugger->RequestPause();
+            WaitUntilStopped(lock);
+            _debugger->ClearBreakpoints();
+
+            // It may have stopped for something else first
+            _debugger->CancelPause();
+            Resume();
+        }
+    }
+}
+
+void GdbServer::Serve(Socket client)
+{
+    for (;;)
+    {
+        std::string packet;
+        bool interrupt = false;
+        if (!ReadPacket(client, packet, interrupt))
+        {
+            return;
+        }
+
+        if (interrupt)
+        {
+            _debugger->RequestPause();
+            continue;
+        }
+
+        std::string reply;
+        bool replied = Handle(packet, reply);
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (replied)
+        {
+            SendPacket(reply);
+        }
+        if (_exit)
+        {
+            return;
+        }
+    }
+}
+
+bool GdbServer::ReadPacket(Socket client, std::string& data, bool& interrupt)
+{
+    for (;;)
+    {
+        // Acknowledgements from the client need nothing doing
+        size_t start = _received.find_first_not_of("+-");
+        _received.erase(0, start == std::string::npos ? _received.size() : start);
+
+        if (!_received.empty() && _received[0] == '\x03')
+        {
+            _received.erase(0, 1);
+            interrupt = true;
+            return true;
+        }
+
+        size_t begin = _received.find('$');
+        size_t end = begin == std::string::npos ? std::string::npos : _received.find('#', begin);
+        if (end != std::string::npos && end + 2 < _received.size())
+        {
+            data = _received.substr(begin + 1, end - begin - 1);
+
+            u8 checksum = 0;
+            for (char c : data)
+            {
+                checksum += (u8)c;
+            }
+            size_t pos = end + 1;
+            std::string sent = _received.substr(pos, 2);
+            size_t sentPos = 0;
+            bool ok = ParseHex(sent, sentPos) == checksum && sentPos == 2;
+            _received.erase(0, end + 3);
+
+            std::lock_guard<std::mutex> lock(_mutex);
+            send(client, ok ? "+" : "-", 1, 0);
+            if (ok)
+            {
+                return true;
+            }
+            continue;
+        }
+
+        char buffer[1024];
+        int received = recv(client, buffer, sizeof(buffer), 0);
+        if (received <= 0)
+        {
+#if !defined(_WIN32)
+            if (received < 0 && errno == EINTR)
+            {
+                continue;
+            }
+#endif
+            return false;
+        }
+        _received.append(buffer, received);
+    }
+}
+
+void GdbServer::SendPacket(const std::string& data)
+{
+    u8 checksum = 0;
+    for (char c : data)
+    {
+        checksum += (u8)c;
+    }
+
+    std::string packet = "$" + data + "#";
+    AppendHex(packet, checksum);
+    send(_client, packet.data(), (int)packet.size(), 0);
+}
+
+void GdbServer::WaitUntilStopped(std::unique_lock<std::mutex>& lock)
+{
+    _changed.wait(lock, [this] { return _stopped || _exit; });
+}
+
+void GdbServer::Resume()
+{
+    _resume = true;
+    _changed.notify_all();
+}
+
+bool GdbServer::SetWatch(char type, u16 addr, u32 length, bool set)
+{
+    void (DebugService::*setBreakpoint)(BreakpointKind, u16) = &DebugService::SetBreakpoint;
+    void (DebugService::*change)(BreakpointKind, u16) = set ? setBreakpoint : &DebugService::ClearBreakpoint;
+    switch (type)
+    {
+    case '0':
+    case '1':
+        (_debugger->*change)(DEBUG_BP_EXECUTE, addr);
+        return true;
+    case '2':
+    case '3':
+    case '4':
+        for (u32 i = 0; i < length; i++)
+        {
+            if (type != '3')
+            {
+                (_debugger->*change)(DEBUG_BP_WRITE, (u16)(addr + i));
+            }
+            if (type != '2')
+            {
+                (_debugger->*change)(DEBUG_BP_READ, (u16)(addr + i));
+            }
+        }
+        return true;
+    }
+    return false;
+}
+
+bool GdbServer::Handle(const std::string& packet, std::string& reply)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (packet.empty())
+    {
+        return true;
+    }
+
+    char command = packet[0];
+    if (command == '?')
+    {
+        WaitUntilStopped(lock);
+        reply = _stopReply;
+        return true;
+    }
+
+    if (command == 'q')
+    {
+        if (packet.compare(0, 10, "qSupported") == 0)
+        {
+            reply = "PacketSize=4000;qXfer:features:read+";
+        }
+        else if (packet == "qAttached")
+        {
+            reply = "1";
+        }
+        else if (packet.compare(0, 31, "qXfer:features:read:target.xml:") == 0)
+        {
+            size_t pos = 31;
+            u32 offset = ParseHex(packet, pos);
+            pos++;
+            u32 length = ParseHex(packet, pos);
+
+            std::string xml(TARGET_XML);
+            if (offset >= xml.size())
+            {
+                reply = "l";
+            }
+            else
+            {
+                std::string part = xml.substr(offset, length);
+                reply = (offset + part.size() < xml.size() ? "m" : "l") + part;
+            }
+        }
+        return true;
+    }
+
+    if (command == 'H')
+    {
+        reply = "OK";
+        return true;
+    }
+
+    // Everything else needs the machine to hold still
+    if (!_stopped)
+    {
+        reply = "E01";
+        return true;
+    }
+
+    CpuRegs regs = _cpu->Regs();
+    size_t pos = 1;
+    switch (command)
+    {
+    case 'g':
+        for (u32 i = 0; i < REGISTER_COUNT - 1; i++)
+        {
+            AppendHex(reply, *RegisterPointer(regs, i));
+        }
+        AppendHex(reply, (u8)regs.PC);
+        AppendHex(reply, (u8)(regs.PC >> 8));
+        break;
+
+    case 'G':
+    {
+        std::vector<u8> bytes;
+        if (!ParseHexBytes(packet, 1, bytes) || bytes.size() != REGISTER_COUNT + 1)
+        {
+            reply = "E01";
+            break;
+        }
+        for (u32 i = 0; i < REGISTER_COUNT - 1; i++)
+        {
+            *RegisterPointer(regs, i) = bytes[i];
+        }
+        regs.PC = (u16)(bytes[5] | (bytes[6] << 8));
+        _cpu->SetRegs(regs);
+        reply = "OK";
+        break;
+    }
+
+    case 'p':
+    {
+        u32 index = ParseHex(packet, pos);
+        if (index < REGISTER_COUNT - 1)
+        {
+            AppendHex(reply, *RegisterPointer(regs, index));
+        }
+        else if (index == REGISTER_COUNT - 1)
+        {
+            AppendHex(reply, (u8)regs.PC);
+            AppendHex(reply, (u8)(regs.PC >> 8));
+        }
+        else
+        {
+            reply = "E01";
+        }
+        break;
+    }
+
+    case 'P':
+    {
+        u32 index = ParseHex(packet, pos);
+        std::vector<u8> bytes;
+        if (pos >= packet.size() || packet[pos] != '=' || !ParseHexBytes(packet, pos + 1, bytes) || index >= REGISTER_COUNT)
+        {
+            reply = "E01";
+            break;
+        }
+        if (index < REGISTER_COUNT - 1 && bytes.size() == 1)
+        {
+            *RegisterPointer(regs, index) = bytes[0];
+        }
+        else if (index == REGISTER_COUNT - 1 && bytes.size() == 2)
+        {
+            regs.PC = (u16)(bytes[0] | (bytes[1] << 8));
+        }
+        else
+        {
+            reply = "E01";
+            break;
+        }
+        _cpu->SetRegs(regs);
+        reply = "OK";
+        break;
+    }
+
+    case 'm':
+    {
+        u32 addr = ParseHex(packet, pos);
+        pos++;
+        u32 length = ParseHex(packet, pos);
+        for (u32 i = 0; i < length && i < 0x10000; i++)
+        {
+            AppendHex(reply, _mem->PeekCode((u16)(addr + i)));
+        }
+        break;
+    }
+
+    case 'M':
+    {
+        u32 addr = ParseHex(packet, pos);
+        pos++;
+        u32 length = ParseHex(packet, pos);
+        std::vector<u8> bytes;
+        if (pos >= packet.size() || packet[pos] != ':' || !ParseHexBytes(packet, pos + 1, bytes) || bytes.size() != length)
+        {
+            reply = "E01";
+            break;
+        }
+
+        // Only ram, writes anywhere else would switch banks or poke the
+        // ppu and apu. Nothing is written unless all of it can be.
+        bool writable = true;
+        for (u32 i = 0; i < length; i++)
+        {
+            u32 byteAddr = addr + i;
+            writable &= byteAddr < 0x2000 || (byteAddr >= 0x6000 && byteAddr < 0x8000);
+        }
+        if (!writable)
+        {
+            reply = "E01";
+            break;
+        }
+
+        for (u32 i = 0; i < length; i++)
+        {
+            _mem->storeb((u16)(addr + i), bytes[i]);
+        }
+        reply = "OK";
+        break;
+    }
+
+    case 'Z':
+    case 'z':
+    {
+        // Z<type>,<addr>,<kind or length>
+        pos = 2;
+        if (packet.size() < 2 || (pos < packet.size() && packet[pos] != ','))
+        {
+            reply = "E01";
+            break;
+        }
+        pos++;
+        u32 addr = ParseHex(packet, pos);
+        pos++;
+        u32 length = ParseHex(packet, pos);
+
+        // Watchpoints take a breakpoint per byte, so they have to fit the
+        // address space
+        bool watch = packet[1] >= '2' && packet[1] <= '4';
+        if (watch && (length == 0 || length > 0x10000 || addr > 0x10000 - length))
+        {
+            reply = "E01";
+            break;
+        }
+        reply = SetWatch(packet[1], (u16)addr, length, command == 'Z') ? "OK" : "";
+        break;
+    }
+
+    case 'c':
+    case 's':
+        // c and s may say where to carry on from
+        if (pos < packet.size())
+        {
+            regs.PC = (u16)ParseHex(packet, pos);
+            _cpu->SetRegs(regs);
+        }
+        if (command == 's')
+        {
+            _debugger->EnableSingleStep();
+        }
+        _clientWaiting = true;
+        Resume();
+        return false;
+
+    case 'D':
+        _debugger->ClearBreakpoints();
+        Resume();
+        reply = "OK";
+        break;
+
+    case 'k':
+        _debugger->ClearBreakpoints();
+        Resume();
+        return false;
+    }
+    return true;
+}
\ No newline at end of file
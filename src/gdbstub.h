@@ -0,0 +1,99 @@
+#pragma once
+
+#include <condition_variable>
+#include <thread>
+
+#include "debug.h"
+
+class Cpu;
+class MemoryMap;
+
+// GDB remote serial protocol server on a localhost TCP port, for debugging
+// a game on a machine with no native debugger (see Nes::StartGdbServer).
+//
+// The client sees the 6502 as registers a, x, y, p, s (8 bits) and pc
+// (16 bits, little endian), in that order, plus the cpu's 64KB address
+// space. Reads skip the registers at $2000-$5fff and read as 0, as reading
+// those has side effects. Writes are only taken for work ram ($0000-$1fff)
+// and cart ram ($6000-$7fff), as the rest would reach the registers and
+// the mapper. It can set breakpoints (Z0/Z1), write, read and access
+// watchpoints (Z2/Z3/Z4), continue, single step and interrupt.
+//
+// The server waits for clients on its own thread, one at a time. The
+// emulation thread only ever stops between instructions, in OnStop, and
+// everything that touches the machine happens while it is stopped there.
+// The machine starts stopped, before its next instruction, so a client
+// can connect before anything runs.
+class GdbServer : public IDebugHandler, public NesObject
+{
+private:
+#if defined(_WIN32)
+    typedef uintptr_t Socket;
+#else
+    typedef int Socket;
+#endif
+
+    GdbServer(Socket listener, Cpu* cpu, MemoryMap* mem, DebugService* debugger);
+
+public:
+    virtual ~GdbServer();
+
+public:
+    DELEGATE_NESOBJECT_REFCOUNTING();
+
+    // Listens on 127.0.0.1:port and becomes debugger's handler
+    static bool Create(u16 port, Cpu* cpu, MemoryMap* mem, DebugService* debugger, GdbServer** server);
+
+    // Stops taking clients, waits for the server thread to finish and takes
+    // the debugger's handler and breakpoints away. On the thread running the
+    // machine, between frames. Called by the destructor if not before.
+    void Stop();
+
+    // IDebugHandler
+public:
+    void OnStop(int dbgEvent, u16 addr);
+
+private:
+    void Run();
+    void Serve(Socket client);
+
+    // Reads one packet's data, acknowledging it, or sets interrupt if the
+    // client sent one instead.
+    // returns: false if the client has gone
+    bool ReadPacket(Socket client, std::string& data, bool& interrupt);
+    void SendPacket(const std::string& data);
+
+    // Answers a packet. Returns false when there is to be no reply yet (the
+    // machine has been let go and the reply comes when it stops again).
+    bool Handle(const std::string& packet, std::string& reply);
+
+    void WaitUntilStopped(std::unique_lock<std::mutex>& lock);
+    void Resume();
+    bool SetWatch(char type, u16 addr, u32 length, bool set);
+
+private:
+    Socket _listener;
+    Socket _client;
+
+    NPtr<Cpu> _cpu;
+    NPtr<MemoryMap> _mem;
+    NPtr<DebugService> _debugger;
+
+    std::mutex _mutex;
+    std::condition_variable _changed;
+
+    // The emulation thread is in OnStop, and may go once _resume is set
+    bool _stopped;
+    bool _resume;
+    bool _exit;
+
+    // The client was let go and is waiting to hear why the machine stopped
+    bool _clientWaiting;
+    std::string _stopReply;
+
+    // Received bytes not yet taken as packets
+    std::string _received;
+
+    // Last so it starts after everything above is initialized
+    std::thread _thread;
+};
\ No newline at end of file
@@ -0,0 +1,85 @@
+#include "stdafx.h"
+#include "heatmap.h"
+
+#include <algorithm>
+
+MemoryHeatmap::MemoryHeatmap()
+{
+    Clear();
+}
+
+void MemoryHeatmap::Clear()
+{
+    memset(_cpuReads, 0, sizeof(_cpuReads));
+    memset(_cpuWrites, 0, sizeof(_cpuWrites));
+    memset(_ppuReads, 0, sizeof(_ppuReads));
+    memset(_ppuWrites, 0, sizeof(_ppuWrites));
+}
+
+static void WriteAddresses(std::ostream& out, const char* space, const u32* reads, const u32* writes, u32 size)
+{
+    char line[64];
+    for (u32 addr = 0; addr < size; addr++)
+    {
+        if (reads[addr] != 0 || writes[addr] != 0)
+        {
+            snprintf(line, sizeof(line), "%s $%04X %u %u\n", space, addr, reads[addr], writes[addr]);
+            out << line;
+        }
+    }
+}
+
+void MemoryHeatmap::WriteTable(std::ostream& out)
+{
+    char line[64];
+
+    out << "# cpu pages: page reads writes\n";
+    for (u32 page = 0; page < CPU_SPACE / 0x100; page++)
+    {
+        u64 reads = 0;
+        u64 writes = 0;
+        for (u32 addr = page * 0x100; addr < (page + 1) * 0x100; addr++)
+        {
+            reads += _cpuReads[addr];
+            writes += _cpuWrites[addr];
+        }
+        if (reads != 0 || writes != 0)
+        {
+            snprintf(line, sizeof(line), "page $%02X %llu %llu\n", page, (unsigned long long)reads, (unsigned long long)writes);
+            out << line;
+        }
+    }
+
+    out << "# addresses: space address reads writes\n";
+    WriteAddresses(out, "cpu", _cpuReads, _cpuWrites, CPU_SPACE);
+    WriteAddresses(out, "ppu", _ppuReads, _ppuWrites, PPU_SPACE);
+}
+
+void MemoryHeatmap::WriteCpuImage(std::ostream& out)
+{
+    WriteImage(out, _cpuReads, _cpuWrites, CPU_SPACE);
+}
+
+void MemoryHeatmap::WritePpuImage(std::ostream& out)
+{
+    WriteImage(out, _ppuReads, _ppuWrites, PPU_SPACE);
+}
+
+void MemoryHeatmap::WriteImage(std::ostream& out, const u32* reads, const u32* writes, u32 size)
+{
+    u32 most = std::max(*std::max_element(reads, reads + size), *std::max_element(writes, writes + size));
+
+    // Anything used at all is at least dim, so a single access still shows
+    double scale = most == 0 ? 0 : 223.0 / log(1.0 + most);
+    auto level = [scale](u32 count) { return count == 0 ? (u8)0 : (u8)(32 + scale * log(1.0 + count)); };
+
+    out << "P6\n256 " << size / 256 << "\n255\n";
+    std::vector<u8> pixels(size * 3);
+    for (u32 addr = 0; addr < size; addr++)
+    {
+        pixels[addr * 3] = level(writes[addr]);
+        pixels[addr * 3 + 1] = level(reads[addr]);
+        pixels[addr * 3 + 2] = 0;
+    }
+    out.write((const char*)pixels.data(), pixels.size());
+}
\ No newline at end of file
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "interfaces.h"
+
+// How many times each address was read and written, in the cpu's 64KB
+// address space and the ppu's 16KB one, to see which ram a game uses, which
+// pages it writes most and how hard it polls registers like $2002.
+//
+// The cpu side counts every access on the bus, instructions, dma and the
+// apu's sample fetches alike. The ppu side counts $2007 accesses and the
+// reads made drawing a frame, which are made per pixel rather than in the
+// real ppu's fetch pattern and only for frames that are drawn.
+//
+// Counts are 32 bits, which is plenty for a window of a few thousand
+// frames; Clear starts a new window.
+class MemoryHeatmap : public NesObject
+{
+public:
+    static const u32 CPU_SPACE = 0x10000;
+    static const u32 PPU_SPACE = 0x4000;
+
+    MemoryHeatmap();
+
+public:
+    DELEGATE_NESOBJECT_REFCOUNTING();
+
+    void CpuRead(u16 addr) { _cpuReads[addr]++; }
+    void CpuWrite(u16 addr) { _cpuWrites[addr]++; }
+
+    // addr is below $4000
+    void PpuRead(u16 addr) { _ppuReads[addr]++; }
+    void PpuWrite(u16 addr) { _ppuWrites[addr]++; }
+
+    void Clear();
+
+    const u32* CpuReads() { return _cpuReads; }
+    const u32* CpuWrites() { return _cpuWrites; }
+    const u32* PpuReads() { return _ppuReads; }
+    const u32* PpuWrites() { return _ppuWrites; }
+
+    // Totals per 256 byte cpu page, then every address that was used, as text
+    void WriteTable(std::ostream& out);
+
+    // .ppm images with a pixel per address, 256 to a row, reads in green and
+    // writes in red on a log scale up to the most used address
+    void WriteCpuImage(std::ostream& out);
+    void WritePpuImage(std::ostream& out);
+
+private:
+    static void WriteImage(std::ostream& out, const u32* reads, const u32* writes, u32 size);
+
+private:
+    u32 _cpuReads[CPU_SPACE];
+    u32 _cpuWrites[CPU_SPACE];
+    u32 _ppuReads[PPU_SPACE];
+    u32 _ppuWrites[PPU_SPACE];
+};
\ No newline at end of file
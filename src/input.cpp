@@ -4,6 +4,7 @@
 Input::Input()
     : _port0(std::make_unique<EmptyPort>())
     , _port1(std::make_unique<EmptyPort>())
+    , _standardControllers{}
 {
 }
 
@@ -51,6 +52,7 @@ IStandardController* Input::GetStandardController(unsigned int port)
 
     std::unique_ptr<StandardController> controller = std::make_unique<StandardController>();
     IStandardController* ptr = static_cast<IStandardController*>(controller.get());
+    _standardControllers[port] = controller.get();
     if (port == 0)
     {
         _port0 = std::move(controller);
@@ -63,6 +65,20 @@ IStandardController* Input::GetStandardController(unsigned int port)
     return ptr;
 }
 
+void Input::SetButtons(unsigned int port, u8 buttons)
+{
+    if (port >= 2)
+    {
+        return;
+    }
+
+    if (_standardControllers[port] == nullptr)
+    {
+        GetStandardController(port);
+    }
+    _standardControllers[port]->SetButtons(buttons);
+}
+
 // Standard Controller Implementation
 
 StandardController::StandardController()
@@ -206,3 +222,26 @@ void StandardController::Right(bool state)
     }
     _Right_actual = state;
 }
+
+void StandardController::SetButtons(unsigned char buttons)
+{
+    bool up = (buttons & NES_BUTTON_UP) != 0;
+    bool down = (buttons & NES_BUTTON_DOWN) != 0;
+    bool left = (buttons & NES_BUTTON_LEFT) != 0;
+    bool right = (buttons & NES_BUTTON_RIGHT) != 0;
+
+    _A = (buttons & NES_BUTTON_A) != 0;
+    _B = (buttons & NES_BUTTON_B) != 0;
+    _Select = (buttons & NES_BUTTON_SELECT) != 0;
+    _Start = (buttons & NES_BUTTON_START) != 0;
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    _Up = up && !down;
+    _Down = down && !up;
+    _Left = left && !right;
+    _Right = right && !left;
+    _Up_actual = up;
+    _Down_actual = down;
+    _Left_actual = left;
+    _Right_actual = right;
+}
\ No newline at end of file
@@ -26,6 +26,8 @@ public:
     u8 Read() { return 0; }
 };
 
+class StandardController;
+
 class Input : public IMem, public NesObject
 {
 public:
@@ -48,9 +50,16 @@ public:
 public:
     IStandardController* GetStandardController(unsigned int port);
 
+    // Set a port's buttons without going through IStandardController,
+    // connecting a standard controller if the port doesn't have one
+    void SetButtons(unsigned int port, u8 buttons);
+
 private:
     std::unique_ptr<IControllerPortDevice> _port0;
     std::unique_ptr<IControllerPortDevice> _port1;
+
+    // The standard controller on each port, if that's what is connected
+    StandardController* _standardControllers[2];
 };
 
 class StandardController : public IControllerPortDevice, public IStandardController, public NesObject
@@ -77,6 +86,7 @@ public:
     void Down(bool state);
     void Left(bool state);
     void Right(bool state);
+    void SetButtons(unsigned char buttons);
 
 private:
     std::mutex _mutex;
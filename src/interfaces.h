@@ -1,11 +1,11 @@
 #pragma once
 
-#include "..\include\nes_interfaces.h"
+#include "../include/nes_interfaces.h"
 
 struct ISaveState : public IBaseInterface
 {
-    virtual void SaveState(std::ofstream& ofs) = 0;
-    virtual void LoadState(std::ifstream& ifs) = 0;
+    virtual void SaveState(std::ostream& ofs) = 0;
+    virtual void LoadState(std::istream& ifs) = 0;
 };
 
 // Standard Memory Interace
@@ -16,8 +16,8 @@ public:
     virtual void storeb(u16 addr, u8 val) = 0;
 
     // default ISaveState
-    virtual void SaveState(std::ofstream& ofs) { }
-    virtual void LoadState(std::ifstream& ifs) { }
+    virtual void SaveState(std::ostream& ofs) { }
+    virtual void LoadState(std::istream& ifs) { }
 
     u16 loadw(u16 addr)
     {
@@ -54,6 +54,10 @@ class IMapper : public ISaveState
 protected:
     IMapper(Rom* rom);
 
+    // For mappers that stand in for the cart's without a Rom, like the
+    // renderers' recorded chr
+    IMapper();
+
 public:
     static bool CreateMapper(Rom* rom, IMapper** mapper);
     virtual void Reset(bool hard);
@@ -64,11 +68,19 @@ public:
     virtual u8 chr_loadb(u16 addr) = 0;
     virtual void chr_storeb(u16 addr, u8 val) = 0;
 
+    // Where in PrgRom a cpu address from $8000 up reads from with the banks
+    // as they are now. For tools that need to tell banked code apart.
+    virtual u32 prg_rom_offset(u16 addr) = 0;
+
+    // Where in ChrRom a ppu address below $2000 reads from with the banks as
+    // they are now, for games with chr rom.
+    virtual u32 chr_rom_offset(u16 addr) = 0;
+
     virtual bool Scanline();
 
 public:
-    virtual void SaveState(std::ofstream& ofs);
-    virtual void LoadState(std::ifstream& ifs);
+    virtual void SaveState(std::ostream& ofs);
+    virtual void LoadState(std::istream& ifs);
 
 public:
     NameTableMirroring Mirroring;
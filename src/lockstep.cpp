@@ -0,0 +1,242 @@
+#include "stdafx.h"
+#include "lockstep.h"
+#include "decode.h"
+
+template <u32 Lanes>
+LockstepCpu<Lanes>::LockstepCpu(const u8* prg, u32 prgSize, IMem* const* io)
+    : _prg(prg)
+    , _prgMask((u16)(prgSize - 1))
+{
+    for (u32 i = 0; i < Lanes; i++)
+    {
+        _io[i] = io[i];
+    }
+    Reset();
+}
+
+template <u32 Lanes>
+void LockstepCpu<Lanes>::Reset()
+{
+    CpuRegs regs;
+    memset(_ram, 0, sizeof(_ram));
+    memset(&_stats, 0, sizeof(_stats));
+
+    for (u32 i = 0; i < Lanes; i++)
+    {
+        _a[i] = regs.A;
+        _x[i] = regs.X;
+        _y[i] = regs.Y;
+        _p[i] = regs.P;
+        _s[i] = regs.S;
+        _pc[i] = (u16)LoadLane(i, RESET_VECTOR) | ((u16)LoadLane(i, RESET_VECTOR + 1) << 8);
+        _cycles[i] = 0;
+    }
+}
+
+template <u32 Lanes>
+CpuRegs LockstepCpu<Lanes>::Regs(u32 lane)
+{
+    CpuRegs regs;
+    regs.A = _a[lane];
+    regs.X = _x[lane];
+    regs.Y = _y[lane];
+    regs.P = _p[lane];
+    regs.S = _s[lane];
+    regs.PC = _pc[lane];
+    return regs;
+}
+
+template <u32 Lanes>
+void LockstepCpu<Lanes>::Run(u32 cycles)
+{
+    for (;;)
+    {
+        // The lane furthest behind leads, so lanes that split up wait for
+        // each other and have a chance to meet again
+        u32 leader = Lanes;
+        for (u32 i = 0; i < Lanes; i++)
+        {
+            if (_cycles[i] < cycles && (leader == Lanes || _cycles[i] < _cycles[leader]))
+            {
+                leader = i;
+            }
+        }
+
+        if (leader == Lanes)
+        {
+            break;
+        }
+
+        // Code in ram can differ between lanes
+        u16 pc = _pc[leader];
+        u32 count = 0;
+        for (u32 i = 0; i < Lanes; i++)
+        {
+            _active[i] = i == leader || (pc >= 0x8000 && _pc[i] == pc && _cycles[i] < cycles);
+            count += _active[i] ? 1 : 0;
+        }
+
+        _leader = leader;
+        Step();
+
+        _stats.Steps++;
+        _stats.LaneInstructions += count;
+        _stats.FullSteps += count == Lanes ? 1 : 0;
+    }
+}
+
+template <u32 Lanes>
+void LockstepCpu<Lanes>::Step()
+{
+    _fetchPC = _pc[_leader];
+    _pcWritten = false;
+    _op = LoadBBumpPC();
+
+    DECODE(_op)
+
+    u8 cycles = CYCLE_TABLE[_op];
+    for (u32 i = 0; i < Lanes; i++)
+    {
+        _cycles[i] += _active[i] ? cycles : 0;
+        if (!_pcWritten)
+        {
+            _pc[i] = Select(i, _fetchPC, _pc[i]);
+        }
+    }
+}
+
+template <u32 Lanes>
+void LockstepCpu<Lanes>::Nmi(u32 lane)
+{
+    PushLane(lane, (_pc[lane] >> 8) & 0xff);
+    PushLane(lane, _pc[lane] & 0xff);
+    PushLane(lane, _p[lane]);
+    _pc[lane] = (u16)LoadLane(lane, NMI_VECTOR) | ((u16)LoadLane(lane, NMI_VECTOR + 1) << 8);
+    _cycles[lane] += 7;
+}
+
+template <u32 Lanes>
+void LockstepCpu<Lanes>::Irq(u32 lane)
+{
+    if (GetFlag(lane, Flag::IRQ))
+    {
+        return;
+    }
+
+    PushLane(lane, (_pc[lane] >> 8) & 0xff);
+    PushLane(lane, _pc[lane] & 0xff);
+    PushLane(lane, _p[lane]);
+    _p[lane] |= (u8)Flag::IRQ;
+    _pc[lane] = (u16)LoadLane(lane, IRQ_VECTOR) | ((u16)LoadLane(lane, IRQ_VECTOR + 1) << 8);
+    _cycles[lane] += 7;
+}
+
+template <u32 Lanes>
+u8 LockstepCpu<Lanes>::LoadLane(u32 lane, u16 addr)
+{
+    if (addr < 0x2000)
+    {
+        return _ram[addr & 0x7ff][lane];
+    }
+    else if (addr >= 0x8000)
+    {
+        return _prg[addr & _prgMask];
+    }
+    else
+    {
+        return _io[lane]->loadb(addr);
+    }
+}
+
+template <u32 Lanes>
+void LockstepCpu<Lanes>::StoreLane(u32 lane, u16 addr, u8 val)
+{
+    if (addr < 0x2000)
+    {
+        _ram[addr & 0x7ff][lane] = val;
+    }
+    else if (addr == 0x4014)
+    {
+        // Oam dma, done all at once rather than a byte per step as Cpu does
+        u16 readAddress = ((u16)val) << 8;
+        for (u32 i = 0; i < 0x100; i++)
+        {
+            _io[lane]->storeb(0x2004, LoadLane(lane, readAddress + i));
+        }
+        _cycles[lane] += 0x200;
+    }
+    else
+    {
+        _io[lane]->storeb(addr, val);
+    }
+}
+
+template <u32 Lanes>
+void LockstepCpu<Lanes>::Load(u8* vals)
+{
+    if (_mode == Mode::Accumulator)
+    {
+        memcpy(vals, _a, Lanes);
+    }
+    else if (_mode == Mode::Immediate)
+    {
+        memset(vals, _imm, Lanes);
+    }
+    else if (_uniform && _addr[_leader] < 0x2000)
+    {
+        // The common case, a whole row of ram in one go
+        memcpy(vals, _ram[_addr[_leader] & 0x7ff], Lanes);
+    }
+    else if (_uniform && _addr[_leader] >= 0x8000)
+    {
+        memset(vals, _prg[_addr[_leader] & _prgMask], Lanes);
+    }
+    else
+    {
+        // Io has side effects, so only the active lanes may touch it
+        for (u32 i = 0; i < Lanes; i++)
+        {
+            if (_active[i])
+            {
+                vals[i] = LoadLane(i, _addr[i]);
+            }
+        }
+    }
+}
+
+template <u32 Lanes>
+void LockstepCpu<Lanes>::Store(const u8* vals)
+{
+    if (_mode == Mode::Accumulator)
+    {
+        for (u32 i = 0; i < Lanes; i++)
+        {
+            _a[i] = Select(i, vals[i], _a[i]);
+        }
+    }
+    else if (_mode == Mode::Immediate)
+    {
+        // Can't store to immediate
+    }
+    else if (_uniform && _addr[_leader] < 0x2000)
+    {
+        u8* row = _ram[_addr[_leader] & 0x7ff];
+        for (u32 i = 0; i < Lanes; i++)
+        {
+            row[i] = Select(i, vals[i], row[i]);
+        }
+    }
+    else
+    {
+        for (u32 i = 0; i < Lanes; i++)
+        {
+            if (_active[i])
+            {
+                StoreLane(i, _addr[i], vals[i]);
+            }
+        }
+    }
+}
+
+template class LockstepCpu<8>;
+template class LockstepCpu<16>;
\ No newline at end of file
@@ -0,0 +1,485 @@
+#pragma once
+
+#include "cpu.h"
+
+// Experimental: several 6502s running the same program in lockstep.
+// Registers and work ram are kept as structure of arrays, one lane per
+// instance, with work ram interleaved so a byte at one address is contiguous
+// across the lanes. Instructions are decoded once, using the same DECODE
+// table and the same instruction semantics (CpuAlu) as Cpu, and applied to
+// every lane with plain loops that the compiler turns into SIMD.
+//
+// Each step runs the lanes whose PC matches the lane furthest behind. While
+// the instances agree that is all of them; once they diverge it shrinks to
+// smaller groups or single lanes, and grows again when they meet at the same
+// PC. Code running from ram always runs one lane at a time.
+//
+// Only the cpu is modeled. Work ram ($0000-$1fff) and a fixed 16K or 32K prg
+// rom at $8000 are handled here, everything else goes to each lane's io bus.
+template <u32 Lanes>
+class LockstepCpu
+{
+public:
+    struct Stats
+    {
+        u64 Steps;              // decoded instructions
+        u64 LaneInstructions;   // instructions summed over the lanes that ran them
+        u64 FullSteps;          // steps that ran every lane
+    };
+
+    // prg: mapped at $8000, mirrored if 16K
+    // io: each lane's bus for $2000-$7fff and writes to $8000-$ffff
+    LockstepCpu(const u8* prg, u32 prgSize, IMem* const* io);
+
+    void Reset();
+
+    // Run every lane until its cycle count reaches cycles
+    void Run(u32 cycles);
+
+    void Nmi(u32 lane);
+    void Irq(u32 lane);
+
+    CpuRegs Regs(u32 lane);
+    u32 Cycles(u32 lane) { return _cycles[lane]; }
+    u8 PeekRam(u32 lane, u16 addr) { return _ram[addr & 0x7ff][lane]; }
+
+    const Stats& GetStats() { return _stats; }
+
+private:
+    enum class Mode : u8
+    {
+        Accumulator,
+        Immediate,
+        Memory
+    };
+
+    void Step();
+
+    // One lane's view of memory
+    u8 LoadLane(u32 lane, u16 addr);
+    void StoreLane(u32 lane, u16 addr, u8 val);
+    u16 LoadWZeroPageLane(u32 lane, u8 addr)
+    {
+        return (u16)_ram[addr][lane] | ((u16)_ram[(u8)(addr + 1)][lane] << 8);
+    }
+    void PushLane(u32 lane, u8 val)
+    {
+        _ram[0x100 | _s[lane]][lane] = val;
+        _s[lane]--;
+    }
+    u8 PopLane(u32 lane)
+    {
+        return _ram[0x100 | ++_s[lane]][lane];
+    }
+
+    // Operands come from the leader, every lane in the step has the same PC
+    u8 LoadBBumpPC() { return LoadLane(_leader, _fetchPC++); }
+    u16 LoadWBumpPC()
+    {
+        u16 lo = LoadBBumpPC();
+        u16 hi = LoadBBumpPC();
+        return (hi << 8) | lo;
+    }
+
+    // Keep val in active lanes and old in the rest
+    template <typename T>
+    T Select(u32 lane, T val, T old) { return _active[lane] ? val : old; }
+
+    // The flags CpuAlu leaves in p, in active lanes
+    void KeepP(u32 lane, u8 p) { _p[lane] = Select(lane, p, _p[lane]); }
+
+    u8 SetZN(u32 lane, u8 val)
+    {
+        u8 p = _p[lane];
+        CpuAlu::SetZN(p, val);
+        KeepP(lane, p);
+        return val;
+    }
+
+    void SetFlag(u32 lane, Flag flag, bool on)
+    {
+        u8 p = _p[lane];
+        CpuAlu::SetFlag(p, flag, on);
+        KeepP(lane, p);
+    }
+
+    bool GetFlag(u32 lane, Flag flag) { return CpuAlu::GetFlag(_p[lane], flag); }
+
+    void checkPageCross(u32 lane, u16 lhs, u16 rhs)
+    {
+        if (_active[lane] && CpuAlu::PageCrossed(lhs, rhs))
+        {
+            _cycles[lane]++;
+        }
+    }
+
+    // The operand of the current instruction, per lane
+    void Load(u8* vals);
+    void Store(const u8* vals);
+
+    // Addressing Modes
+    void Immediate()
+    {
+        _imm = LoadBBumpPC();
+        _mode = Mode::Immediate;
+    }
+
+    void Accumulator() { _mode = Mode::Accumulator; }
+
+    void UniformAddress(u16 addr)
+    {
+        for (u32 i = 0; i < Lanes; i++)
+        {
+            _addr[i] = addr;
+        }
+        _uniform = true;
+        _mode = Mode::Memory;
+    }
+
+    void LaneAddresses()
+    {
+        u16 addr = _addr[_leader];
+        bool uniform = true;
+        for (u32 i = 0; i < Lanes; i++)
+        {
+            uniform &= !_active[i] || _addr[i] == addr;
+        }
+        _uniform = uniform;
+        _mode = Mode::Memory;
+    }
+
+    void ZeroPage() { UniformAddress((u16)LoadBBumpPC()); }
+
+    void ZeroPageX()
+    {
+        u8 base = LoadBBumpPC();
+        for (u32 i = 0; i < Lanes; i++)
+        {
+            _addr[i] = (u16)(u8)(base + _x[i]);
+        }
+        LaneAddresses();
+    }
+
+    void ZeroPageY()
+    {
+        u8 base = LoadBBumpPC();
+        for (u32 i = 0; i < Lanes; i++)
+        {
+            _addr[i] = (u16)(u8)(base + _y[i]);
+        }
+        LaneAddresses();
+    }
+
+    void Absolute() { UniformAddress(LoadWBumpPC()); }
+
+    void AbsoluteX()
+    {
+        u16 addr = LoadWBumpPC();
+        bool checkCross = CpuAlu::AbsoluteXCrossCosts(_op);
+
+        for (u32 i = 0; i < Lanes; i++)
+        {
+            _addr[i] = addr + (u16)_x[i];
+            if (checkCross)
+            {
+                checkPageCross(i, addr, _addr[i]);
+            }
+        }
+        LaneAddresses();
+    }
+
+    void AbsoluteY()
+    {
+        u16 addr = LoadWBumpPC();
+        bool checkCross = CpuAlu::AbsoluteYCrossCosts(_op);
+        for (u32 i = 0; i < Lanes; i++)
+        {
+            _addr[i] = addr + (u16)_y[i];
+            if (checkCross)
+            {
+                checkPageCross(i, addr, _addr[i]);
+            }
+        }
+        LaneAddresses();
+    }
+
+    void IndexedIndirectX()
+    {
+        u8 base = LoadBBumpPC();
+        for (u32 i = 0; i < Lanes; i++)
+        {
+            _addr[i] = LoadWZeroPageLane(i, base + _x[i]);
+        }
+        LaneAddresses();
+    }
+
+    void IndirectIndexedY()
+    {
+        u8 base = LoadBBumpPC();
+        for (u32 i = 0; i < Lanes; i++)
+        {
+            u16 addr = LoadWZeroPageLane(i, base);
+            _addr[i] = addr + (u16)_y[i];
+            checkPageCross(i, addr, _addr[i]);
+        }
+        LaneAddresses();
+    }
+
+    // Instructions
+    // Each is Cpu's, through the same CpuAlu, applied to every lane and kept
+    // only in the active ones
+
+    // Loads
+    void lda() { Load(_val); for (u32 i = 0; i < Lanes; i++) _a[i] = Select(i, SetZN(i, _val[i]), _a[i]); }
+    void ldx() { Load(_val); for (u32 i = 0; i < Lanes; i++) _x[i] = Select(i, SetZN(i, _val[i]), _x[i]); }
+    void ldy() { Load(_val); for (u32 i = 0; i < Lanes; i++) _y[i] = Select(i, SetZN(i, _val[i]), _y[i]); }
+
+    // Stores
+    void sta() { Store(_a); }
+    void stx() { Store(_x); }
+    void sty() { Store(_y); }
+
+    // Arithemtic
+    // op is CpuAlu::Adc or Sbc
+    void arithmetic(u8 (*op)(u8&, u8, u8))
+    {
+        Load(_val);
+        for (u32 i = 0; i < Lanes; i++)
+        {
+            u8 p = _p[i];
+            u8 a = op(p, _a[i], _val[i]);
+            KeepP(i, p);
+            _a[i] = Select(i, a, _a[i]);
+        }
+    }
+    void adc() { arithmetic(CpuAlu::Adc); }
+    void sbc() { arithmetic(CpuAlu::Sbc); }
+
+    // Comparisons
+    void cmp_base(const u8* reg)
+    {
+        Load(_val);
+        for (u32 i = 0; i < Lanes; i++)
+        {
+            u8 p = _p[i];
+            CpuAlu::Compare(p, reg[i], _val[i]);
+            KeepP(i, p);
+        }
+    }
+    void cmp() { cmp_base(_a); }
+    void cpx() { cmp_base(_x); }
+    void cpy() { cmp_base(_y); }
+
+    // Bitwise Operations
+    void and() { Load(_val); for (u32 i = 0; i < Lanes; i++) _a[i] = Select(i, SetZN(i, _a[i] & _val[i]), _a[i]); }
+    void ora() { Load(_val); for (u32 i = 0; i < Lanes; i++) _a[i] = Select(i, SetZN(i, _a[i] | _val[i]), _a[i]); }
+    void eor() { Load(_val); for (u32 i = 0; i < Lanes; i++) _a[i] = Select(i, SetZN(i, _a[i] ^ _val[i]), _a[i]); }
+    void bit()
+    {
+        Load(_val);
+        for (u32 i = 0; i < Lanes; i++)
+        {
+            u8 p = _p[i];
+            CpuAlu::Bit(p, _a[i], _val[i]);
+            KeepP(i, p);
+        }
+    }
+
+    // Shifts and Rotates
+    // op is CpuAlu::ShiftLeft or ShiftRight
+    void shift_base(u8 (*op)(u8&, u8, bool), bool rotate)
+    {
+        Load(_val);
+        for (u32 i = 0; i < Lanes; i++)
+        {
+            u8 p = _p[i];
+            _val[i] = op(p, _val[i], rotate);
+            KeepP(i, p);
+        }
+        Store(_val);
+    }
+    void rol() { shift_base(CpuAlu::ShiftLeft, true); }
+    void ror() { shift_base(CpuAlu::ShiftRight, true); }
+    void asl() { shift_base(CpuAlu::ShiftLeft, false); }
+    void lsr() { shift_base(CpuAlu::ShiftRight, false); }
+
+    // Increments and Decrements
+    void inc() { Load(_val); for (u32 i = 0; i < Lanes; i++) _val[i] = SetZN(i, _val[i] + 1); Store(_val); }
+    void dec() { Load(_val); for (u32 i = 0; i < Lanes; i++) _val[i] = SetZN(i, _val[i] - 1); Store(_val); }
+    void inx() { for (u32 i = 0; i < Lanes; i++) _x[i] = Select(i, SetZN(i, _x[i] + 1), _x[i]); }
+    void dex() { for (u32 i = 0; i < Lanes; i++) _x[i] = Select(i, SetZN(i, _x[i] - 1), _x[i]); }
+    void iny() { for (u32 i = 0; i < Lanes; i++) _y[i] = Select(i, SetZN(i, _y[i] + 1), _y[i]); }
+    void dey() { for (u32 i = 0; i < Lanes; i++) _y[i] = Select(i, SetZN(i, _y[i] - 1), _y[i]); }
+
+    // Register Moves
+    void tax() { for (u32 i = 0; i < Lanes; i++) _x[i] = Select(i, SetZN(i, _a[i]), _x[i]); }
+    void tay() { for (u32 i = 0; i < Lanes; i++) _y[i] = Select(i, SetZN(i, _a[i]), _y[i]); }
+    void txa() { for (u32 i = 0; i < Lanes; i++) _a[i] = Select(i, SetZN(i, _x[i]), _a[i]); }
+    void tya() { for (u32 i = 0; i < Lanes; i++) _a[i] = Select(i, SetZN(i, _y[i]), _a[i]); }
+    void txs() { for (u32 i = 0; i < Lanes; i++) _s[i] = Select(i, _x[i], _s[i]); }
+    void tsx() { for (u32 i = 0; i < Lanes; i++) _x[i] = Select(i, SetZN(i, _s[i]), _x[i]); }
+
+    // Flag Operations
+    void clc() { for (u32 i = 0; i < Lanes; i++) SetFlag(i, Flag::Carry, false); }
+    void sec() { for (u32 i = 0; i < Lanes; i++) SetFlag(i, Flag::Carry, true); }
+    void cli() { for (u32 i = 0; i < Lanes; i++) SetFlag(i, Flag::IRQ, false); }
+    void sei() { for (u32 i = 0; i < Lanes; i++) SetFlag(i, Flag::IRQ, true); }
+    void clv() { for (u32 i = 0; i < Lanes; i++) SetFlag(i, Flag::Overflow, false); }
+    void cld() { for (u32 i = 0; i < Lanes; i++) SetFlag(i, Flag::Decimal, false); }
+    void sed() { for (u32 i = 0; i < Lanes; i++) SetFlag(i, Flag::Decimal, true); }
+
+    // Branches
+    // Lanes that disagree about the condition split here
+    void branch_base(Flag flag, bool set)
+    {
+        u8 disp = LoadBBumpPC();
+        u16 target = CpuAlu::BranchTarget(_fetchPC, disp);
+        for (u32 i = 0; i < Lanes; i++)
+        {
+            if (_active[i] && GetFlag(i, flag) == set)
+            {
+                _cycles[i]++;
+                checkPageCross(i, _fetchPC, target);
+                _pc[i] = target;
+            }
+            else
+            {
+                _pc[i] = Select(i, _fetchPC, _pc[i]);
+            }
+        }
+        _pcWritten = true;
+    }
+    void bpl() { branch_base(Flag::Negative, false); }
+    void bmi() { branch_base(Flag::Negative, true); }
+    void bvc() { branch_base(Flag::Overflow, false); }
+    void bvs() { branch_base(Flag::Overflow, true); }
+    void bcc() { branch_base(Flag::Carry, false); }
+    void bcs() { branch_base(Flag::Carry, true); }
+    void bne() { branch_base(Flag::Zero, false); }
+    void beq() { branch_base(Flag::Zero, true); }
+
+    // Jumps
+    void jmp()
+    {
+        _fetchPC = LoadWBumpPC();
+    }
+    void jmpi()
+    {
+        u16 addr = LoadWBumpPC();
+        u16 hiAddr = CpuAlu::IndirectHighAddress(addr);
+        for (u32 i = 0; i < Lanes; i++)
+        {
+            if (_active[i])
+            {
+                _pc[i] = (u16)LoadLane(i, addr) | ((u16)LoadLane(i, hiAddr) << 8);
+            }
+        }
+        _pcWritten = true;
+    }
+
+    // Procedure Calls
+    void jsr()
+    {
+        u16 target = LoadWBumpPC();
+        u16 ret = _fetchPC - 1;
+        for (u32 i = 0; i < Lanes; i++)
+        {
+            if (_active[i])
+            {
+                PushLane(i, (ret >> 8) & 0xff);
+                PushLane(i, ret & 0xff);
+            }
+        }
+        _fetchPC = target;
+    }
+    void rts()
+    {
+        for (u32 i = 0; i < Lanes; i++)
+        {
+            if (_active[i])
+            {
+                u16 lo = PopLane(i);
+                u16 hi = PopLane(i);
+                _pc[i] = ((hi << 8) | lo) + 1;
+            }
+        }
+        _pcWritten = true;
+    }
+    void brk()
+    {
+        u16 ret = _fetchPC + 1;
+        for (u32 i = 0; i < Lanes; i++)
+        {
+            if (_active[i])
+            {
+                PushLane(i, (ret >> 8) & 0xff);
+                PushLane(i, ret & 0xff);
+                PushLane(i, CpuAlu::PushedStatus(_p[i]));
+                CpuAlu::SetFlag(_p[i], Flag::IRQ, true);
+                CpuAlu::SetFlag(_p[i], Flag::Unused, true);
+                _pc[i] = (u16)LoadLane(i, IRQ_VECTOR) | ((u16)LoadLane(i, IRQ_VECTOR + 1) << 8);
+            }
+        }
+        _pcWritten = true;
+    }
+    void rti()
+    {
+        for (u32 i = 0; i < Lanes; i++)
+        {
+            if (_active[i])
+            {
+                _p[i] = CpuAlu::ReturnStatus(PopLane(i));
+                u16 lo = PopLane(i);
+                u16 hi = PopLane(i);
+                _pc[i] = (hi << 8) | lo;
+            }
+        }
+        _pcWritten = true;
+    }
+
+    // Stack Operations
+    void pha() { for (u32 i = 0; i < Lanes; i++) if (_active[i]) PushLane(i, _a[i]); }
+    void pla() { for (u32 i = 0; i < Lanes; i++) if (_active[i]) _a[i] = SetZN(i, PopLane(i)); }
+    void php() { for (u32 i = 0; i < Lanes; i++) if (_active[i]) PushLane(i, CpuAlu::PushedStatus(_p[i])); }
+    void plp() { for (u32 i = 0; i < Lanes; i++) if (_active[i]) _p[i] = PopLane(i); }
+
+    // No Operation
+    void nop() { }
+
+    void unimplemented(u8 op)
+    {
+        printf("Unimplemented instruction: 0x%02x\n", op);
+        __debugbreak();
+    }
+
+private:
+    const u8* _prg;
+    u16 _prgMask;
+    IMem* _io[Lanes];
+
+    // Registers, one per lane
+    u8 _a[Lanes];
+    u8 _x[Lanes];
+    u8 _y[Lanes];
+    u8 _p[Lanes];
+    u8 _s[Lanes];
+    u16 _pc[Lanes];
+    u32 _cycles[Lanes];
+
+    // Work ram, _ram[addr][lane]
+    u8 _ram[0x800][Lanes];
+
+    // The current step
+    bool _active[Lanes];
+    u32 _leader;
+    u8 _op;
+    u16 _fetchPC;
+    bool _pcWritten;
+    Mode _mode;
+    u8 _imm;
+    u16 _addr[Lanes];
+    bool _uniform;
+    u8 _val[Lanes];
+
+    Stats _stats;
+};
\ No newline at end of file
@@ -8,6 +8,11 @@ IMapper::IMapper(Rom* rom)
     Reset(true);
 }
 
+IMapper::IMapper()
+    : Mirroring((NameTableMirroring)0)
+{
+}
+
 bool IMapper::CreateMapper(Rom* rom, IMapper** mapper)
 {
     switch (rom->Header.MapperNumber())
@@ -41,10 +46,6 @@ void IMapper::Reset(bool hard)
     if (hard)
     {
         Mirroring = _rom->Header.Mirroring();
-        if (!_rom->Header.HasSaveRam())
-        {
-            memset((void*)&_rom->PrgRam[0], 0, _rom->PrgRam.size());
-        }
     }
     else
     {
@@ -57,22 +58,21 @@ bool IMapper::Scanline()
     return false;
 }
 
-void IMapper::SaveState(std::ofstream& ofs)
+void IMapper::SaveState(std::ostream& ofs)
 {
     Util::WriteBytes((u8)Mirroring, ofs);
-    _rom->SaveState(ofs);
 }
 
-void IMapper::LoadState(std::ifstream& ifs)
+void IMapper::LoadState(std::istream& ifs)
 {
     Util::ReadBytes((u8&)Mirroring, ifs);
-    _rom->LoadState(ifs);
 }
 
 /// NRom
 
 NRom::NRom(Rom* rom)
     : IMapper(rom)
+    , _chrRam() // saved in save states even when unused, so it must be deterministic
 {
     if (_rom->Header.ChrRomSize > 0)
     {
@@ -96,14 +96,19 @@ u8 NRom::prg_loadb(u16 addr)
     }
     else
     {
-        if (_rom->Header.PrgRomSize == 1)
-        {
-            return _rom->PrgRom[addr & 0x3fff];
-        }
-        else
-        {
-            return _rom->PrgRom[addr & 0x7fff];
-        }
+        return _rom->PrgRom[NRom::prg_rom_offset(addr)];
+    }
+}
+
+u32 NRom::prg_rom_offset(u16 addr)
+{
+    if (_rom->Header.PrgRomSize == 1)
+    {
+        return addr & 0x3fff;
+    }
+    else
+    {
+        return addr & 0x7fff;
     }
 }
 
@@ -111,7 +116,7 @@ void NRom::prg_storeb(u16 addr, u8 val)
 {
     if (addr < 0x8000)
     {
-        _rom->PrgRam[addr & 0x1fff] = val;
+        _rom->StorePrgRam(addr & 0x1fff, val);
     }
 }
 
@@ -120,21 +125,28 @@ u8 NRom::chr_loadb(u16 addr)
     return _chrBuf[addr]; // this will return ChrRom if present or ChrRam if not
 }
 
+u32 NRom::chr_rom_offset(u16 addr)
+{
+    return addr & 0x1fff;
+}
+
 void NRom::chr_storeb(u16 addr, u8 val)
 {
+    _chrRamHash.Update(addr, _chrRam[addr], val);
     _chrRam[addr] = val; // This will only ever store to ChrRam
 }
 
-void NRom::SaveState(std::ofstream& ofs)
+void NRom::SaveState(std::ostream& ofs)
 {
     IMapper::SaveState(ofs);
-    ofs.write((char*)_chrRam, sizeof(_chrRam));
+    Util::WriteBlock(_chrRam, sizeof(_chrRam), _chrRamHash, ofs);
 }
 
-void NRom::LoadState(std::ifstream& ifs)
+void NRom::LoadState(std::istream& ifs)
 {
     IMapper::LoadState(ifs);
     ifs.read((char*)_chrRam, sizeof(_chrRam));
+    _chrRamHash.Invalidate();
 }
 
 /// SxRom (Mapper #1)
@@ -186,49 +198,54 @@ u8 SxRom::prg_loadb(u16 addr)
     }
     else
     {
-        if (_prgSize == PrgSize::Size32k)
-        {
-            return _rom->PrgRom[((_prgBank >> 1) * 0x4000 * 2) + (addr & 0x7fff)];
-        }
-        else if (_prgSize == PrgSize::Size16k)
+        return _rom->PrgRom[SxRom::prg_rom_offset(addr)];
+    }
+}
+
+u32 SxRom::prg_rom_offset(u16 addr)
+{
+    if (_prgSize == PrgSize::Size32k)
+    {
+        return ((_prgBank >> 1) * 0x4000 * 2) + (addr & 0x7fff);
+    }
+    else if (_prgSize == PrgSize::Size16k)
+    {
+        if (addr < 0xc000)
         {
-            if (addr < 0xc000)
+            if (!_slotSelect)
             {
-                if (!_slotSelect)
-                {
-                    return _rom->PrgRom[addr & 0x3fff];
-                }
-                else
-                {
-                    return _rom->PrgRom[(_prgBank * 0x4000) + (addr & 0x3fff)];
-                }
+                return addr & 0x3fff;
             }
             else
             {
-                if (!_slotSelect)
-                {
-                    return _rom->PrgRom[(_prgBank * 0x4000) + (addr & 0x3fff)];
-                }
-                else
-                {
-                    return _rom->PrgRom[((_rom->Header.PrgRomSize - 1) * 0x4000) + (addr & 0x3fff)];
-                }
+                return (_prgBank * 0x4000) + (addr & 0x3fff);
             }
         }
         else
         {
-            // can't happen
-            __debugbreak();
-            return 0;
+            if (!_slotSelect)
+            {
+                return (_prgBank * 0x4000) + (addr & 0x3fff);
+            }
+            else
+            {
+                return ((_rom->Header.PrgRomSize - 1) * 0x4000) + (addr & 0x3fff);
+            }
         }
     }
+    else
+    {
+        // can't happen
+        __debugbreak();
+        return 0;
+    }
 }
 
 void SxRom::prg_storeb(u16 addr, u8 val)
 {
     if (addr < 0x8000)
     {
-        _rom->PrgRam[addr & 0x1fff] = val;
+        _rom->StorePrgRam(addr & 0x1fff, val);
         return;
     }
 
@@ -283,7 +300,17 @@ u8 SxRom::chr_loadb(u16 addr)
 
 void SxRom::chr_storeb(u16 addr, u8 val)
 {
-    _chrBuf[ChrBufAddress(addr)] = val;
+    u32 chrAddr = ChrBufAddress(addr);
+    if (!_chrRam.empty())
+    {
+        _chrRamHash.Update(chrAddr, _chrRam[chrAddr], val);
+    }
+    _chrBuf[chrAddr] = val;
+}
+
+u32 SxRom::chr_rom_offset(u16 addr)
+{
+    return ChrBufAddress(addr);
 }
 
 u32 SxRom::ChrBufAddress(u16 addr)
@@ -305,7 +332,7 @@ u32 SxRom::ChrBufAddress(u16 addr)
     }
 }
 
-void SxRom::SaveState(std::ofstream& ofs)
+void SxRom::SaveState(std::ostream& ofs)
 {
     IMapper::SaveState(ofs);
     Util::WriteBytes((u8)_prgSize, ofs);
@@ -316,10 +343,13 @@ void SxRom::SaveState(std::ofstream& ofs)
     Util::WriteBytes(_prgBank, ofs);
     Util::WriteBytes(_accumulator, ofs);
     Util::WriteBytes(_writeCount, ofs);
-    ofs.write((char*)&_chrRam[0], _chrRam.size());
+    if (!_chrRam.empty())
+    {
+        Util::WriteBlock(&_chrRam[0], _chrRam.size(), _chrRamHash, ofs);
+    }
 }
 
-void SxRom::LoadState(std::ifstream& ifs)
+void SxRom::LoadState(std::istream& ifs)
 {
     IMapper::LoadState(ifs);
     Util::ReadBytes((u8&)_prgSize, ifs);
@@ -330,7 +360,11 @@ void SxRom::LoadState(std::ifstream& ifs)
     Util::ReadBytes(_prgBank, ifs);
     Util::ReadBytes(_accumulator, ifs);
     Util::ReadBytes(_writeCount, ifs);
-    ifs.read((char*)&_chrRam[0], _chrRam.size());
+    if (!_chrRam.empty())
+    {
+        ifs.read((char*)&_chrRam[0], _chrRam.size());
+        _chrRamHash.Invalidate();
+    }
 }
 
 /// UxRom (Mapper #2)
@@ -355,13 +389,13 @@ void UxRom::Reset(bool hard)
     }
 }
 
-void UxRom::SaveState(std::ofstream& ofs)
+void UxRom::SaveState(std::ostream& ofs)
 {
     NRom::SaveState(ofs);
     Util::WriteBytes(_prgBank, ofs);
 }
 
-void UxRom::LoadState(std::ifstream& ifs)
+void UxRom::LoadState(std::istream& ifs)
 {
     NRom::LoadState(ifs);
     Util::ReadBytes(_prgBank, ifs);
@@ -378,13 +412,21 @@ u8 UxRom::prg_loadb(u16 addr)
     {
         return NRom::prg_loadb(addr);
     }
-    else if (addr >= 0xC000)
+    else
+    {
+        return _rom->PrgRom[UxRom::prg_rom_offset(addr)];
+    }
+}
+
+u32 UxRom::prg_rom_offset(u16 addr)
+{
+    if (addr >= 0xC000)
     {
-        return _rom->PrgRom[_lastBankOffset + (addr & 0x3FFF)];
+        return _lastBankOffset + (addr & 0x3FFF);
     }
     else
     {
-        return _rom->PrgRom[(_prgBank * PRG_ROM_BANK_SIZE) + (addr & 0x3FFF)];
+        return (_prgBank * PRG_ROM_BANK_SIZE) + (addr & 0x3FFF);
     }
 }
 
@@ -418,15 +460,21 @@ void CNRom::prg_storeb(u16 addr, u8 val)
 
 u8 CNRom::chr_loadb(u16 addr)
 {
-    return _rom->ChrRom[(_chrBank * CHR_ROM_BANK_SIZE) + addr];
+    return _rom->ChrRom[CNRom::chr_rom_offset(addr)];
 }
-void CNRom::SaveState(std::ofstream& ofs)
+
+u32 CNRom::chr_rom_offset(u16 addr)
+{
+    return (_chrBank * CHR_ROM_BANK_SIZE) + addr;
+}
+
+void CNRom::SaveState(std::ostream& ofs)
 {
     NRom::SaveState(ofs);
     Util::WriteBytes(_chrBank, ofs);
 }
 
-void CNRom::LoadState(std::ifstream& ifs)
+void CNRom::LoadState(std::istream& ifs)
 {
     NRom::LoadState(ifs);
     Util::ReadBytes(_chrBank, ifs);
@@ -486,35 +534,40 @@ u8 TxRom::prg_loadb(u16 addr)
     }
     else
     {
-        u32 baseAddress = 0;
-        if (addr < 0xa000)
-        {
-            baseAddress = _prgSegmentAddr[0];
-        }
-        else if (addr < 0xc000)
-        {
-            baseAddress = _prgSegmentAddr[1];
-        }
-        else if (addr < 0xe000)
-        {
-            baseAddress = _prgSegmentAddr[2];
-        }
-        else
-        {
-            baseAddress = _prgSegmentAddr[3];
-        }
-        
-        return _rom->PrgRom[baseAddress + (addr & 0x1fff)];
+        return _rom->PrgRom[TxRom::prg_rom_offset(addr)];
     }
 }
 
+u32 TxRom::prg_rom_offset(u16 addr)
+{
+    u32 baseAddress = 0;
+    if (addr < 0xa000)
+    {
+        baseAddress = _prgSegmentAddr[0];
+    }
+    else if (addr < 0xc000)
+    {
+        baseAddress = _prgSegmentAddr[1];
+    }
+    else if (addr < 0xe000)
+    {
+        baseAddress = _prgSegmentAddr[2];
+    }
+    else
+    {
+        baseAddress = _prgSegmentAddr[3];
+    }
+
+    return baseAddress + (addr & 0x1fff);
+}
+
 void TxRom::prg_storeb(u16 addr, u8 val)
 {
     if (addr < 0x8000)
     {
 
         // TODO: This can be disabled?
-        _rom->PrgRam[addr & 0x1fff] = val;
+        _rom->StorePrgRam(addr & 0x1fff, val);
     }
     else
     {
@@ -601,6 +654,11 @@ void TxRom::SetSegmentAddresses()
 }
 
 u8 TxRom::chr_loadb(u16 addr)
+{
+    return _rom->ChrRom[TxRom::chr_rom_offset(addr)];
+}
+
+u32 TxRom::chr_rom_offset(u16 addr)
 {
     u32 baseAddr = 0;
 
@@ -618,7 +676,7 @@ u8 TxRom::chr_loadb(u16 addr)
         baseAddr = 0;
     }
 
-    return _rom->ChrRom[baseAddr + (addr & 0x3ff)];
+    return baseAddr + (addr & 0x3ff);
 }
 
 void TxRom::chr_storeb(u16 addr, u8 val)
@@ -626,6 +684,37 @@ void TxRom::chr_storeb(u16 addr, u8 val)
     // not sure if mmc3 can have ChrRam
 }
 
+void TxRom::SaveState(std::ostream& ofs)
+{
+    IMapper::SaveState(ofs);
+    Util::WriteBytes(_chrMode, ofs);
+    Util::WriteBytes(_prgMode, ofs);
+    Util::WriteBytes(_addr8001, ofs);
+    ofs.write((char*)_chrReg, sizeof(_chrReg));
+    ofs.write((char*)_prgReg, sizeof(_prgReg));
+    Util::WriteBytes(_irqCounter, ofs);
+    Util::WriteBytes(_irqReload, ofs);
+    Util::WriteBytes(_irqEnable, ofs);
+    Util::WriteBytes(_irqPending, ofs);
+}
+
+void TxRom::LoadState(std::istream& ifs)
+{
+    IMapper::LoadState(ifs);
+    Util::ReadBytes(_chrMode, ifs);
+    Util::ReadBytes(_prgMode, ifs);
+    Util::ReadBytes(_addr8001, ifs);
+    ifs.read((char*)_chrReg, sizeof(_chrReg));
+    ifs.read((char*)_prgReg, sizeof(_prgReg));
+    Util::ReadBytes(_irqCounter, ifs);
+    Util::ReadBytes(_irqReload, ifs);
+    Util::ReadBytes(_irqEnable, ifs);
+    Util::ReadBytes(_irqPending, ifs);
+
+    // segment addresses are derived from the registers
+    SetSegmentAddresses();
+}
+
 bool TxRom::Scanline()
 {
     if (_irqCounter == 0)
@@ -674,10 +763,15 @@ u8 AxRom::prg_loadb(u16 addr)
     }
     else
     {
-        return _rom->PrgRom[((_prgReg * 0x8000) + (addr & 0x7fff))];
+        return _rom->PrgRom[AxRom::prg_rom_offset(addr)];
     }
 }
 
+u32 AxRom::prg_rom_offset(u16 addr)
+{
+    return (_prgReg * 0x8000) + (addr & 0x7fff);
+}
+
 void AxRom::prg_storeb(u16 addr, u8 val)
 {
     if (addr < 0x8000)
@@ -689,4 +783,16 @@ void AxRom::prg_storeb(u16 addr, u8 val)
         Mirroring = (val & (1 << 4)) == 0 ? NameTableMirroring::SingleScreenLower : NameTableMirroring::SingleScreenUpper;
         _prgReg = val & 0b111;
     }
+}
+
+void AxRom::SaveState(std::ostream& ofs)
+{
+    NRom::SaveState(ofs);
+    Util::WriteBytes(_prgReg, ofs);
+}
+
+void AxRom::LoadState(std::istream& ifs)
+{
+    NRom::LoadState(ifs);
+    Util::ReadBytes(_prgReg, ifs);
 }
\ No newline at end of file
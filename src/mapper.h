@@ -16,15 +16,18 @@ public:
     virtual void prg_storeb(u16 addr, u8 val);
     virtual u8 chr_loadb(u16 addr);
     virtual void chr_storeb(u16 addr, u8 val);
+    virtual u32 prg_rom_offset(u16 addr);
+    virtual u32 chr_rom_offset(u16 addr);
 
 public:
     // ISaveState
-    void SaveState(std::ofstream& ofs);
-    void LoadState(std::ifstream& ifs);
+    void SaveState(std::ostream& ofs);
+    void LoadState(std::istream& ifs);
 
 private:
     u8* _chrBuf;
     u8 _chrRam[0x2000]; // If no ChrRom is provided we will give ChrRam
+    BlockHash _chrRamHash;
 };
 
 class SxRom : public IMapper, public NesObject
@@ -43,11 +46,13 @@ public:
     void prg_storeb(u16 addr, u8 val);
     u8 chr_loadb(u16 addr);
     void chr_storeb(u16 addr, u8 val);
+    u32 prg_rom_offset(u16 addr);
+    u32 chr_rom_offset(u16 addr);
 
 public:
     // ISaveState
-    void SaveState(std::ofstream& ofs);
-    void LoadState(std::ifstream& ifs);
+    void SaveState(std::ostream& ofs);
+    void LoadState(std::istream& ifs);
 
 private:
     u32 ChrBufAddress(u16 addr);
@@ -76,6 +81,7 @@ private:
     u8 _writeCount;
     u8* _chrBuf;
     std::vector<u8> _chrRam;
+    BlockHash _chrRamHash;
 };
 
 class UxRom : public NRom
@@ -87,10 +93,11 @@ public:
 
     void prg_storeb(u16 addr, u8 val);
     u8 prg_loadb(u16 addr);
+    u32 prg_rom_offset(u16 addr);
 
     // ISaveState
-    void SaveState(std::ofstream& ofs);
-    void LoadState(std::ifstream& ifs);
+    void SaveState(std::ostream& ofs);
+    void LoadState(std::istream& ifs);
 private:
     int _lastBankOffset;
     u8 _prgBank;
@@ -105,10 +112,11 @@ public:
 
     void prg_storeb(u16 addr, u8 val);
     u8 chr_loadb(u16 addr);
+    u32 chr_rom_offset(u16 addr);
 
     // ISaveState
-    void SaveState(std::ofstream& ofs);
-    void LoadState(std::ifstream& ifs);
+    void SaveState(std::ostream& ofs);
+    void LoadState(std::istream& ifs);
 private:
     u8 _chrBank;
 };
@@ -128,9 +136,15 @@ public:
     void prg_storeb(u16 addr, u8 val);
     u8 chr_loadb(u16 addr);
     void chr_storeb(u16 addr, u8 val);
+    u32 prg_rom_offset(u16 addr);
+    u32 chr_rom_offset(u16 addr);
 
     bool Scanline();
 
+    // ISaveState
+    void SaveState(std::ostream& ofs);
+    void LoadState(std::istream& ifs);
+
 private:
     void SetSegmentAddresses();
 
@@ -163,6 +177,11 @@ public:
 
     u8 prg_loadb(u16 addr);
     void prg_storeb(u16 addr, u8 val);
+    u32 prg_rom_offset(u16 addr);
+
+    // ISaveState
+    void SaveState(std::ostream& ofs);
+    void LoadState(std::istream& ifs);
 
 private:
     u8 _prgReg;
@@ -3,6 +3,7 @@
 #include "ppu.h"
 #include "apu.h"
 #include "input.h"
+#include "counters.h"
 
 /*
     MemoryMap
@@ -26,6 +27,7 @@ void MemoryMap::Reset(bool hard)
     if (hard)
     {
         memset(_ram, 0, sizeof(_ram));
+        _ramHash.Invalidate();
     }
     else
     {
@@ -39,6 +41,13 @@ void MemoryMap::Reset(bool hard)
 // IMem
 u8 MemoryMap::loadb(u16 addr)
 {
+    COUNT_CALL(NES_COUNTER_MEM_LOAD);
+
+    if (_heatmap != nullptr)
+    {
+        _heatmap->CpuRead(addr);
+    }
+
     if (addr < 0x2000)
     {
         return _ram[addr & 0x7ff];
@@ -63,14 +72,23 @@ u8 MemoryMap::loadb(u16 addr)
     }
     else
     {
+        COUNT_CALL(NES_COUNTER_MAPPER_PRG_LOAD);
         return _mapper->prg_loadb(addr);
     }
 }
 
 void MemoryMap::storeb(u16 addr, u8 val)
 {
+    COUNT_CALL(NES_COUNTER_MEM_STORE);
+
+    if (_heatmap != nullptr)
+    {
+        _heatmap->CpuWrite(addr);
+    }
+
     if (addr < 0x2000)
     {
+        _ramHash.Update(addr & 0x7ff, _ram[addr & 0x7ff], val);
         _ram[addr & 0x7ff] = val;
     }
     else if (addr < 0x4000)
@@ -95,22 +113,22 @@ void MemoryMap::storeb(u16 addr, u8 val)
     }
     else
     {
+        // Below $8000 is cart ram, which the ppu never sees
+        if (addr >= 0x8000)
+        {
+            _ppu->LogMapperWrite(addr, val);
+        }
         _mapper->prg_storeb(addr, val);
     }
 }
 
-void MemoryMap::SaveState(std::ofstream& ofs)
+void MemoryMap::SaveState(std::ostream& ofs)
 {
-    ofs.write((char*)_ram, sizeof(_ram));
-    _ppu->SaveState(ofs);
-    _apu->SaveState(ofs);
-    _mapper->SaveState(ofs);
+    Util::WriteBlock(_ram, sizeof(_ram), _ramHash, ofs);
 }
 
-void MemoryMap::LoadState(std::ifstream& ifs)
+void MemoryMap::LoadState(std::istream& ifs)
 {
     ifs.read((char*)_ram, sizeof(_ram));
-    _ppu->LoadState(ifs);
-    _apu->LoadState(ifs);
-    _mapper->LoadState(ifs);
+    _ramHash.Invalidate();
 }
\ No newline at end of file
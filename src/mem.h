@@ -6,6 +6,7 @@ class Input;
 class Rom;
 
 #include "interfaces.h"
+#include "heatmap.h"
 
 // CPU Memory Map
 class MemoryMap : public IMem, public NesObject
@@ -22,12 +23,35 @@ public:
     u8 loadb(u16 addr);
     void storeb(u16 addr, u8 val);
 
-    void SaveState(std::ofstream& ofs);
-    void LoadState(std::ifstream& ifs);
+    void SaveState(std::ostream& ofs);
+    void LoadState(std::istream& ifs);
+
+    // Work ram without going through the bus, for reading game state
+    u8 PeekRam(u16 addr) { return _ram[addr & 0x7ff]; }
+    const u8* Ram() { return _ram; }
+    u32 RamSize() { return sizeof(_ram); }
+
+    // Work ram, cart ram and rom as the cpu would read them, for tools that
+    // look at code. The registers in between read as 0 as reading them has
+    // side effects.
+    u8 PeekCode(u16 addr)
+    {
+        if (addr < 0x2000)
+        {
+            return _ram[addr & 0x7ff];
+        }
+        return addr < 0x6000 ? 0 : _mapper->prg_loadb(addr);
+    }
+
+    // Count every load and store in heatmap, or stop counting if null
+    void SetMemoryHeatmap(MemoryHeatmap* heatmap) { _heatmap = heatmap; }
+
 private:
     u8 _ram[0x800];
+    BlockHash _ramHash;
     NPtr<Ppu> _ppu;
     NPtr<Apu> _apu;
     NPtr<Input> _input;
     NPtr<IMapper> _mapper;
+    NPtr<MemoryHeatmap> _heatmap;
 };
\ No newline at end of file
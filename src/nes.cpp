@@ -11,9 +11,25 @@
 #include "rom.h"
 #include "apu.h"
 #include "mapper.h"
+#include "persist.h"
+#include "renderthread.h"
+#include "scanlinerenderer.h"
+#include "profiler.h"
+#include "trace.h"
+#include "cdl.h"
+#include "heatmap.h"
+#include "gdbstub.h"
+
+// How often battery ram is checked for changes and written out
+static const unsigned int BatteryCheckFrames = 60;
 
 Nes::Nes(Rom* rom, IMapper* mapper, IAudioProvider* audioProvider)
     : _rom(rom)
+    , _mapper(mapper)
+    , _framesSinceBatteryCheck(0)
+    , _runAheadFrames(0)
+    , _memoryGeneration(0)
+    , _cpuCycles(0)
 {
     _debugger = new DebugService();
     _ppu = new Ppu(mapper);
@@ -21,10 +37,26 @@ Nes::Nes(Rom* rom, IMapper* mapper, IAudioProvider* audioProvider)
     _input = new Input();
     _mem = new MemoryMap(_ppu, _apu, _input, mapper);
     _cpu = new Cpu(_mem, _debugger);
+    _debugger->SetMachine(_cpu, _mem, _ppu);
+
+    _stateChunks[0] = { "CPU ", _cpu };
+    _stateChunks[1] = { "RAM ", _mem };
+    _stateChunks[2] = { "PPU ", _ppu };
+    _stateChunks[3] = { "APU ", _apu };
+    _stateChunks[4] = { "MAPR", mapper };
+    _stateChunks[5] = { "CRAM", rom };
+
+    _stateFileHeader.RomHash = rom->Hash;
+    _stateFileHeader.Mapper = (u16)rom->Header.MapperNumber();
 
     // TODO: Move these to an init method
+    _rom->Reset(true);
     _cpu->Reset(true);
     _apu->StartAudio(_mem); 
+
+#if defined(NES_COUNTERS)
+    _apu->SetCounters(&_counters);
+#endif
 }
 
 Nes::~Nes()
@@ -56,6 +88,19 @@ void Nes::Dispose()
 {
     _apu->StopAudio();
 
+    // Wait for the last battery ram and any save state to reach the disk
+    std::vector<u8> saveGame;
+    if (_rom->TakeSaveGame(saveGame))
+    {
+        Persistence()->Write(PersistTarget::SaveGame, std::move(saveGame));
+    }
+    if (_persist != nullptr)
+    {
+        _persist->Flush();
+    }
+
+    StopGdbServer();
+
     // Release smart pointers to avoid problems with circular references.
     _debugger.Release();
     _ppu.Release();
@@ -63,10 +108,102 @@ void Nes::Dispose()
     _input.Release();
     _mem.Release();
     _cpu.Release();
+    _mapper.Release();
+    _persist.Release();
+    _renderThread.Release();
+    _scanlineRenderer.Release();
+    _profiler.Release();
+    _trace.Release();
+    _cdl.Release();
+    _heatmap.Release();
 }
 
 void Nes::DoFrame(u8 screen[])
 {
+    DoFrame(screen, NES_FRAME_DEFAULT);
+}
+
+void Nes::DoFrame(u8 screen[], unsigned int flags)
+{
+    EmulateFrame(screen, flags, _renderThread != nullptr);
+}
+
+void Nes::PublishFrame(unsigned int flags)
+{
+    // A frame that isn't drawn has nothing to show
+    if ((flags & NES_FRAME_NO_RENDER) != 0)
+    {
+        DoFrame(nullptr, flags);
+        return;
+    }
+
+    DoFrame(_frames.Back(), flags);
+    _frames.Publish();
+}
+
+const unsigned char* Nes::AcquireFrame(unsigned long long* frame)
+{
+    u64 number;
+    const u8* screen = _frames.Acquire(&number);
+    if (frame != nullptr)
+    {
+        *frame = number;
+    }
+    return screen;
+}
+
+void Nes::EmulateFrame(u8 screen[], unsigned int flags, bool pipelined)
+{
+#if defined(NES_COUNTERS)
+    CounterFrame counting(_counters);
+#endif
+
+    bool render = (flags & NES_FRAME_NO_RENDER) == 0;
+    bool audio = (flags & NES_FRAME_NO_AUDIO) == 0;
+
+    _memoryGeneration++;
+    ServicePersistence();
+
+    _apu->SuppressAudio(!audio);
+
+    if (_runAheadFrames == 0)
+    {
+        RunFrame(render ? screen : nullptr, pipelined);
+        return;
+    }
+
+    // The real frame. This is the only one that is heard, but it is never seen.
+    RunFrame(nullptr, false);
+
+    _runAheadState.Clear();
+    SaveState(_runAheadState);
+
+    // Run ahead with the same input and present the last frame
+    _apu->SuppressAudio(true);
+    for (unsigned int i = 1; i <= _runAheadFrames; i++)
+    {
+        RunFrame((render && i == _runAheadFrames) ? screen : nullptr, pipelined);
+    }
+
+    _runAheadState.Rewind();
+    LoadState(_runAheadState);
+    _apu->SuppressAudio(!audio);
+}
+
+void Nes::RunFrame(u8 screen[], bool pipelined)
+{
+    if (pipelined && screen != nullptr)
+    {
+        RunPipelinedFrame(screen);
+        return;
+    }
+
+    if (_scanlineRenderer != nullptr && screen != nullptr)
+    {
+        RunParallelFrame(screen);
+        return;
+    }
+
     PpuStepResult ppuResult;
     ApuStepResult apuResult;
     do
@@ -78,6 +215,7 @@ void Nes::DoFrame(u8 screen[])
         _apu->Step(_cpu->Cycles, _cpu->IsDmaRunning(), apuResult);
         _ppu->Step(_cpu->Cycles * 3, screen, ppuResult);
         
+        _cpuCycles += _cpu->Cycles;
         _cpu->Cycles = 0;
         
         if (ppuResult.WantNmi)
@@ -91,45 +229,411 @@ void Nes::DoFrame(u8 screen[])
     } while (!ppuResult.VBlank);
 }
 
+void Nes::RunPipelinedFrame(u8 screen[])
+{
+    PpuFrameLog& log = _renderThread->NextLog();
+    log.Clear();
+    _ppu->SaveState(log.Start);
+    _mapper->SaveState(log.Start);
+
+    // Emulated without drawing, the render thread draws it from the log
+    _ppu->SetFrameLog(&log);
+    RunFrame(nullptr, false);
+    _ppu->SetFrameLog(nullptr);
+
+    _renderThread->TakeFrame(screen);
+    _renderThread->Submit();
+}
+
+void Nes::RunParallelFrame(u8 screen[])
+{
+    PpuScanlines& scanlines = _scanlineRenderer->Scanlines();
+    scanlines.Begin(screen);
+
+    _ppu->SetScanlineRecording(&scanlines);
+    RunFrame(nullptr, false);
+    _ppu->SetScanlineRecording(nullptr);
+
+    _scanlineRenderer->Draw(screen);
+}
+
 IStandardController* Nes::GetStandardController(unsigned int port)
 {
     return _input->GetStandardController(port);
 }
 
-void Nes::SaveState()
+void Nes::RunFrames(unsigned int count, const u8* inputPerFrame, IFrameSink* sink, unsigned int flags)
 {
-    //std::ofstream ofs(GetSavePath()->c_str(), std::fstream::binary | std::fstream::trunc);
-    //_cpu->SaveState(ofs);
-    //ofs.close();
+    unsigned int interval = 0;
+    if (sink != nullptr)
+    {
+        interval = sink->FrameInterval();
+    }
+    if (interval == 0)
+    {
+        interval = count;
+    }
+
+    for (unsigned int frame = 0; frame < count; frame++)
+    {
+        if (inputPerFrame != nullptr)
+        {
+            _input->SetButtons(0, inputPerFrame[frame]);
+        }
+
+        if (sink != nullptr && (frame + 1) % interval == 0)
+        {
+            EmulateFrame(sink->GetFrameBuffer(frame), flags & ~NES_FRAME_NO_RENDER, false);
+            sink->OnFrame(frame);
+        }
+        else
+        {
+            EmulateFrame(nullptr, flags | NES_FRAME_NO_RENDER, false);
+        }
+    }
+}
 
-    //printf("State Saved!\n");
+void Nes::SaveState()
+{
+    // Only the snapshot happens on this thread. The audio device is paused
+    // for save states the player makes and loads, not for the in-memory ones
+    // run-ahead, netplay and hashing make every frame.
+    std::vector<u8> data;
+    _apu->PauseAudio();
+    SaveStateFile(data);
+    _apu->UnpauseAudio();
+    Persistence()->Write(PersistTarget::SaveState, std::move(data));
 }
 
 void Nes::LoadState()
 {
-    //auto savePath = GetSavePath();
+    Persistence()->RequestLoadState();
+}
+
+PersistenceWorker* Nes::Persistence()
+{
+    if (_persist == nullptr)
+    {
+        _persist = new PersistenceWorker(_rom->File());
+    }
+    return _persist;
+}
+
+void Nes::ServicePersistence()
+{
+    std::vector<u8> data;
+    if (_persist != nullptr && _persist->TakeLoadedState(data))
+    {
+        if (data.empty())
+        {
+            printf("No save state for this ROM.\n");
+        }
+        else
+        {
+            _apu->PauseAudio();
+            LoadStateFile(&data[0], data.size());
+            _apu->UnpauseAudio();
+        }
+    }
+
+    if (++_framesSinceBatteryCheck >= BatteryCheckFrames)
+    {
+        _framesSinceBatteryCheck = 0;
+        if (_rom->TakeSaveGame(data))
+        {
+            Persistence()->Write(PersistTarget::SaveGame, std::move(data));
+        }
+    }
+}
+
+void Nes::SaveState(std::ostream& ofs)
+{
+    for (StateChunk& chunk : _stateChunks)
+    {
+        chunk.Component->SaveState(ofs);
+    }
+}
+
+void Nes::LoadState(std::istream& ifs)
+{
+    _memoryGeneration++;
+    for (StateChunk& chunk : _stateChunks)
+    {
+        chunk.Component->LoadState(ifs);
+    }
+}
+
+void Nes::SaveStateFile(std::vector<u8>& data)
+{
+    StateFile::Write(_stateFileHeader, _stateChunks, StateChunkCount, data);
+}
+
+bool Nes::LoadStateFile(const u8* data, size_t size)
+{
+    _memoryGeneration++;
+    return StateFile::Read(_stateFileHeader, _stateChunks, StateChunkCount, data, size);
+}
+
+void Nes::SetRunAhead(unsigned int frames)
+{
+    _runAheadFrames = frames;
+}
+
+void Nes::SetPipelinedRendering(bool enabled)
+{
+    if (!enabled)
+    {
+        // Waits for the frame being drawn, which is dropped
+        _renderThread.Release();
+    }
+    else if (_renderThread == nullptr && !RenderThread::Create(_rom, &_renderThread))
+    {
+        printf("Unable to start the render thread, frames will be drawn as they are emulated\n");
+    }
+}
+
+void Nes::SetParallelRendering(unsigned int threads)
+{
+    if (threads == 0)
+    {
+        _scanlineRenderer.Release();
+    }
+    else if (_scanlineRenderer == nullptr || _scanlineRenderer->ThreadCount() != threads)
+    {
+        _scanlineRenderer = new ScanlineRenderer(threads);
+    }
+}
+
+u64 Nes::StateHash()
+{
+    // Saving into a HashStream hashes the registers as they are written and
+    // takes the running hash of each memory block instead of its contents
+    _stateHash.Clear();
+    SaveState(_stateHash);
+    return _stateHash.Hash();
+}
+
+u8 Nes::PeekRam(u16 addr)
+{
+    return _mem->PeekRam(addr);
+}
+
+bool Nes::GetCounters(NesCounters* counters)
+{
+    memset(counters, 0, sizeof(NesCounters));
+
+#if defined(NES_COUNTERS)
+    memcpy(counters->lastFrame, _counters.Frame, sizeof(counters->lastFrame));
+    memcpy(counters->total, _counters.Total, sizeof(counters->total));
+    counters->frames = _counters.Frames;
+    return true;
+#else
+    return false;
+#endif
+}
+
+void Nes::ResetCounters()
+{
+#if defined(NES_COUNTERS)
+    _counters.Reset();
+#endif
+}
+
+void Nes::SetCpuProfiling(bool enabled)
+{
+    if (enabled)
+    {
+        _profiler = new CpuProfiler(_rom, _mapper, _mem);
+    }
+    else
+    {
+        _profiler.Release();
+    }
+    _cpu->SetProfiler(_profiler);
+}
+
+void Nes::WriteCpuProfile(std::ostream& out, u32 top)
+{
+    if (_profiler == nullptr)
+    {
+        out << "cpu profiling is off\n";
+        return;
+    }
+    _profiler->Report(out, top);
+}
+
+void Nes::SetCpuTrace(u32 count)
+{
+    if (count > 0)
+    {
+        _trace = new CpuTrace(count, _ppu, &_cpuCycles);
+    }
+    else
+    {
+        _trace.Release();
+    }
+    _cpu->SetTrace(_trace);
+}
+
+void Nes::WriteCpuTrace(std::ostream& out, u32 count)
+{
+    if (_trace == nullptr)
+    {
+        out << "cpu tracing is off\n";
+        return;
+    }
+    _trace->Write(out, count);
+}
+
+void Nes::SetCodeDataLogging(bool enabled)
+{
+    if (enabled)
+    {
+        _cdl = new CodeDataLog(_rom, _mapper);
+    }
+    else
+    {
+        _cdl.Release();
+    }
+    _cpu->SetCodeDataLog(_cdl);
+    _ppu->SetCodeDataLog(_cdl);
+}
+
+bool Nes::WriteCodeDataLog(std::ostream& out)
+{
+    if (_cdl == nullptr)
+    {
+        return false;
+    }
+    _cdl->Write(out);
+    return true;
+}
+
+void Nes::SetMemoryHeatmap(bool enabled)
+{
+    if (enabled)
+    {
+        _heatmap = new MemoryHeatmap();
+    }
+    else
+    {
+        _heatmap.Release();
+    }
+    _mem->SetMemoryHeatmap(_heatmap);
+    _ppu->GetVRam().SetMemoryHeatmap(_heatmap);
+}
+
+void Nes::SetBreakpoint(BreakpointKind kind, u16 address)
+{
+    _debugger->SetBreakpoint(kind, address);
+    _cpu->UpdateDebugging();
+}
+
+bool Nes::SetBreakpoint(BreakpointKind kind, u16 address, const char* condition, const char* log)
+{
+    bool set = _debugger->SetBreakpoint(kind, address, condition, log);
+    _cpu->UpdateDebugging();
+    return set;
+}
+
+u64 Nes::BreakpointHits(BreakpointKind kind, u16 address)
+{
+    return _debugger->BreakpointHits(kind, address);
+}
+
+void Nes::WriteBreakpointLog(std::ostream& out)
+{
+    _debugger->WriteLog(out);
+}
+
+void Nes::ClearBreakpoint(BreakpointKind kind, u16 address)
+{
+    _debugger->ClearBreakpoint(kind, address);
+    _cpu->UpdateDebugging();
+}
+
+void Nes::EnableSingleStep()
+{
+    _debugger->EnableSingleStep();
+    _cpu->UpdateDebugging();
+}
+
+bool Nes::StartGdbServer(u16 port)
+{
+    StopGdbServer();
+    if (!GdbServer::Create(port, _cpu, _mem, _debugger, &_gdb))
+    {
+        return false;
+    }
+    _cpu->UpdateDebugging();
+    return true;
+}
+
+void Nes::StopGdbServer()
+{
+    if (_gdb == nullptr)
+    {
+        return;
+    }
+    _gdb->Stop();
+    _gdb.Release();
+    _cpu->UpdateDebugging();
+}
+
+u64 Nes::InstructionCount()
+{
+    return _cpu->Instructions;
+}
 
-    //if (!fs::exists(*savePath))
-    //{
-    //    printf("No save state for this ROM.\n");
-    //    return;
-    //}
+bool Nes::GetMemoryView(NesMemoryRegion region, NesMemoryView* view)
+{
+    switch (region)
+    {
+    case NES_MEMORY_RAM:
+        view->data = _mem->Ram();
+        view->size = _mem->RamSize();
+        break;
+    case NES_MEMORY_CART_RAM:
+        view->data = _rom->PrgRam.data();
+        view->size = (unsigned int)_rom->PrgRam.size();
+        break;
+    case NES_MEMORY_OAM:
+        view->data = _ppu->GetOam().Data();
+        view->size = _ppu->GetOam().Size();
+        break;
+    case NES_MEMORY_NAMETABLES:
+        view->data = _ppu->GetVRam().Nametables();
+        view->size = _ppu->GetVRam().NametablesSize();
+        break;
+    case NES_MEMORY_PALETTE:
+        view->data = _ppu->GetVRam().Palette();
+        view->size = _ppu->GetVRam().PaletteSize();
+        break;
+    default:
+        view->size = 0;
+        break;
+    }
 
-    //std::ifstream ifs(GetSavePath()->c_str(), std::fstream::binary);
-    //_cpu->LoadState(ifs);
-    //ifs.close();
+    if (view->size == 0)
+    {
+        view->data = nullptr;
+        view->generation = 0;
+        return false;
+    }
 
-    //printf("State Loaded!\n");
+    view->generation = _memoryGeneration;
+    return true;
 }
 
-//std::unique_ptr<fs::path> Nes::GetSavePath()
-//{
-//    fs::path savePath(_rom->Path());
-//    return std::make_unique<fs::path>(savePath.replace_extension("ns"));
-//}
+unsigned long long Nes::MemoryGeneration()
+{
+    return _memoryGeneration;
+}
 
 void Nes::Reset(bool hard)
 {
+    _memoryGeneration++;
+    _rom->Reset(hard);
     _cpu->Reset(hard);
     _mem->Reset(hard);
 }
\ No newline at end of file
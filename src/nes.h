@@ -7,8 +7,20 @@ class MemoryMap;
 class Ppu;
 class Apu;
 class Input;
+class PersistenceWorker;
+class RenderThread;
+class ScanlineRenderer;
+class CpuProfiler;
+class CpuTrace;
+class CodeDataLog;
+class MemoryHeatmap;
+class GdbServer;
 
 #include "interfaces.h"
+#include "savestate.h"
+#include "frameset.h"
+#include "counters.h"
+#include "debug.h"
 
 class Nes : public INes, public NesObject
 {
@@ -30,26 +42,161 @@ public:
     // screen is the pixel data buffer that the ppu will write to
     void DoFrame(u8 screen[]);
 
+    // Same as above, flags is a combination of NesFrameFlags
+    void DoFrame(u8 screen[], unsigned int flags);
+
+    // DoFrame into the frame set and hand the frame to AcquireFrame,
+    // see INes::PublishFrame
+    void PublishFrame(unsigned int flags);
+    const unsigned char* AcquireFrame(unsigned long long* frame);
+
     // Gets a standard Nes controller on the specified port
     // Port can only be 0 or 1
     // If there is an existing device on the port,
     // it will be disconnected and it's memory will be freed.
     IStandardController* GetStandardController(unsigned int port);
 
+    // Many frames with packed input for controller 1, see INes::RunFrames
+    void RunFrames(unsigned int count, const u8* inputPerFrame, IFrameSink* sink, unsigned int flags);
+
+    // Save state to disk and load it back (F1/F2)
+    // The file is written and read on a background thread. A loaded state
+    // takes effect at the start of a later DoFrame.
     void SaveState();
     void LoadState();
 
+    // Save and load the whole machine.
+    // These must be called between frames.
+    void SaveState(std::ostream& ofs);
+    void LoadState(std::istream& ifs);
+
+    // Same as above in the save state file format (see StateFile).
+    // LoadStateFile leaves the machine alone if the file is for another game
+    // or doesn't check out.
+    void SaveStateFile(std::vector<u8>& data);
+    bool LoadStateFile(const u8* data, size_t size);
+
+    void SetRunAhead(unsigned int frames);
+    void SetPipelinedRendering(bool enabled);
+    void SetParallelRendering(unsigned int threads);
+
+    u64 StateHash();
+
+    // Read work ram ($0000-$1fff) with no side effects
+    u8 PeekRam(u16 addr);
+
+    // Work done since the machine was created, run-ahead frames included.
+    // Neither is saved or loaded. The ppu runs three dots per cpu cycle.
+    u64 InstructionCount();
+    u64 PpuDotCount() { return _cpuCycles * 3; }
+
+    // Count every instruction the cpu runs by where it is and by opcode
+    // (see CpuProfiler), run-ahead frames included. Starting again clears
+    // the counts. Slows the cpu down a little while on.
+    void SetCpuProfiling(bool enabled);
+    void WriteCpuProfile(std::ostream& out, u32 top);
+
+    // Keep the last count instructions the cpu runs (see CpuTrace), or stop
+    // keeping them if count is 0. Starting again clears them.
+    void SetCpuTrace(u32 count);
+    void WriteCpuTrace(std::ostream& out, u32 count);
+
+    // Mark the rom the game runs, reads and draws (see CodeDataLog),
+    // run-ahead frames included. Starting again clears the marks. Writing
+    // the log as a .cdl file fails if it is off.
+    void SetCodeDataLogging(bool enabled);
+    bool WriteCodeDataLog(std::ostream& out);
+
+    // Count the reads and writes to each cpu and ppu address (see
+    // MemoryHeatmap), run-ahead frames included. Starting again clears the
+    // counts. The heatmap is null while this is off; clear it to start a new
+    // window of frames.
+    void SetMemoryHeatmap(bool enabled);
+    MemoryHeatmap* GetMemoryHeatmap() { return _heatmap; }
+
+    // Breakpoints on cpu reads, writes and instructions, see DebugService.
+    // The cpu only checks for them while there are any.
+    void SetBreakpoint(BreakpointKind kind, u16 address);
+    void ClearBreakpoint(BreakpointKind kind, u16 address);
+    void EnableSingleStep();
+
+    // Conditional breakpoints, logpoints and hit counts, see
+    // DebugService::SetBreakpoint. Addresses without one run as fast as ever.
+    bool SetBreakpoint(BreakpointKind kind, u16 address, const char* condition, const char* log);
+    u64 BreakpointHits(BreakpointKind kind, u16 address);
+    void WriteBreakpointLog(std::ostream& out);
+
+    // Let a gdb client on this machine debug the cpu (see GdbServer). The
+    // machine stops before its next instruction until a client lets it go.
+    // Stop on the thread running the machine, between frames.
+    bool StartGdbServer(u16 port);
+    void StopGdbServer();
+
+    bool GetMemoryView(NesMemoryRegion region, NesMemoryView* view);
+    unsigned long long MemoryGeneration();
+
+    bool GetCounters(NesCounters* counters);
+    void ResetCounters();
+
     void Reset(bool hard);
 
 private:
-    //std::unique_ptr<fs::path> GetSavePath();
+    // DoFrame, with RunFrames able to keep its frames off the render thread
+    void EmulateFrame(u8 screen[], unsigned int flags, bool pipelined);
+    void RunFrame(u8 screen[], bool pipelined);
+
+    // Emulate a frame and hand it to the render thread to draw. screen gets
+    // the frame handed over before this one.
+    void RunPipelinedFrame(u8 screen[]);
+
+    // Emulate a frame, then draw its scanlines across the scanline renderer's threads
+    void RunParallelFrame(u8 screen[]);
+
+    // Apply a save state the persistence worker has read and hand it battery
+    // ram that has changed
+    void ServicePersistence();
+
+    // The worker and its thread are only started once there is something to
+    // read or write, so machines that never persist anything don't carry one
+    PersistenceWorker* Persistence();
 
 private:
     NPtr<Rom> _rom;
+    NPtr<IMapper> _mapper;
     NPtr<Apu> _apu;
     NPtr<Ppu> _ppu;
     NPtr<Input> _input;
     NPtr<MemoryMap> _mem;
     NPtr<Cpu> _cpu;
     NPtr<DebugService> _debugger;
+    NPtr<PersistenceWorker> _persist;
+    NPtr<RenderThread> _renderThread;
+    NPtr<ScanlineRenderer> _scanlineRenderer;
+    NPtr<CpuProfiler> _profiler;
+    NPtr<CpuTrace> _trace;
+    NPtr<CodeDataLog> _cdl;
+    NPtr<MemoryHeatmap> _heatmap;
+    NPtr<GdbServer> _gdb;
+    FrameSet _frames;
+    unsigned int _framesSinceBatteryCheck;
+
+    // Run-ahead
+    unsigned int _runAheadFrames;
+    MemoryStream _runAheadState;
+
+    HashStream _stateHash;
+
+    // Moves on whenever memory views may have changed
+    u64 _memoryGeneration;
+
+    u64 _cpuCycles;
+
+#if defined(NES_COUNTERS)
+    CounterSet _counters;
+#endif
+
+    // Every component with state, in save order
+    static const u32 StateChunkCount = 6;
+    StateChunk _stateChunks[StateChunkCount];
+    StateFileHeader _stateFileHeader;
 };
\ No newline at end of file
@@ -1,6 +1,7 @@
 #include "stdafx.h"
-#include "..\include\nes_api.h"
+#include "../include/nes_api.h"
 #include "nes.h"
+#include "vecenv.h"
 
 bool Nes_Create(const char* romPath, IAudioProvider* audioProvider, INes** ines)
 {
@@ -15,3 +16,39 @@ bool Nes_Create(const char* romPath, IAudioProvider* audioProvider, INes** ines)
         return false;
     }
 }
+
+NesVecEnv* NesVecEnv_Create(const NesVecEnvConfig* config)
+{
+    NPtr<VecEnv> env;
+    if (VecEnv::Create(*config, &env))
+    {
+        return reinterpret_cast<NesVecEnv*>(env.Detach());
+    }
+    else
+    {
+        return nullptr;
+    }
+}
+
+void NesVecEnv_Destroy(NesVecEnv* env)
+{
+    if (env != nullptr)
+    {
+        reinterpret_cast<VecEnv*>(env)->Release();
+    }
+}
+
+unsigned int NesVecEnv_ObservationSize(NesVecEnv* env)
+{
+    return reinterpret_cast<VecEnv*>(env)->ObservationSize();
+}
+
+void NesVecEnv_Reset(NesVecEnv* env, unsigned char* observations, unsigned char* ram)
+{
+    reinterpret_cast<VecEnv*>(env)->Reset(observations, ram);
+}
+
+void NesVecEnv_Step(NesVecEnv* env, const unsigned char* actions, unsigned char* observations, unsigned char* ram, unsigned char* done)
+{
+    reinterpret_cast<VecEnv*>(env)->Step(actions, observations, ram, done);
+}
\ No newline at end of file
@@ -0,0 +1,495 @@
+#include "stdafx.h"
+#include "netplay.h"
+#include "nes.h"
+
+#if defined(_WIN32)
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "Ws2_32.lib")
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+// Loopback Transport
+
+LoopbackTransport::LoopbackTransport(std::shared_ptr<Channel> in, std::shared_ptr<Channel> out, u32 delayMs, float lossRate, u32 seed)
+    : _in(in)
+    , _out(out)
+    , _delay(delayMs)
+    , _lossRate(lossRate)
+    , _random(seed)
+{
+}
+
+void LoopbackTransport::CreatePair(u32 delayMs, float lossRate, LoopbackTransport** first, LoopbackTransport** second)
+{
+    std::shared_ptr<Channel> a = std::make_shared<Channel>();
+    std::shared_ptr<Channel> b = std::make_shared<Channel>();
+
+    *first = new LoopbackTransport(a, b, delayMs, lossRate, 1);
+    *second = new LoopbackTransport(b, a, delayMs, lossRate, 2);
+}
+
+void LoopbackTransport::Send(const u8* data, u32 size)
+{
+    if (std::uniform_real_distribution<float>(0.0f, 1.0f)(_random) < _lossRate)
+    {
+        return;
+    }
+
+    Packet packet;
+    packet.deliverTime = std::chrono::steady_clock::now() + _delay;
+    packet.data.assign(data, data + size);
+
+    std::lock_guard<std::mutex> lock(_out->mutex);
+    _out->packets.push_back(std::move(packet));
+}
+
+bool LoopbackTransport::Receive(u8* data, u32 maxSize, u32& size)
+{
+    std::lock_guard<std::mutex> lock(_in->mutex);
+    if (_in->packets.empty() || _in->packets.front().deliverTime > std::chrono::steady_clock::now())
+    {
+        return false;
+    }
+
+    Packet& packet = _in->packets.front();
+    size = std::min(maxSize, (u32)packet.data.size());
+    memcpy(data, packet.data.data(), size);
+    _in->packets.pop_front();
+    return true;
+}
+
+// UDP Transport
+
+#if defined(_WIN32)
+static void CloseSocket(SOCKET s)
+{
+    closesocket(s);
+    WSACleanup();
+}
+#else
+static const int INVALID_SOCKET = -1;
+
+static void CloseSocket(int s)
+{
+    close(s);
+}
+#endif
+
+UdpTransport::UdpTransport(Socket socket, u32 remoteAddress, u16 remotePort)
+    : _socket(socket)
+    , _remoteAddress(remoteAddress)
+    , _remotePort(remotePort)
+{
+}
+
+UdpTransport::~UdpTransport()
+{
+    CloseSocket(_socket);
+}
+
+bool UdpTransport::Create(u16 localPort, const char* remoteHost, u16 remotePort, UdpTransport** transport)
+{
+#if defined(_WIN32)
+    WSADATA wsaData;
+    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+    {
+        printf("Unable to start winsock\n");
+        return false;
+    }
+#endif
+
+    Socket s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (s == INVALID_SOCKET)
+    {
+        printf("Unable to create socket\n");
+#if defined(_WIN32)
+        WSACleanup();
+#endif
+        return false;
+    }
+
+    in_addr remote;
+    if (inet_pton(AF_INET, remoteHost, &remote) != 1)
+    {
+        printf("Invalid address: %s\n", remoteHost);
+        CloseSocket(s);
+        return false;
+    }
+
+    sockaddr_in local = {};
+    local.sin_family = AF_INET;
+    local.sin_port = htons(localPort);
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(s, (sockaddr*)&local, sizeof(local)) != 0)
+    {
+        printf("Unable to bind port %d\n", localPort);
+        CloseSocket(s);
+        return false;
+    }
+
+    // The session polls once per frame, it must never wait on the network
+#if defined(_WIN32)
+    u_long nonBlocking = 1;
+    bool ok = ioctlsocket(s, FIONBIO, &nonBlocking) == 0;
+#else
+    bool ok = fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK) == 0;
+#endif
+    if (!ok)
+    {
+        printf("Unable to make socket non-blocking\n");
+        CloseSocket(s);
+        return false;
+    }
+
+    *transport = new UdpTransport(s, remote.s_addr, htons(remotePort));
+    return true;
+}
+
+void UdpTransport::Send(const u8* data, u32 size)
+{
+    sockaddr_in remote = {};
+    remote.sin_family = AF_INET;
+    remote.sin_port = _remotePort;
+    remote.sin_addr.s_addr = _remoteAddress;
+
+    // Failures look the same as a lost packet to the session
+    sendto(_socket, (const char*)data, size, 0, (sockaddr*)&remote, sizeof(remote));
+}
+
+bool UdpTransport::Receive(u8* data, u32 maxSize, u32& size)
+{
+    for (;;)
+    {
+        sockaddr_in from = {};
+        socklen_t fromSize = sizeof(from);
+        int received = recvfrom(_socket, (char*)data, maxSize, 0, (sockaddr*)&from, &fromSize);
+        if (received < 0)
+        {
+#if defined(_WIN32)
+            // Reported when an earlier packet reached the other port before anyone was listening
+            if (WSAGetLastError() == WSAECONNRESET)
+            {
+                continue;
+            }
+#else
+            if (errno == EINTR)
+            {
+                continue;
+            }
+#endif
+            return false;
+        }
+
+        // Ignore strays from anyone other than the other player
+        if (from.sin_addr.s_addr == _remoteAddress && from.sin_port == _remotePort)
+        {
+            size = (u32)received;
+            return true;
+        }
+    }
+}
+
+// Netplay Session
+
+// Every packet carries all of the sender's input the other side hasn't
+// acknowledged yet, so a lost packet is covered by the next one.
+// [type:1] [ack:4] [first frame:4] [count:1] [input:count] [hash frame:4] [hash:8]
+static const u8 InputPacket = 1;
+static const u32 MaxInputsPerPacket = 64;
+static const u32 MaxPacketSize = 1 + 4 + 4 + 1 + MaxInputsPerPacket + 4 + 8;
+
+static void Write32(u8*& p, u32 val)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        *p++ = (u8)(val >> (i * 8));
+    }
+}
+
+static void Write64(u8*& p, u64 val)
+{
+    Write32(p, (u32)val);
+    Write32(p, (u32)(val >> 32));
+}
+
+static u32 Read32(const u8*& p)
+{
+    u32 val = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        val |= (u32)(*p++) << (i * 8);
+    }
+    return val;
+}
+
+static u64 Read64(const u8*& p)
+{
+    u64 lo = Read32(p);
+    u64 hi = Read32(p);
+    return (hi << 32) | lo;
+}
+
+NetplaySession::NetplaySession(Nes* nes, INetplayTransport* transport, const NetplayConfig& config)
+    : _nes(nes)
+    , _transport(transport)
+    , _config(config)
+    , _frame(0)
+    , _localFrames(0)
+    , _remoteConfirmed(0)
+    , _remoteAcked(0)
+    , _rollbackFrame(NoFrame)
+    , _lastRemoteInput(0)
+    , _hashedFrames(0)
+    , _desyncFrame(NoFrame)
+    , _stats()
+{
+    _config.localPort &= 1;
+    _config.maxPrediction = std::max(1u, std::min(_config.maxPrediction, HistorySize / 4));
+    _config.inputDelay = std::min(_config.inputDelay, HistorySize / 4);
+
+    _localController = _nes->GetStandardController(_config.localPort);
+    _remoteController = _nes->GetStandardController(_config.localPort ^ 1);
+
+    for (u32 i = 0; i < HistorySize; i++)
+    {
+        _localInput[i] = 0;
+        _remoteInput[i] = 0;
+        _remoteFrame[i] = NoFrame;
+        _remoteUsed[i] = 0;
+        _localHashes[i].frame = NoFrame;
+        _remoteHashes[i].frame = NoFrame;
+    }
+
+    // Nothing is pressed during the input delay at the start
+    _localFrames = _config.inputDelay;
+}
+
+bool NetplaySession::DoFrame(u8 buttons, u8 screen[])
+{
+    ReceiveInputs();
+
+    if (_rollbackFrame != NoFrame)
+    {
+        Rollback(_rollbackFrame);
+        _rollbackFrame = NoFrame;
+    }
+
+    HashConfirmedFrames();
+
+    if (_frame >= _remoteConfirmed + _config.maxPrediction)
+    {
+        // Too far ahead, give the other player time to catch up
+        // Keep sending so our acks and hashes still get through
+        _stats.stalls++;
+        SendInputs();
+        return false;
+    }
+
+    _localInput[_localFrames % HistorySize] = buttons;
+    _localFrames++;
+    SendInputs();
+
+    SaveFrameState(_frame);
+
+    RunFrame(_frame, screen, NES_FRAME_DEFAULT);
+    _frame++;
+    _stats.frame = _frame;
+    return true;
+}
+
+void NetplaySession::SendInputs()
+{
+    u32 first = _remoteAcked;
+    u32 count = std::min(_localFrames - first, MaxInputsPerPacket);
+
+    u8 packet[MaxPacketSize];
+    u8* p = packet;
+    *p++ = InputPacket;
+    Write32(p, _remoteConfirmed);
+    Write32(p, first);
+    *p++ = (u8)count;
+    for (u32 i = 0; i < count; i++)
+    {
+        *p++ = _localInput[(first + i) % HistorySize];
+    }
+
+    if (_hashedFrames > 0)
+    {
+        FrameHash& latest = _localHashes[(_hashedFrames - 1) % HistorySize];
+        Write32(p, latest.frame);
+        Write64(p, latest.hash);
+    }
+    else
+    {
+        Write32(p, NoFrame);
+        Write64(p, 0);
+    }
+
+    _transport->Send(packet, (u32)(p - packet));
+    _stats.packetsSent++;
+}
+
+void NetplaySession::ReceiveInputs()
+{
+    u8 packet[MaxPacketSize];
+    u32 size;
+    while (_transport->Receive(packet, sizeof(packet), size))
+    {
+        _stats.packetsReceived++;
+        HandlePacket(packet, size);
+    }
+}
+
+void NetplaySession::HandlePacket(const u8* data, u32 size)
+{
+    if (size < 10 || data[0] != InputPacket)
+    {
+        return;
+    }
+
+    const u8* p = data + 1;
+    u32 ack = Read32(p);
+    u32 first = Read32(p);
+    u32 count = *p++;
+    if (size != 10 + count + 12)
+    {
+        return;
+    }
+
+    if (ack > _remoteAcked && ack <= _localFrames)
+    {
+        _remoteAcked = ack;
+    }
+
+    for (u32 i = 0; i < count; i++)
+    {
+        u32 frame = first + i;
+        u8 input = *p++;
+
+        // Already have it, or too far ahead to fit in the history
+        if (frame < _remoteConfirmed || frame >= _remoteConfirmed + HistorySize / 2)
+        {
+            continue;
+        }
+
+        u32 index = frame % HistorySize;
+        if (_remoteFrame[index] == frame)
+        {
+            continue;
+        }
+
+        _remoteFrame[index] = frame;
+        _remoteInput[index] = input;
+
+        // This frame was already run with a guess. If the guess was wrong
+        // everything from here on has to be run again.
+        if (frame < _frame && _remoteUsed[index] != input)
+        {
+            _rollbackFrame = std::min(_rollbackFrame, frame);
+        }
+    }
+
+    while (_remoteFrame[_remoteConfirmed % HistorySize] == _remoteConfirmed)
+    {
+        _lastRemoteInput = _remoteInput[_remoteConfirmed % HistorySize];
+        _remoteConfirmed++;
+    }
+
+    u32 hashFrame = Read32(p);
+    u64 hash = Read64(p);
+    if (hashFrame != NoFrame)
+    {
+        RemoteHash(hashFrame, hash);
+    }
+}
+
+void NetplaySession::RemoteHash(u32 frame, u64 hash)
+{
+    FrameHash& remote = _remoteHashes[frame % HistorySize];
+    remote.frame = frame;
+    remote.hash = hash;
+
+    FrameHash& local = _localHashes[frame % HistorySize];
+    if (local.frame == frame)
+    {
+        _stats.hashesCompared++;
+        if (local.hash != hash)
+        {
+            _desyncFrame = std::min(_desyncFrame, frame);
+        }
+    }
+}
+
+void NetplaySession::Rollback(u32 frame)
+{
+    MemoryStream& state = _states[frame % HistorySize];
+    state.Rewind();
+    _nes->LoadState(state);
+
+    // Nobody sees or hears these frames, only the last one gets shown
+    for (u32 f = frame; f < _frame; f++)
+    {
+        if (f != frame)
+        {
+            SaveFrameState(f);
+        }
+        RunFrame(f, nullptr, NES_FRAME_NO_RENDER | NES_FRAME_NO_AUDIO);
+    }
+
+    u32 length = _frame - frame;
+    _stats.rollbacks++;
+    _stats.framesResimulated += length;
+    _stats.longestRollback = std::max(_stats.longestRollback, length);
+}
+
+void NetplaySession::SaveFrameState(u32 frame)
+{
+    MemoryStream& state = _states[frame % HistorySize];
+    state.Clear();
+    _nes->SaveState(state);
+    _stateHashes[frame % HistorySize] = _nes->StateHash();
+}
+
+void NetplaySession::HashConfirmedFrames()
+{
+    // The state at the start of a frame is final once all input before it is known
+    while (_hashedFrames < _frame && _hashedFrames <= _remoteConfirmed)
+    {
+        FrameHash& local = _localHashes[_hashedFrames % HistorySize];
+        local.frame = _hashedFrames;
+        local.hash = _stateHashes[_hashedFrames % HistorySize];
+
+        FrameHash& remote = _remoteHashes[_hashedFrames % HistorySize];
+        if (remote.frame == _hashedFrames)
+        {
+            _stats.hashesCompared++;
+            if (remote.hash != local.hash)
+            {
+                _desyncFrame = std::min(_desyncFrame, _hashedFrames);
+            }
+        }
+
+        _hashedFrames++;
+    }
+}
+
+void NetplaySession::RunFrame(u32 frame, u8 screen[], unsigned int flags)
+{
+    u32 index = frame % HistorySize;
+
+    // Predict that the other player is still doing what they did last
+    u8 remote = (_remoteFrame[index] == frame) ? _remoteInput[index] : _lastRemoteInput;
+    _remoteUsed[index] = remote;
+
+    _localController->SetButtons(_localInput[index]);
+    _remoteController->SetButtons(remote);
+
+    _nes->DoFrame(screen, flags);
+}
\ No newline at end of file
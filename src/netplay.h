@@ -0,0 +1,221 @@
+#pragma once
+
+#include <deque>
+#include <random>
+
+#include "interfaces.h"
+
+class Nes;
+
+// Netplay Transport Interface
+// An unreliable datagram link to the other player. The session copes with
+// lost, late and reordered packets, so transports don't need to.
+struct INetplayTransport : public IBaseInterface
+{
+    // Queue a packet for the other player. Delivery is not guaranteed.
+    virtual void Send(const u8* data, u32 size) = 0;
+
+    // Take the next waiting packet without blocking.
+    // returns: false if there is nothing waiting
+    virtual bool Receive(u8* data, u32 maxSize, u32& size) = 0;
+};
+
+// In-process transport for testing netplay on a single machine
+// Packets are held back for delayMs and dropped with probability lossRate.
+// The two ends of a pair may be used from different threads.
+class LoopbackTransport : public INetplayTransport, public NesObject
+{
+private:
+    struct Packet
+    {
+        std::chrono::steady_clock::time_point deliverTime;
+        std::vector<u8> data;
+    };
+
+    struct Channel
+    {
+        std::mutex mutex;
+        std::deque<Packet> packets;
+    };
+
+    LoopbackTransport(std::shared_ptr<Channel> in, std::shared_ptr<Channel> out, u32 delayMs, float lossRate, u32 seed);
+
+public:
+    DELEGATE_NESOBJECT_REFCOUNTING();
+
+    static void CreatePair(u32 delayMs, float lossRate, LoopbackTransport** first, LoopbackTransport** second);
+
+    // INetplayTransport
+public:
+    void Send(const u8* data, u32 size);
+    bool Receive(u8* data, u32 maxSize, u32& size);
+
+private:
+    std::shared_ptr<Channel> _in;
+    std::shared_ptr<Channel> _out;
+    std::chrono::milliseconds _delay;
+    float _lossRate;
+
+    // Seeded so a lossy test run can be repeated
+    std::mt19937 _random;
+};
+
+// UDP transport
+// Meant for two processes on one machine (127.0.0.1) but works across a LAN.
+class UdpTransport : public INetplayTransport, public NesObject
+{
+private:
+#if defined(_WIN32)
+    typedef uintptr_t Socket;
+#else
+    typedef int Socket;
+#endif
+
+    UdpTransport(Socket socket, u32 remoteAddress, u16 remotePort);
+
+public:
+    virtual ~UdpTransport();
+
+public:
+    DELEGATE_NESOBJECT_REFCOUNTING();
+
+    // remoteHost is a dotted IPv4 address
+    static bool Create(u16 localPort, const char* remoteHost, u16 remotePort, UdpTransport** transport);
+
+    // INetplayTransport
+public:
+    void Send(const u8* data, u32 size);
+    bool Receive(u8* data, u32 maxSize, u32& size);
+
+private:
+    Socket _socket;
+
+    // network byte order
+    u32 _remoteAddress;
+    u16 _remotePort;
+};
+
+struct NetplayConfig
+{
+    // Which controller port the local player uses, 0 or 1
+    unsigned int localPort = 0;
+
+    // Local input is applied this many frames after it is read.
+    // A little delay hides most of the latency and keeps rollbacks short.
+    unsigned int inputDelay = 2;
+
+    // How many frames we will run ahead of the last confirmed remote input
+    // before waiting for the other player. This bounds the rollback length.
+    unsigned int maxPrediction = 8;
+};
+
+struct NetplayStats
+{
+    u32 frame;
+    u32 rollbacks;
+    u32 framesResimulated;
+    u32 longestRollback;
+    u32 stalls;
+    u32 packetsSent;
+    u32 packetsReceived;
+    u32 hashesCompared;
+};
+
+// Rollback netplay for two players
+// Each side runs the full game. Remote input that hasn't arrived yet is
+// predicted by repeating the last input received, and the state at the start
+// of every unconfirmed frame is kept. When the real input turns out to differ
+// from the prediction the game is rewound to that frame and the frames since
+// are run again, silently, before the next displayed frame.
+// Both sides swap Nes::StateHash at the start of each fully confirmed frame
+// to detect a desync.
+// The Nes must not have run-ahead enabled and should not have its controllers
+// driven by anything else.
+class NetplaySession : public NesObject
+{
+public:
+    static const u32 NoFrame = 0xffffffff;
+
+    NetplaySession(Nes* nes, INetplayTransport* transport, const NetplayConfig& config);
+
+public:
+    DELEGATE_NESOBJECT_REFCOUNTING();
+
+    // Run the next frame with the local player's buttons (NesButtons).
+    // Rollbacks happen here before the frame is run.
+    // returns: false if we are too far ahead of the other player and no frame
+    // was run. Call again on the next tick.
+    bool DoFrame(u8 buttons, u8 screen[]);
+
+    // First frame at which the two sides were seen to disagree, or NoFrame
+    u32 DesyncFrame() { return _desyncFrame; }
+
+    const NetplayStats& Stats() { return _stats; }
+
+private:
+    // Ring buffers must cover the rollback window plus input delay and
+    // inputs still in flight
+    static const u32 HistorySize = 128;
+
+    struct FrameHash
+    {
+        u32 frame;
+        u64 hash;
+    };
+
+    void SendInputs();
+    void ReceiveInputs();
+    void HandlePacket(const u8* data, u32 size);
+    void RemoteHash(u32 frame, u64 hash);
+
+    void Rollback(u32 frame);
+    void SaveFrameState(u32 frame);
+    void HashConfirmedFrames();
+    void RunFrame(u32 frame, u8 screen[], unsigned int flags);
+
+private:
+    NPtr<Nes> _nes;
+    NPtr<INetplayTransport> _transport;
+    NetplayConfig _config;
+    IStandardController* _localController;
+    IStandardController* _remoteController;
+
+    // Next frame to run
+    u32 _frame;
+
+    // Local input has been read up to here (exclusive)
+    u32 _localFrames;
+
+    // All remote input before this frame has arrived
+    u32 _remoteConfirmed;
+
+    // The other side has all of our input before this frame
+    u32 _remoteAcked;
+
+    // Earliest frame that was run with a wrong prediction
+    u32 _rollbackFrame;
+
+    u8 _localInput[HistorySize];
+    u8 _remoteInput[HistorySize];
+
+    // Which frame each _remoteInput entry holds, NoFrame if none
+    u32 _remoteFrame[HistorySize];
+
+    // Newest confirmed remote input, used as the prediction
+    u8 _lastRemoteInput;
+
+    // What the remote input was taken to be when each frame was run
+    u8 _remoteUsed[HistorySize];
+
+    // Machine state at the start of each frame
+    MemoryStream _states[HistorySize];
+    u64 _stateHashes[HistorySize];
+
+    // Desync detection
+    u32 _hashedFrames;
+    FrameHash _localHashes[HistorySize];
+    FrameHash _remoteHashes[HistorySize];
+    u32 _desyncFrame;
+
+    NetplayStats _stats;
+};
\ No newline at end of file
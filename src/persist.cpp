@@ -0,0 +1,262 @@
+#include "stdafx.h"
+#include "persist.h"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+// Atomic File Write Stream
+
+AtomicFileWriteStream::AtomicFileWriteStream(const char* path, FILE* file)
+    : _path(path)
+    , _tempPath(std::string(path) + ".tmp")
+    , _file(file)
+    , _failed(false)
+{
+}
+
+AtomicFileWriteStream::~AtomicFileWriteStream()
+{
+    Commit();
+}
+
+bool AtomicFileWriteStream::Create(const char* path, IWriteStream** stream)
+{
+    std::string tempPath = std::string(path) + ".tmp";
+
+    FILE* file = nullptr;
+#if defined(_WIN32)
+    if (fopen_s(&file, tempPath.c_str(), "wb") != 0)
+    {
+        file = nullptr;
+    }
+#else
+    file = fopen(tempPath.c_str(), "wb");
+#endif
+
+    if (file == nullptr)
+    {
+        printf("Unable to open %s\n", tempPath.c_str());
+        *stream = nullptr;
+        return false;
+    }
+
+    *stream = new AtomicFileWriteStream(path, file);
+    return true;
+}
+
+int AtomicFileWriteStream::WriteBytes(u8* buf, int count)
+{
+    size_t written = fwrite(buf, 1, count, _file);
+    if (written != (size_t)count)
+    {
+        _failed = true;
+    }
+    return (int)written;
+}
+
+void AtomicFileWriteStream::Commit()
+{
+    // The data has to be on the disk before the rename, otherwise a crash
+    // can leave the new name pointing at an empty file
+    bool ok = !_failed && fflush(_file) == 0;
+#if defined(_WIN32)
+    ok = ok && _commit(_fileno(_file)) == 0;
+#else
+    ok = ok && fsync(fileno(_file)) == 0;
+#endif
+    ok = (fclose(_file) == 0) && ok;
+
+    if (ok)
+    {
+#if defined(_WIN32)
+        ok = MoveFileExA(_tempPath.c_str(), _path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+        ok = rename(_tempPath.c_str(), _path.c_str()) == 0;
+#endif
+    }
+
+    if (!ok)
+    {
+        printf("Unable to write %s\n", _path.c_str());
+        remove(_tempPath.c_str());
+    }
+}
+
+// Persistence Worker
+
+PersistenceWorker::PersistenceWorker(IRomFile* romFile)
+    : _romFile(romFile)
+    , _exit(false)
+    , _busy(false)
+    , _pending()
+    , _loadRequested(false)
+    , _loaded(false)
+    , _thread(&PersistenceWorker::Run, this)
+{
+}
+
+PersistenceWorker::~PersistenceWorker()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _exit = true;
+    }
+    _wake.notify_one();
+
+    // Run finishes the queued writes before it returns
+    _thread.join();
+}
+
+void PersistenceWorker::Write(PersistTarget target, std::vector<u8>&& data)
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _data[(int)target] = std::move(data);
+        _pending[(int)target] = true;
+    }
+    _wake.notify_one();
+}
+
+void PersistenceWorker::RequestLoadState()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _loadRequested = true;
+        _loaded = false;
+    }
+    _wake.notify_one();
+}
+
+bool PersistenceWorker::TakeLoadedState(std::vector<u8>& data)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (!_loaded)
+    {
+        return false;
+    }
+
+    data = std::move(_loadedState);
+    _loadedState.clear();
+    _loaded = false;
+    return true;
+}
+
+void PersistenceWorker::Flush()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _idle.wait(lock, [this] { return Idle(); });
+}
+
+bool PersistenceWorker::Idle()
+{
+    if (_busy || _loadRequested)
+    {
+        return false;
+    }
+
+    for (int i = 0; i < TargetCount; i++)
+    {
+        if (_pending[i])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void PersistenceWorker::Run()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    for (;;)
+    {
+        _wake.wait(lock, [this] { return _exit || !Idle(); });
+
+        if (_exit && Idle())
+        {
+            break;
+        }
+
+        // Writes go first so that a load sees the latest save
+        for (int i = 0; i < TargetCount; i++)
+        {
+            if (_pending[i])
+            {
+                std::vector<u8> data = std::move(_data[i]);
+                _data[i].clear();
+                _pending[i] = false;
+                _busy = true;
+
+                lock.unlock();
+                WriteTarget((PersistTarget)i, data);
+                lock.lock();
+
+                _busy = false;
+            }
+        }
+
+        if (_loadRequested && !_pending[(int)PersistTarget::SaveState])
+        {
+            _loadRequested = false;
+            _busy = true;
+
+            std::vector<u8> data;
+            lock.unlock();
+            ReadState(data);
+            lock.lock();
+
+            _loadedState = std::move(data);
+            _loaded = true;
+            _busy = false;
+        }
+
+        if (Idle())
+        {
+            _idle.notify_all();
+        }
+    }
+}
+
+void PersistenceWorker::WriteTarget(PersistTarget target, std::vector<u8>& data)
+{
+    NPtr<IWriteStream> stream;
+    bool ok = (target == PersistTarget::SaveGame)
+        ? _romFile->GetSaveGameStream(&stream)
+        : _romFile->GetSaveStateStream(&stream);
+
+    // A host without somewhere to keep the file just doesn't get one
+    if (ok && !data.empty())
+    {
+        stream->WriteBytes(&data[0], (int)data.size());
+    }
+}
+
+void PersistenceWorker::ReadState(std::vector<u8>& data)
+{
+    NPtr<IReadStream> stream;
+    if (!_romFile->GetLoadStateStream(&stream))
+    {
+        return;
+    }
+
+    u8 buf[0x4000];
+    for (;;)
+    {
+        int count = stream->ReadBytes(buf, sizeof(buf));
+        if (count <= 0)
+        {
+            break;
+        }
+
+        data.insert(data.end(), buf, buf + count);
+        if (count < (int)sizeof(buf))
+        {
+            break;
+        }
+    }
+}
\ No newline at end of file
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <condition_variable>
+#include <thread>
+
+#include "interfaces.h"
+
+// Write stream for files that must never be left half-written.
+// Bytes go to <path>.tmp, which is flushed to disk and renamed over <path>
+// when the stream is released. If anything fails <path> is left untouched.
+class AtomicFileWriteStream : public IWriteStream, public NesObject
+{
+private:
+    AtomicFileWriteStream(const char* path, FILE* file);
+
+public:
+    virtual ~AtomicFileWriteStream();
+
+public:
+    DELEGATE_NESOBJECT_REFCOUNTING();
+
+    static bool Create(const char* path, IWriteStream** stream);
+
+public:
+    int WriteBytes(u8* buf, int count);
+
+private:
+    void Commit();
+
+private:
+    std::string _path;
+    std::string _tempPath;
+    FILE* _file;
+    bool _failed;
+};
+
+enum class PersistTarget : u8
+{
+    SaveGame = 0, // battery backed PrgRam
+    SaveState = 1,
+};
+
+// Background thread for save state and battery ram I/O
+// The emulation thread hands over a buffer and carries on, it never waits on
+// the disk. Writes to the same target that pile up are collapsed into the
+// newest one. The files themselves come from the IRomFile.
+class PersistenceWorker : public NesObject
+{
+public:
+    PersistenceWorker(IRomFile* romFile);
+    virtual ~PersistenceWorker();
+
+public:
+    DELEGATE_NESOBJECT_REFCOUNTING();
+
+    // Queue data to be written, replacing anything still waiting for the same target
+    void Write(PersistTarget target, std::vector<u8>&& data);
+
+    // Start reading the save state. It is read after any queued writes,
+    // so a load straight after a save gets that save.
+    void RequestLoadState();
+
+    // returns: true once a requested save state has been read.
+    // data is left empty if there was no save state.
+    bool TakeLoadedState(std::vector<u8>& data);
+
+    // Wait for everything queued to be written
+    void Flush();
+
+private:
+    void Run();
+    void WriteTarget(PersistTarget target, std::vector<u8>& data);
+    void ReadState(std::vector<u8>& data);
+    bool Idle();
+
+private:
+    static const int TargetCount = 2;
+
+    NPtr<IRomFile> _romFile;
+
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::condition_variable _idle;
+    bool _exit;
+    bool _busy;
+
+    bool _pending[TargetCount];
+    std::vector<u8> _data[TargetCount];
+
+    bool _loadRequested;
+    bool _loaded;
+    std::vector<u8> _loadedState;
+
+    // Last so it starts after everything above is initialized
+    std::thread _thread;
+};
\ No newline at end of file
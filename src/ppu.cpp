@@ -1,10 +1,13 @@
 #include "stdafx.h"
 #include "ppu.h"
 #include "rom.h"
+#include "counters.h"
 
 Ppu::Ppu(IMapper* mapper)
     : _mapper(mapper)
     , _vram(_mapper)
+    , _log(nullptr)
+    , _scanlines(nullptr)
 {
     Reset(true);
 }
@@ -36,7 +39,7 @@ void Ppu::Reset(bool hard)
         _showBackground = false;
         _showSprites = false;
         _oamAddr = 0;
-        _lineSprites.resize(0);
+        _lineSpriteCount = 0;
         _spriteZeroOnLine = false;
         _vram.Reset(hard);
         _oam.Reset(hard);
@@ -50,6 +53,18 @@ void Ppu::Reset(bool hard)
 // IMem
 u8 Ppu::loadb(u16 addr)
 {
+    // The other registers can be read without side effects
+    if (_log != nullptr && ((addr & 0x7) == 2 || (addr & 0x7) == 7))
+    {
+        LogAccess(PpuAccess::Read, addr, 0);
+    }
+
+    // $2007 reads move v on
+    if (_scanlines != nullptr && (addr & 0x7) == 7)
+    {
+        RecordChange(false, false);
+    }
+
     switch (addr & 0x7)
     {
     case 0:
@@ -85,6 +100,18 @@ u8 Ppu::loadb(u16 addr)
 
 void Ppu::storeb(u16 addr, u8 val)
 {
+    if (_log != nullptr)
+    {
+        LogAccess(PpuAccess::Write, addr, val);
+    }
+
+    // Oam changes don't show until the next line's sprites are evaluated
+    if (_scanlines != nullptr && (addr & 0x7) != 3 && (addr & 0x7) != 4)
+    {
+        bool vramWrite = (addr & 0x7) == 7;
+        RecordChange(vramWrite, vramWrite && (_v & 0x3fff) < 0x2000);
+    }
+
     switch (addr & 0x7)
     {
     case 0:
@@ -117,7 +144,7 @@ void Ppu::storeb(u16 addr, u8 val)
     }
 }
 
-void Ppu::SaveState(std::ofstream& ofs)
+void Ppu::SaveState(std::ostream& ofs)
 {
     // don't need to save screen because we save and load state in VBlank
     _vram.SaveState(ofs);
@@ -150,7 +177,7 @@ void Ppu::SaveState(std::ofstream& ofs)
     Util::WriteBytes(_frameOdd, ofs);
 }
 
-void Ppu::LoadState(std::ifstream& ifs)
+void Ppu::LoadState(std::istream& ifs)
 {
     // don't need to load screen because we save and load state in VBlank
     _vram.LoadState(ifs);
@@ -202,6 +229,10 @@ u8 Ppu::Read2007()
 {
     u16 addr = _v;
     u8 val = _vram.loadb(addr);
+    if (_cdl != nullptr && (addr & 0x3fff) < 0x2000)
+    {
+        _cdl->LogChr(addr & 0x3fff, CDL_CHR_READ);
+    }
     _v += _vramAddrIncrement;
 
     // quirk: If reading from nametables, data is buffered
@@ -383,16 +414,31 @@ void Ppu::Step(PpuStepResult& result, u8 screen[])
         
         if (_cycle == 0)
         {
-            _lineSprites.clear();
+            _lineSpriteCount = 0;
             _spriteZeroOnLine = false;
             if (_showSprites)
             {
                 ProcessSprites();
             }
+            if (_scanlines != nullptr)
+            {
+                RecordScanline();
+            }
+            if (_cdl != nullptr && IsRendering())
+            {
+                LogChrFetches();
+            }
         }
         if (_cycle >=1 && _cycle <= 256)
         {
-            DrawScanline(_cycle - 1, screen);
+            if (_scanlines != nullptr && _scanlines->Lines[_scanline].Drawn)
+            {
+                DrawScanline(_cycle - 1, _scanlines->Screen);
+            }
+            else
+            {
+                DrawScanline(_cycle - 1, screen);
+            }
             if (_cycle == 256 && IsRendering())
             {
                 IncVertV();
@@ -488,14 +534,137 @@ void Ppu::Step(PpuStepResult& result, u8 screen[])
 
 void Ppu::Step(u8 cycles, u8 screen[], PpuStepResult& result)
 {
+    COUNT_CALL(NES_COUNTER_PPU_STEP);
+
     for (u8 i = 0; i < cycles; i++)
     {
         Step(result, screen);
     }
+
+    if (_log != nullptr)
+    {
+        _log->Cycles += cycles;
+    }
+}
+
+void Ppu::RecordScanline()
+{
+    if (_scanlines->MemoryChanged)
+    {
+        if (_scanlines->MemoryCount == _scanlines->Memory.size())
+        {
+            _scanlines->Memory.emplace_back();
+        }
+
+        PpuMemory& memory = _scanlines->Memory[_scanlines->MemoryCount++];
+        memcpy(memory.Nametables, _vram.Nametables(), sizeof(memory.Nametables));
+        memcpy(memory.Palette, _vram.Palette(), sizeof(memory.Palette));
+        if (_scanlines->ChrChanged)
+        {
+            for (u16 addr = 0; addr < sizeof(memory.Chr); addr++)
+            {
+                memory.Chr[addr] = _mapper->chr_loadb(addr);
+            }
+        }
+        else
+        {
+            memcpy(memory.Chr, _scanlines->Memory[_scanlines->MemoryCount - 2].Chr, sizeof(memory.Chr));
+        }
+        memory.Mirroring = _mapper->Mirroring;
+
+        _scanlines->MemoryChanged = false;
+        _scanlines->ChrChanged = false;
+    }
+
+    PpuScanline& line = _scanlines->Lines[_scanline];
+    line.V = _v;
+    line.X = _x;
+    line.BackgroundBaseAddress = _backgroundBaseAddress;
+    line.SpriteBaseAddress = _spriteBaseAddress;
+    line.Size = _spriteSize;
+    line.ClipBackground = _clipBackground;
+    line.ClipSprites = _clipSprites;
+    line.ShowBackground = _showBackground;
+    line.ShowSprites = _showSprites;
+    memcpy(line.Sprites, _lineSprites, sizeof(line.Sprites));
+    line.SpriteCount = _lineSpriteCount;
+    line.SpriteZeroOnLine = _spriteZeroOnLine;
+    line.Memory = _scanlines->MemoryCount - 1;
+    line.Drawn = false;
+}
+
+// Called before an access that can change what is drawn
+void Ppu::RecordChange(bool memory, bool chr)
+{
+    if (memory)
+    {
+        _scanlines->MemoryChanged = true;
+    }
+    if (chr)
+    {
+        _scanlines->ChrChanged = true;
+    }
+
+    // Part way along a line the recording no longer describes the rest of it.
+    // Nothing has changed since the line started, so the pixels skipped so far
+    // can be drawn now and the rest as the line goes.
+    if (_scanline < SCREEN_HEIGHT && _cycle >= 1 && _cycle <= 256 && !_scanlines->Lines[_scanline].Drawn)
+    {
+        _scanlines->Lines[_scanline].Drawn = true;
+
+        u16 cycle = _cycle;
+        for (_cycle = 1; _cycle < cycle; _cycle++)
+        {
+            DrawScanline(_cycle - 1, _scanlines->Screen);
+        }
+        _cycle = cycle;
+    }
+}
+
+void Ppu::DrawRecordedScanline(u16 scanline, const PpuScanline& line, u8 screen[])
+{
+    _scanline = scanline;
+    _v = line.V;
+    _x = line.X;
+    _backgroundBaseAddress = line.BackgroundBaseAddress;
+    _spriteBaseAddress = line.SpriteBaseAddress;
+    _spriteSize = line.Size;
+    _clipBackground = line.ClipBackground;
+    _clipSprites = line.ClipSprites;
+    _showBackground = line.ShowBackground;
+    _showSprites = line.ShowSprites;
+    memcpy(_lineSprites, line.Sprites, sizeof(_lineSprites));
+    _lineSpriteCount = line.SpriteCount;
+    _spriteZeroOnLine = line.SpriteZeroOnLine;
+
+    for (_cycle = 1; _cycle <= SCREEN_WIDTH; _cycle++)
+    {
+        DrawScanline(_cycle - 1, screen);
+    }
+}
+
+void Ppu::LogAccess(PpuAccess access, u16 addr, u8 val)
+{
+    PpuAccessRecord record;
+    record.Cycle = _log->Cycles;
+    record.Addr = addr;
+    record.Val = val;
+    record.Access = access;
+    _log->Accesses.push_back(record);
 }
 
 void Ppu::DrawScanline(u8 x, u8 screen[])
 {
+    COUNT_CALL(NES_COUNTER_PPU_DRAW_SCANLINE);
+
+    // screen is null for frames that are emulated but not displayed.
+    // Nothing about the pixel is visible to the game except sprite 0 hit.
+    if (screen == nullptr)
+    {
+        CheckSpriteZeroHit(x);
+        return;
+    }
+
     SpritePriority spritePriority = SpritePriority::Below;
     rgb pixel;
 
@@ -512,7 +681,7 @@ void Ppu::DrawScanline(u8 x, u8 screen[])
 
     u8 spritePaletteIndex = 0;
     bool spriteOpqaue = false;
-    if (_lineSprites.size() > 0 && !((x < 8) && _clipSprites))
+    if (_lineSpriteCount > 0 && !((x < 8) && _clipSprites))
     {
         spriteOpqaue = GetSpriteColor(x, (u8)_scanline, backgroundPaletteIndex != 0, spritePaletteIndex, spritePriority);
     }
@@ -544,6 +713,39 @@ void Ppu::DrawScanline(u8 x, u8 screen[])
     screen[(_scanline * SCREEN_WIDTH + x) * 4 + 3] = 0xff; //alpha channel, ignore
 }
 
+// The same tests DrawScanline makes before it can set sprite 0 hit, without
+// working out the colour of pixels no one will see
+void Ppu::CheckSpriteZeroHit(u8 x)
+{
+    if (!_spriteZeroOnLine || _ppuStatus.SpriteZeroHit())
+    {
+        return;
+    }
+
+    // Sprite 0 is always first on the line when it's there
+    const Sprite& spriteZero = _lineSprites[0];
+    if (spriteZero.X > x || spriteZero.X + 8 <= x || ((x < 8) && _clipSprites))
+    {
+        return;
+    }
+
+    if (!_showBackground || ((x < 8) && _clipBackground))
+    {
+        return;
+    }
+
+    u8 backgroundPaletteIndex = 0;
+    GetBackgroundColor(backgroundPaletteIndex);
+    if (backgroundPaletteIndex == 0)
+    {
+        return;
+    }
+
+    u8 spritePaletteIndex;
+    SpritePriority spritePriority;
+    GetSpriteColor(x, (u8)_scanline, true, spritePaletteIndex, spritePriority);
+}
+
 void Ppu::ProcessSprites()
 {
     u8 numSpritesOnLine = 0;
@@ -562,7 +764,7 @@ void Ppu::ProcessSprites()
                 {
                     _spriteZeroOnLine = true;
                 }
-                _lineSprites.push_back(std::make_unique<Sprite>(*pSprite));
+                _lineSprites[numSpritesOnLine] = *pSprite;
                 numSpritesOnLine++;
             }
             else if (numSpritesOnLine == 8)
@@ -571,6 +773,7 @@ void Ppu::ProcessSprites()
             }
         }
     }
+    _lineSpriteCount = numSpritesOnLine;
 }
 
 bool Ppu::GetBackgroundColor(u8& paletteIndex)
@@ -677,67 +880,14 @@ bool Ppu::GetBackgroundColor(u8& paletteIndex)
 
 bool Ppu::GetSpriteColor(u8 x, u8 y, bool backgroundOpaque, u8& paletteIndex, SpritePriority& priority)
 {
-    std::vector<std::unique_ptr<Sprite>>::iterator it = _lineSprites.begin();
-
-    u16 spriteHeight = _spriteSize == SpriteSize::Spr8x8 ? 8 : 16;
-    bool is8x16 = _spriteSize == SpriteSize::Spr8x16;
-
-    // which table are sprites in?
-    u16 patternTableBaseAddress = _spriteBaseAddress;
-
-    for (; it != _lineSprites.end(); it++)
+    for (u8 i = 0; i < _lineSpriteCount; i++)
     {
-        Sprite* spr = it->get();
+        Sprite* spr = &_lineSprites[i];
 
         if (spr->X <= x && spr->X + 8 > x)
         {
             // our pixel is within this sprite
-
-            u16 patternTableBaseOffset;
-            u16 patternRowOffset = y - (spr->Y + 1);
-            if (is8x16)
-            {
-                patternTableBaseAddress = (spr->TileIndex & 1) == 0 ? 0 : 0x1000;
-
-                u16 topSpriteOffset = (spr->TileIndex & 0xFE) * 16;
-                u16 bottomSpriteOffset = topSpriteOffset + 16;
-
-                if (spr->FlipVertical())
-                {
-                    if (patternRowOffset < 8)
-                    {
-                        patternTableBaseOffset = bottomSpriteOffset;
-                    }
-                    else
-                    {
-                        patternTableBaseOffset = topSpriteOffset;
-                        patternRowOffset -= 8;
-                    }
-                }
-                else
-                {
-                    if (patternRowOffset < 8)
-                    {
-                        patternTableBaseOffset = topSpriteOffset;
-                    }
-                    else
-                    {
-                        patternTableBaseOffset = bottomSpriteOffset;
-                        patternRowOffset -= 8;
-                    }
-                }
-            }
-            else
-            {
-                patternTableBaseOffset = spr->TileIndex * 16;
-            }
-
-            if (spr->FlipVertical())
-            {
-                patternRowOffset = 7 - patternRowOffset;
-            }
-
-            u16 patternRowAddress = patternTableBaseAddress + patternTableBaseOffset + patternRowOffset;
+            u16 patternRowAddress = SpriteRowAddress(*spr, y);
 
             u8 loPlaneRow = _vram.loadb(patternRowAddress);
             u8 hiPlaneRow = _vram.loadb(patternRowAddress + 8);
@@ -755,16 +905,12 @@ bool Ppu::GetSpriteColor(u8 x, u8 y, bool backgroundOpaque, u8& paletteIndex, Sp
 
             if (patternColor == 0)
             {
-                if (it == _lineSprites.end())
-                {
-                    return false;
-                }
                 // This sprite pixel is transparent, continue searching for lower pri sprites
                 continue;
             }
 
             // Now we know we have an opaque sprite pixel
-            if (backgroundOpaque && _spriteZeroOnLine && it == _lineSprites.begin() && x != 255)
+            if (backgroundOpaque && _spriteZeroOnLine && i == 0 && x != 255)
             {
                 _ppuStatus.SetSpriteZeroHit(true);
             }
@@ -781,6 +927,86 @@ bool Ppu::GetSpriteColor(u8 x, u8 y, bool backgroundOpaque, u8& paletteIndex, Sp
     return 0;
 }
 
+u16 Ppu::SpriteRowAddress(Sprite& spr, u8 y)
+{
+    // which table are sprites in?
+    u16 patternTableBaseAddress = _spriteBaseAddress;
+
+    u16 patternTableBaseOffset;
+    u16 patternRowOffset = y - (spr.Y + 1);
+    if (_spriteSize == SpriteSize::Spr8x16)
+    {
+        patternTableBaseAddress = (spr.TileIndex & 1) == 0 ? 0 : 0x1000;
+
+        u16 topSpriteOffset = (spr.TileIndex & 0xFE) * 16;
+        u16 bottomSpriteOffset = topSpriteOffset + 16;
+
+        if (spr.FlipVertical())
+        {
+            if (patternRowOffset < 8)
+            {
+                patternTableBaseOffset = bottomSpriteOffset;
+            }
+            else
+            {
+                patternTableBaseOffset = topSpriteOffset;
+                patternRowOffset -= 8;
+            }
+        }
+        else
+        {
+            if (patternRowOffset < 8)
+            {
+                patternTableBaseOffset = topSpriteOffset;
+            }
+            else
+            {
+                patternTableBaseOffset = bottomSpriteOffset;
+                patternRowOffset -= 8;
+            }
+        }
+    }
+    else
+    {
+        patternTableBaseOffset = spr.TileIndex * 16;
+    }
+
+    if (spr.FlipVertical())
+    {
+        patternRowOffset = 7 - patternRowOffset;
+    }
+
+    return patternTableBaseAddress + patternTableBaseOffset + patternRowOffset;
+}
+
+void Ppu::LogChrFetches()
+{
+    u8 y = ScrollY();
+    if (_showBackground)
+    {
+        // The line's 32 tiles and the one fine x scroll brings in
+        u16 x = ScrollX();
+        u8 nameTableBits = (u8)((_v & 0b110000000000) >> 10);
+        for (u16 tile = 0; tile < 33; tile++)
+        {
+            u16 tileX = x + tile * 8;
+            u8 tileNameTableBits = tileX >= 256 ? nameTableBits ^ 0b01 : nameTableBits;
+            u16 nameTableAddress = 0x2000 + (tileNameTableBits * 0x400) + ((y / 8) * 32) + ((tileX & 0xff) / 8);
+
+            u16 patternRowAddress = _backgroundBaseAddress + (_vram.loadb(nameTableAddress) * 16) + (y % 8);
+            _cdl->LogChr(patternRowAddress, CDL_CHR_RENDERED);
+            _cdl->LogChr(patternRowAddress + 8, CDL_CHR_RENDERED);
+        }
+    }
+
+    for (u8 i = 0; i < _lineSpriteCount; i++)
+    {
+        u16 patternRowAddress = SpriteRowAddress(_lineSprites[i], (u8)_scanline);
+        _cdl->LogChr(patternRowAddress, CDL_CHR_RENDERED);
+        _cdl->LogChr(patternRowAddress + 8, CDL_CHR_RENDERED);
+    }
+}
+
 ///
 /// VRam
 ///
@@ -801,6 +1027,8 @@ void VRam::Reset(bool hard)
     {
         memset(_nametables, 0, sizeof(_nametables));
         memset(_palette, 0, sizeof(_palette));
+        _nametablesHash.Invalidate();
+        _paletteHash.Invalidate();
     }
     else
     {
@@ -812,8 +1040,14 @@ u8 VRam::loadb(u16 addr)
 {
     addr &= 0x3fff;
 
+    if (_heatmap != nullptr)
+    {
+        _heatmap->PpuRead(addr);
+    }
+
     if (addr < 0x2000)
     {
+        COUNT_CALL(NES_COUNTER_MAPPER_CHR_LOAD);
         return _mapper->chr_loadb(addr);
     }
     else if (addr < 0x3f00)
@@ -834,13 +1068,20 @@ void VRam::storeb(u16 addr, u8 val)
 {
     addr &= 0x3fff;
 
+    if (_heatmap != nullptr)
+    {
+        _heatmap->PpuWrite(addr);
+    }
+
     if (addr < 0x2000)
     {
         _mapper->chr_storeb(addr, val);
     }
     else if (addr < 0x3f00)
     {
-        _nametables[NameTableAddress(addr)] = val;
+        u16 nametableAddr = NameTableAddress(addr);
+        _nametablesHash.Update(nametableAddr, _nametables[nametableAddr], val);
+        _nametables[nametableAddr] = val;
     }
     else if (addr < 0x4000)
     {
@@ -849,6 +1090,7 @@ void VRam::storeb(u16 addr, u8 val)
         {
             addr = 0x00;
         }
+        _paletteHash.Update(addr, _palette[addr], val);
         _palette[addr] = val;
     }
 }
@@ -877,17 +1119,27 @@ u16 VRam::NameTableAddress(u16 addr)
     }
 }
 
-void VRam::SaveState(std::ofstream& ofs)
+void VRam::Load(const u8* nametables, const u8* palette)
+{
+    memcpy(_nametables, nametables, sizeof(_nametables));
+    memcpy(_palette, palette, sizeof(_palette));
+    _nametablesHash.Invalidate();
+    _paletteHash.Invalidate();
+}
+
+void VRam::SaveState(std::ostream& ofs)
 {
     // mapper is saved by memory map
-    ofs.write((char*)_nametables, sizeof(_nametables));
-    ofs.write((char*)_palette, sizeof(_palette));
+    Util::WriteBlock(_nametables, sizeof(_nametables), _nametablesHash, ofs);
+    Util::WriteBlock(_palette, sizeof(_palette), _paletteHash, ofs);
 }
 
-void VRam::LoadState(std::ifstream& ifs)
+void VRam::LoadState(std::istream& ifs)
 {
     ifs.read((char*)_nametables, sizeof(_nametables));
     ifs.read((char*)_palette, sizeof(_palette));
+    _nametablesHash.Invalidate();
+    _paletteHash.Invalidate();
 }
 
 Oam::Oam()
@@ -904,6 +1156,7 @@ void Oam::Reset(bool hard)
     if (hard)
     {
         memset(_ram, 0, sizeof(_ram));
+        _ramHash.Invalidate();
     }
     else
     {
@@ -918,17 +1171,19 @@ u8 Oam::loadb(u16 addr)
 
 void Oam::storeb(u16 addr, u8 val)
 {
+    _ramHash.Update((u8)addr, _ram[(u8)addr], val);
     _ram[(u8)addr] = val;
 }
 
-void Oam::SaveState(std::ofstream& ofs)
+void Oam::SaveState(std::ostream& ofs)
 {
-    ofs.write((char*)_ram, sizeof(_ram));
+    Util::WriteBlock(_ram, sizeof(_ram), _ramHash, ofs);
 }
 
-void Oam::LoadState(std::ifstream& ifs)
+void Oam::LoadState(std::istream& ifs)
 {
     ifs.read((char*)_ram, sizeof(_ram));
+    _ramHash.Invalidate();
 }
 
 const Sprite* Oam::operator[](const int index)
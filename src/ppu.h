@@ -2,6 +2,7 @@
 
 #include "mem.h"
 #include "mapper.h"
+#include "cdl.h"
 
 const u32 SCREEN_HEIGHT = 240;
 const u32 SCREEN_WIDTH = 256;
@@ -72,20 +73,35 @@ public:
     void storeb(u16 addr, u8 val);
 
     // ISaveState
-    void SaveState(std::ofstream& ofs);
-    void LoadState(std::ifstream& ifs);
+    void SaveState(std::ostream& ofs);
+    void LoadState(std::istream& ifs);
+
+    const u8* Nametables() { return _nametables; }
+    u32 NametablesSize() { return sizeof(_nametables); }
+    const u8* Palette() { return _palette; }
+    u32 PaletteSize() { return sizeof(_palette); }
+
+    // Replace the nametables and palette, for drawing recorded scanlines
+    void Load(const u8* nametables, const u8* palette);
+
+    // Count every load and store in heatmap, or stop counting if null
+    void SetMemoryHeatmap(MemoryHeatmap* heatmap) { _heatmap = heatmap; }
 
 private:
     u16 NameTableAddress(u16 addr);
 
 private:
     NPtr<IMapper> _mapper;
+    NPtr<MemoryHeatmap> _heatmap;
 
     // FIXME: This is enough VRAM for two name tables
     // FIXME: Which is not correct for all mapper scenarios
     u8 _nametables[0x800];
 
     u8 _palette[0x20];
+
+    BlockHash _nametablesHash;
+    BlockHash _paletteHash;
 };
 
 enum class SpritePriority : u8
@@ -130,13 +146,17 @@ public:
     u8 loadb(u16 addr);
     void storeb(u16 addr, u8 val);
 
-    void SaveState(std::ofstream& ofs);
-    void LoadState(std::ifstream& ifs);
+    void SaveState(std::ostream& ofs);
+    void LoadState(std::istream& ifs);
 
     const Sprite* operator[](const int index);
 
+    const u8* Data() { return _ram; }
+    u32 Size() { return sizeof(_ram); }
+
 private:
     u8 _ram[0x100];
+    BlockHash _ramHash;
 };
 
 struct PpuStepResult
@@ -158,6 +178,101 @@ struct PpuStepResult
     }
 };
 
+// An access that changes what the ppu shows, see PpuFrameLog
+enum class PpuAccess : u8
+{
+    Read = 0,           // $2002 and $2007 reads, which move the ppu on
+    Write = 1,          // $2000-$2007 writes, oam dma included
+    MapperWrite = 2,    // $8000-$ffff writes, which can switch chr banks and mirroring
+};
+
+struct PpuAccessRecord
+{
+    u32 Cycle; // ppu cycles since the start of the frame
+    u16 Addr;
+    u8 Val;
+    PpuAccess Access;
+};
+
+// Everything needed to draw a frame somewhere else.
+// A Ppu and mapper loaded from Start, stepped Cycles times with Accesses
+// applied in order at their cycles, draw exactly the frame the real ones did.
+struct PpuFrameLog
+{
+    MemoryStream Start; // ppu then mapper state
+    std::vector<PpuAccessRecord> Accesses;
+    u32 Cycles;
+
+    PpuFrameLog()
+        : Cycles(0)
+    {
+    }
+
+    void Clear()
+    {
+        Start.Clear();
+        Accesses.clear();
+        Cycles = 0;
+    }
+};
+
+// Memory the ppu draws from, as it was for some scanlines of a frame
+struct PpuMemory
+{
+    u8 Nametables[0x800];
+    u8 Palette[0x20];
+    u8 Chr[0x2000]; // as the mapper had it banked in
+    NameTableMirroring Mirroring;
+};
+
+// The ppu as the pixels of one scanline see it, taken at cycle 0
+struct PpuScanline
+{
+    u16 V;
+    u8 X;
+    u16 BackgroundBaseAddress;
+    u16 SpriteBaseAddress;
+    SpriteSize Size; // of sprites
+    bool ClipBackground;
+    bool ClipSprites;
+    bool ShowBackground;
+    bool ShowSprites;
+    Sprite Sprites[8];
+    u8 SpriteCount;
+    bool SpriteZeroOnLine;
+
+    u32 Memory; // index into PpuScanlines::Memory
+
+    // Nothing left to draw. Either something changed part way along the line
+    // and the ppu drew it as it went, or the frame never reached the line.
+    bool Drawn;
+};
+
+// The visible scanlines of a frame, recorded so they can be drawn in any
+// order once the frame has run (see ScanlineRenderer).
+// The memory is only copied again when something that can change it happens.
+struct PpuScanlines
+{
+    u8* Screen; // where lines the ppu draws itself go
+    PpuScanline Lines[SCREEN_HEIGHT];
+    std::vector<PpuMemory> Memory;
+    u32 MemoryCount;
+    bool MemoryChanged;
+    bool ChrChanged; // reading chr through the mapper is the slow part of a copy
+
+    void Begin(u8 screen[])
+    {
+        Screen = screen;
+        MemoryCount = 0;
+        MemoryChanged = true;
+        ChrChanged = true;
+        for (PpuScanline& line : Lines)
+        {
+            line.Drawn = true;
+        }
+    }
+};
+
 // Ppu Registers
 
 struct PpuStatus
@@ -183,6 +298,8 @@ struct PpuStatus
         if (on) val |= (1 << 6);
         else val &= ~(1 << 6);
     }
+
+    bool SpriteZeroHit() { return (val & (1 << 6)) != 0; }
 };
 
 class Ppu : public IMem, public NesObject
@@ -200,14 +317,51 @@ public:
     void storeb(u16 addr, u8 val);
 
     // ISaveState
-    void SaveState(std::ofstream& ofs);
-    void LoadState(std::ifstream& ifs);
+    void SaveState(std::ostream& ofs);
+    void LoadState(std::istream& ifs);
 
 public:
     void Step(PpuStepResult& result, u8 screen[]);
     void Step(u8 cycles, u8 screen[], PpuStepResult& result);
     void Reset(bool hard);
 
+    // For reading game state, see INes::GetMemoryView
+    VRam& GetVRam() { return _vram; }
+    Oam& GetOam() { return _oam; }
+
+    // Where the ppu is in the frame, for tracing
+    u16 Scanline() { return _scanline; }
+    u16 Dot() { return _cycle; }
+
+    // Record accesses into log until this is called with null.
+    // The log's start state is up to the caller.
+    void SetFrameLog(PpuFrameLog* log) { _log = log; }
+
+    // Record the visible scanlines into scanlines until this is called with null.
+    // Pixels aren't drawn while recording, except on lines that change part way.
+    void SetScanlineRecording(PpuScanlines* scanlines) { _scanlines = scanlines; }
+
+    // Draw a recorded scanline. The nametables, palette and chr must already
+    // be the ones the line was recorded with.
+    void DrawRecordedScanline(u16 scanline, const PpuScanline& line, u8 screen[]);
+
+    // Marks the chr rom the ppu draws from and the cpu reads in log, or
+    // stops if null
+    void SetCodeDataLog(CodeDataLog* log) { _cdl = log; }
+
+    // Mapper writes don't come through the ppu, the memory map reports them
+    void LogMapperWrite(u16 addr, u8 val)
+    {
+        if (_log != nullptr)
+        {
+            LogAccess(PpuAccess::MapperWrite, addr, val);
+        }
+        if (_scanlines != nullptr)
+        {
+            RecordChange(true, true);
+        }
+    }
+
 #if defined(RENDER_NAMETABLE)
     void RenderNameTable(u8 screen[], int i);
 #endif
@@ -237,10 +391,20 @@ private:
 
     // Rendering
     void DrawScanline(u8 x, u8 screen[]);
+    void CheckSpriteZeroHit(u8 x);
     bool GetBackgroundColor(u8& paletteIndex);
     bool GetSpriteColor(u8 x, u8 y, bool backgroundOpaque, u8& paletteIndex, SpritePriority& priority);
+    u16 SpriteRowAddress(Sprite& spr, u8 y);
     void ProcessSprites();
 
+    // Marks the pattern rows a real ppu fetches for the line, whether or
+    // not it is drawn
+    void LogChrFetches();
+
+    void LogAccess(PpuAccess access, u16 addr, u8 val);
+    void RecordScanline();
+    void RecordChange(bool memory, bool chr);
+
 private:
     NPtr<IMapper> _mapper;
     VRam _vram;
@@ -248,7 +412,8 @@ private:
     // Sprites
     Oam _oam;
     u16 _oamAddr;
-    std::vector<std::unique_ptr<Sprite>> _lineSprites;
+    Sprite _lineSprites[8];
+    u8 _lineSpriteCount;
     bool _spriteZeroOnLine;
 
     // Ppu Register Data
@@ -296,4 +461,8 @@ private:
     // Toggled on every frame
     // If true, the last cycle of the pre render scanline is skipped
     bool _frameOdd;
+
+    PpuFrameLog* _log;
+    PpuScanlines* _scanlines;
+    NPtr<CodeDataLog> _cdl;
 };
\ No newline at end of file
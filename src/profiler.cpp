@@ -0,0 +1,180 @@
+#include "stdafx.h"
+#include "profiler.h"
+#include "diassembler.h"
+#include "mem.h"
+#include "rom.h"
+
+#include <algorithm>
+
+static const u32 BankSize = 0x2000;
+
+CpuProfiler::CpuProfiler(Rom* rom, IMapper* mapper, MemoryMap* mem)
+    : _rom(rom)
+    , _mapper(mapper)
+    , _mem(mem)
+    , _romSize((u32)rom->PrgRom.size())
+{
+    Clear();
+}
+
+void CpuProfiler::Clear()
+{
+    _places.assign(_romSize + 0x8000, Place());
+    memset(_opcodes, 0, sizeof(_opcodes));
+}
+
+u8 CpuProfiler::LoadPlace(u32 place, u16 offset)
+{
+    if (place < _romSize)
+    {
+        // An instruction can run off the end of a bank, this is near enough
+        return place + offset < _romSize ? _rom->PrgRom[place + offset] : 0;
+    }
+
+    // Ram as it is now, which may not be what ran
+    return _mem->PeekCode((u16)(place - _romSize + offset));
+}
+
+void CpuProfiler::Disassemble(u32 place, u16 pc, std::string& text)
+{
+    u8 bytes[3];
+    for (u16 i = 0; i < sizeof(bytes); i++)
+    {
+        bytes[i] = LoadPlace(place, i);
+    }
+
+    char formatted[DISASSEMBLY_TEXT_SIZE];
+    Disassembler::FormatBytes(bytes, formatted);
+    text = formatted;
+    Disassembler::Format(pc, bytes, formatted);
+    text += ' ';
+    text += formatted;
+}
+
+void CpuProfiler::Report(std::ostream& out, u32 top)
+{
+    Count total = {};
+    std::vector<u32> ran;
+    for (u32 place = 0; place < _places.size(); place++)
+    {
+        if (_places[place].Counts.Instructions > 0)
+        {
+            total.Instructions += _places[place].Counts.Instructions;
+            total.Cycles += _places[place].Counts.Cycles;
+            ran.push_back(place);
+        }
+    }
+
+    char line[160];
+    snprintf(line, sizeof(line), "cpu profile: %llu instructions, %llu cycles, %zu places\n",
+        total.Instructions, total.Cycles, ran.size());
+    out << line;
+    if (total.Cycles == 0)
+    {
+        return;
+    }
+
+    std::sort(ran.begin(), ran.end(), [this](u32 a, u32 b)
+    {
+        return _places[a].Counts.Cycles > _places[b].Counts.Cycles;
+    });
+
+    out << "\nhot spots:\n";
+    out << "       cycles      %  instructions  where    addr  instruction\n";
+    for (u32 i = 0; i < top && i < ran.size(); i++)
+    {
+        u32 place = ran[i];
+        const Place& counted = _places[place];
+
+        char where[16];
+        if (place < _romSize)
+        {
+            snprintf(where, sizeof(where), "%06x", place);
+        }
+        else
+        {
+            snprintf(where, sizeof(where), "ram");
+        }
+
+        std::string text;
+        Disassemble(place, counted.Address, text);
+
+        snprintf(line, sizeof(line), "%13llu %5.1f%% %13llu  %-7s $%04X  %s\n",
+            counted.Counts.Cycles,
+            100.0 * counted.Counts.Cycles / total.Cycles,
+            counted.Counts.Instructions,
+            where,
+            counted.Address,
+            text.c_str());
+        out << line;
+    }
+
+    // Per bank, with everything below $8000 as one
+    u32 bankCount = (_romSize + BankSize - 1) / BankSize;
+    std::vector<Count> banks(bankCount + 1, Count());
+    for (u32 place : ran)
+    {
+        Count& bank = banks[place < _romSize ? place / BankSize : bankCount];
+        bank.Instructions += _places[place].Counts.Instructions;
+        bank.Cycles += _places[place].Counts.Cycles;
+    }
+
+    out << "\nprg banks (8KB):\n";
+    out << "  bank        cycles      %  instructions\n";
+    for (u32 bank = 0; bank <= bankCount; bank++)
+    {
+        if (banks[bank].Instructions == 0)
+        {
+            continue;
+        }
+
+        char name[16];
+        if (bank < bankCount)
+        {
+            snprintf(name, sizeof(name), "%u", bank);
+        }
+        else
+        {
+            snprintf(name, sizeof(name), "ram");
+        }
+
+        snprintf(line, sizeof(line), "  %-4s %13llu %5.1f%% %13llu\n",
+            name,
+            banks[bank].Cycles,
+            100.0 * banks[bank].Cycles / total.Cycles,
+            banks[bank].Instructions);
+        out << line;
+    }
+
+    std::vector<u32> opcodes;
+    for (u32 op = 0; op < 0x100; op++)
+    {
+        if (_opcodes[op].Instructions > 0)
+        {
+            opcodes.push_back(op);
+        }
+    }
+
+    std::sort(opcodes.begin(), opcodes.end(), [this](u32 a, u32 b)
+    {
+        return _opcodes[a].Instructions > _opcodes[b].Instructions;
+    });
+
+    out << "\nopcodes:\n";
+    out << "  op  instruction   instructions      %        cycles      %\n";
+    for (u32 op : opcodes)
+    {
+        u8 bytes[3] = { (u8)op, 0, 0 };
+        char instruction[DISASSEMBLY_TEXT_SIZE];
+        Disassembler::Format(0, bytes, instruction);
+
+        snprintf(line, sizeof(line), "  %02X  %-12s %13llu %5.1f%% %13llu %5.1f%%\n",
+            op,
+            instruction,
+            _opcodes[op].Instructions,
+            100.0 * _opcodes[op].Instructions / total.Instructions,
+            _opcodes[op].Cycles,
+            100.0 * _opcodes[op].Cycles / total.Cycles);
+        out << line;
+    }
+}
\ No newline at end of file
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "interfaces.h"
+
+class Rom;
+class MemoryMap;
+
+// Counts the instructions the cpu runs and the cycles they take, by where
+// they are and by opcode, for finding idle loops and the opcodes a faster
+// interpreter should care about most.
+// Code from $8000 up is counted by its offset in PrgRom, with the banks as
+// they were when it ran, so the same address in two banks is two places.
+// Code below $8000 (work ram, cart ram) is counted by address.
+class CpuProfiler : public NesObject
+{
+private:
+    struct Count
+    {
+        u64 Instructions;
+        u64 Cycles;
+    };
+
+    struct Place
+    {
+        Count Counts;
+        u16 Address; // where it last ran
+    };
+
+public:
+    CpuProfiler(Rom* rom, IMapper* mapper, MemoryMap* mem);
+
+public:
+    DELEGATE_NESOBJECT_REFCOUNTING();
+
+    // Where the instruction at pc is counted, looked up before it runs as it
+    // may switch banks
+    u32 PlaceOf(u16 pc)
+    {
+        return pc >= 0x8000 ? _mapper->prg_rom_offset(pc) : _romSize + pc;
+    }
+
+    void Record(u32 place, u16 pc, u8 op, u32 cycles)
+    {
+        Place& counted = _places[place];
+        counted.Counts.Instructions++;
+        counted.Counts.Cycles += cycles;
+        counted.Address = pc;
+
+        _opcodes[op].Instructions++;
+        _opcodes[op].Cycles += cycles;
+    }
+
+    void Clear();
+
+    // The top places by cycles with their disassembly, cycles per 8KB
+    // bank of PrgRom and every opcode that ran, as text
+    void Report(std::ostream& out, u32 top);
+
+private:
+    void Disassemble(u32 place, u16 pc, std::string& text);
+    u8 LoadPlace(u32 place, u16 offset);
+
+private:
+    NPtr<Rom> _rom;
+    NPtr<IMapper> _mapper;
+    NPtr<MemoryMap> _mem;
+    u32 _romSize;
+
+    // PrgRom offsets, then cpu addresses below $8000
+    std::vector<Place> _places;
+    Count _opcodes[0x100];
+};
\ No newline at end of file
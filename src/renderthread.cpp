@@ -0,0 +1,125 @@
+#include "stdafx.h"
+#include "renderthread.h"
+#include "rom.h"
+
+RenderThread::RenderThread(IMapper* mapper)
+    : _mapper(mapper)
+    , _ppu(new Ppu(mapper))
+    , _screen(SCREEN_WIDTH * SCREEN_HEIGHT * 4)
+    , _next(0)
+    , _exit(false)
+    , _pending(nullptr)
+    , _untaken(false)
+    , _thread(&RenderThread::Run, this)
+{
+}
+
+RenderThread::~RenderThread()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _exit = true;
+    }
+    _wake.notify_one();
+    _thread.join();
+}
+
+bool RenderThread::Create(Rom* rom, RenderThread** thread)
+{
+    *thread = nullptr;
+
+    NPtr<IMapper> mapper;
+    if (!IMapper::CreateMapper(rom, &mapper))
+    {
+        return false;
+    }
+
+    *thread = new RenderThread(mapper);
+    return true;
+}
+
+void RenderThread::Submit()
+{
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _drawn.wait(lock, [this] { return _pending == nullptr; });
+        _pending = &_logs[_next];
+        _untaken = false;
+    }
+    _wake.notify_one();
+
+    _next ^= 1;
+}
+
+bool RenderThread::TakeFrame(u8 screen[])
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _drawn.wait(lock, [this] { return _pending == nullptr; });
+    if (!_untaken)
+    {
+        return false;
+    }
+
+    memcpy(screen, _screen.data(), _screen.size());
+    _untaken = false;
+    return true;
+}
+
+void RenderThread::Run()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    for (;;)
+    {
+        _wake.wait(lock, [this] { return _exit || _pending != nullptr; });
+        if (_exit)
+        {
+            break;
+        }
+
+        // The emulation thread only touches the other log and waits for
+        // _screen, so the drawing can happen unlocked
+        PpuFrameLog* log = _pending;
+        lock.unlock();
+        Replay(*log);
+        lock.lock();
+
+        _pending = nullptr;
+        _untaken = true;
+        _drawn.notify_all();
+    }
+}
+
+void RenderThread::Replay(PpuFrameLog& log)
+{
+    log.Start.Rewind();
+    _ppu->LoadState(log.Start);
+    _mapper->LoadState(log.Start);
+
+    PpuStepResult result;
+    u32 cycle = 0;
+    for (const PpuAccessRecord& record : log.Accesses)
+    {
+        for (; cycle < record.Cycle; cycle++)
+        {
+            _ppu->Step(result, _screen.data());
+        }
+
+        switch (record.Access)
+        {
+        case PpuAccess::Read:
+            _ppu->loadb(record.Addr);
+            break;
+        case PpuAccess::Write:
+            _ppu->storeb(record.Addr, record.Val);
+            break;
+        case PpuAccess::MapperWrite:
+            _mapper->prg_storeb(record.Addr, record.Val);
+            break;
+        }
+    }
+
+    for (; cycle < log.Cycles; cycle++)
+    {
+        _ppu->Step(result, _screen.data());
+    }
+}
\ No newline at end of file
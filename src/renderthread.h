@@ -0,0 +1,64 @@
+#pragma once
+
+#include <condition_variable>
+#include <thread>
+
+#include "ppu.h"
+
+// Draws frames on a thread of its own, a frame behind the emulation.
+// The emulation thread runs a frame without drawing it, recording the ppu
+// state it started from and every access that changes what the ppu shows
+// (see PpuFrameLog). This thread replays the log on its own Ppu and mapper,
+// drawing that frame while the emulation thread runs the next one.
+// Sprite 0 hit, status reads and mapper irqs are still worked out on the
+// emulation thread, the replay's own versions of them go nowhere.
+class RenderThread : public NesObject
+{
+private:
+    RenderThread(IMapper* mapper);
+
+public:
+    virtual ~RenderThread();
+
+public:
+    DELEGATE_NESOBJECT_REFCOUNTING();
+
+    // The render thread gets its own mapper for rom, which must be the rom the
+    // frames are recorded from
+    static bool Create(Rom* rom, RenderThread** thread);
+
+    // The log to record the next frame into. It belongs to the emulation
+    // thread until Submit.
+    PpuFrameLog& NextLog() { return _logs[_next]; }
+
+    // Start drawing the frame in NextLog. Waits for the frame before it.
+    void Submit();
+
+    // Wait for the last submitted frame to be drawn and copy it to screen.
+    // returns: false, leaving screen alone, if there is no frame that hasn't
+    // been taken already
+    bool TakeFrame(u8 screen[]);
+
+private:
+    void Run();
+    void Replay(PpuFrameLog& log);
+
+private:
+    NPtr<IMapper> _mapper;
+    NPtr<Ppu> _ppu;
+    std::vector<u8> _screen;
+
+    // One being recorded while the other is drawn
+    PpuFrameLog _logs[2];
+    u32 _next;
+
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::condition_variable _drawn;
+    bool _exit;
+    PpuFrameLog* _pending; // submitted and not drawn yet
+    bool _untaken; // _screen has a frame TakeFrame hasn't copied
+
+    // Last so it starts after everything above is initialized
+    std::thread _thread;
+};
\ No newline at end of file
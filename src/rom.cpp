@@ -7,14 +7,17 @@ Rom::Rom(IRomFile* romFile)
     : _romFile(romFile)
     , PrgRom(0)
     , ChrRom(0)
+    , Hash(0)
+    , _savedPrgRamHash(0)
 {
 }
 
 Rom::~Rom()
 {
-    // destructor is probably not the best place for IO
-    // but here it goes for now
-    if (Header.HasSaveRam())
+    // The Nes normally hands the battery ram to its persistence worker before
+    // this, in which case there is nothing left to write here
+    std::vector<u8> data;
+    if (TakeSaveGame(data))
     {
         SaveGame();
     }
@@ -67,6 +70,7 @@ bool Rom::Load()
         if (Header.HasSaveRam())
         {
             LoadGame();
+            _savedPrgRamHash = PrgRamHash.Value(&PrgRam[0], PrgRam.size());
         }
 
         if (Header.PrgRomSize > 0)
@@ -80,6 +84,11 @@ bool Rom::Load()
             ChrRom.resize(Header.ChrRomSize * CHR_ROM_BANK_SIZE);
             stream->ReadBytes((u8*)&ChrRom[0], CHR_ROM_BANK_SIZE * Header.ChrRomSize);
         }
+
+        HashStream hash;
+        hash.write((char*)PrgRom.data(), PrgRom.size());
+        hash.write((char*)ChrRom.data(), ChrRom.size());
+        Hash = hash.Hash();
         return true;
     }
     else
@@ -89,14 +98,24 @@ bool Rom::Load()
     }
 }
 
-void Rom::SaveState(std::ofstream& ofs)
+void Rom::Reset(bool hard)
 {
-    ofs.write((char*)&PrgRam[0], PrgRam.size());
+    if (hard && !Header.HasSaveRam())
+    {
+        memset((void*)&PrgRam[0], 0, PrgRam.size());
+        PrgRamHash.Invalidate();
+    }
 }
 
-void Rom::LoadState(std::ifstream& ifs)
+void Rom::SaveState(std::ostream& ofs)
+{
+    Util::WriteBlock(&PrgRam[0], PrgRam.size(), PrgRamHash, ofs);
+}
+
+void Rom::LoadState(std::istream& ifs)
 {
     ifs.read((char*)&PrgRam[0], PrgRam.size());
+    PrgRamHash.Invalidate();
 }
 
 void Rom::SaveGame()
@@ -114,5 +133,24 @@ void Rom::LoadGame()
     if (_romFile->GetLoadGameStream(&stream))
     {
         stream->ReadBytes(&PrgRam[0], PrgRam.size());
+        PrgRamHash.Invalidate();
     }
+}
+
+bool Rom::TakeSaveGame(std::vector<u8>& data)
+{
+    if (!Header.HasSaveRam())
+    {
+        return false;
+    }
+
+    u64 hash = PrgRamHash.Value(&PrgRam[0], PrgRam.size());
+    if (hash == _savedPrgRamHash)
+    {
+        return false;
+    }
+
+    data.assign(PrgRam.begin(), PrgRam.end());
+    _savedPrgRamHash = hash;
+    return true;
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "mem.h"
+#include "persist.h"
 
 #include <vector>
 
@@ -87,8 +88,25 @@ public:
     DELEGATE_NESOBJECT_REFCOUNTING();
 
 public:
-    virtual void SaveState(std::ofstream& ofs);
-    virtual void LoadState(std::ifstream& ifs);
+    virtual void SaveState(std::ostream& ofs);
+    virtual void LoadState(std::istream& ifs);
+
+    // A hard reset clears cart ram, unless it has a battery. Cart ram belongs
+    // to the game rather than the mapper, so the extra mappers the renderers
+    // make over the same Rom leave it alone.
+    void Reset(bool hard);
+
+    // Copies battery backed PrgRam if it has changed since it was loaded or last taken
+    bool TakeSaveGame(std::vector<u8>& data);
+
+    IRomFile* File() { return _romFile; }
+
+    // Mappers store to PrgRam through here to keep the state hash current
+    void StorePrgRam(u32 addr, u8 val)
+    {
+        PrgRamHash.Update(addr, PrgRam[addr], val);
+        PrgRam[addr] = val;
+    }
 
 private:
     bool Load();
@@ -100,10 +118,17 @@ public:
     INesHeader Header;
     std::vector<u8> PrgRom;
     std::vector<u8> PrgRam;
+    BlockHash PrgRamHash;
     std::vector<u8> ChrRom;
 
+    // Hash of PrgRom and ChrRom, identifies the game a save state belongs to
+    u64 Hash;
+
 private:
     NPtr<IRomFile> _romFile;
+
+    // PrgRamHash of the battery ram as it was last persisted
+    u64 _savedPrgRamHash;
 };
 
 // TODO: These std stream implementations will be used by save state as well, so move them somewhere more accessible
@@ -188,6 +213,8 @@ class StdStreamRomFile : public IRomFile, public NesObject
 public:
     StdStreamRomFile(const char* romPath)
         : _romPath(romPath)
+        , _saveGamePath(fs::path(romPath).replace_extension("sav").string())
+        , _saveStatePath(fs::path(romPath).replace_extension("ns").string())
     {
     }
 
@@ -200,17 +227,105 @@ public:
         return StdReadStream::Create(_romPath, stream);
     }
 
-    // TOOD: Path transfomration for these
+    // Battery ram and save states live next to the rom as .sav and .ns
     bool GetSaveGameStream(IWriteStream** stream)
     {
-        return false;
+        return AtomicFileWriteStream::Create(_saveGamePath.c_str(), stream);
     }
 
     bool GetLoadGameStream(IReadStream** stream)
     {
-        return false;
+        return StdReadStream::Create(_saveGamePath.c_str(), stream);
+    }
+
+    bool GetSaveStateStream(IWriteStream** stream)
+    {
+        return AtomicFileWriteStream::Create(_saveStatePath.c_str(), stream);
+    }
+
+    bool GetLoadStateStream(IReadStream** stream)
+    {
+        return StdReadStream::Create(_saveStatePath.c_str(), stream);
     }
 
 private:
     const char* _romPath;
+    std::string _saveGamePath;
+    std::string _saveStatePath;
 };
+
+
+// A rom read into memory once and shared by any number of instances, which
+// may be on different threads. There is nowhere to keep battery ram or save
+// states, so nothing is ever written next to the rom.
+class MemoryRomFile : public IRomFile, public NesObject
+{
+private:
+    class Stream : public IReadStream, public NesObject
+    {
+    public:
+        Stream(MemoryRomFile* file)
+            : _file(file)
+            , _pos(0)
+        {
+        }
+
+    public:
+        DELEGATE_NESOBJECT_REFCOUNTING();
+
+        int ReadBytes(u8* buf, int count)
+        {
+            size_t available = _file->_image.size() - _pos;
+            size_t read = (size_t)count < available ? (size_t)count : available;
+            if (read > 0)
+            {
+                memcpy(buf, &_file->_image[_pos], read);
+            }
+            _pos += read;
+            return (int)read;
+        }
+
+    private:
+        NPtr<MemoryRomFile> _file;
+        size_t _pos;
+    };
+
+    MemoryRomFile(std::vector<u8>&& image)
+        : _image(std::move(image))
+    {
+    }
+
+public:
+    // returns: false if romPath can't be opened, for the caller to report
+    static bool Create(const char* romPath, MemoryRomFile** file)
+    {
+        std::ifstream stream(romPath, std::ios::binary);
+        if (!stream.is_open())
+        {
+            *file = nullptr;
+            return false;
+        }
+
+        std::vector<u8> image((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+        *file = new MemoryRomFile(std::move(image));
+        return true;
+    }
+
+public:
+    DELEGATE_NESOBJECT_REFCOUNTING();
+
+public:
+    bool GetRomFileStream(IReadStream** stream)
+    {
+        *stream = new Stream(this);
+        return true;
+    }
+
+    bool GetSaveGameStream(IWriteStream** stream) { return false; }
+    bool GetLoadGameStream(IReadStream** stream) { return false; }
+    bool GetSaveStateStream(IWriteStream** stream) { return false; }
+    bool GetLoadStateStream(IReadStream** stream) { return false; }
+
+private:
+    const std::vector<u8> _image;
+};
\ No newline at end of file
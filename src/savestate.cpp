@@ -0,0 +1,335 @@
+#include "stdafx.h"
+#include "savestate.h"
+
+#include <algorithm>
+
+static u32 Read32(const u8* p)
+{
+    return (u32)p[0] | ((u32)p[1] << 8) | ((u32)p[2] << 16) | ((u32)p[3] << 24);
+}
+
+static void Put16(u16 val, std::vector<u8>& dst)
+{
+    dst.push_back((u8)val);
+    dst.push_back((u8)(val >> 8));
+}
+
+static void Put32(u32 val, std::vector<u8>& dst)
+{
+    Put16((u16)val, dst);
+    Put16((u16)(val >> 16), dst);
+}
+
+static void Put64(u64 val, std::vector<u8>& dst)
+{
+    Put32((u32)val, dst);
+    Put32((u32)(val >> 32), dst);
+}
+
+static u64 Read64(const u8* p)
+{
+    return (u64)Read32(p) | ((u64)Read32(p + 4) << 32);
+}
+
+// LZ Codec
+
+void LzCodec::WriteLength(size_t length, std::vector<u8>& dst)
+{
+    // The token holds up to 15, the rest follows in bytes of 255 and a remainder
+    for (length -= 15; length >= 255; length -= 255)
+    {
+        dst.push_back(255);
+    }
+    dst.push_back((u8)length);
+}
+
+bool LzCodec::ReadLength(const u8* src, size_t srcSize, size_t& pos, size_t& length)
+{
+    u8 b;
+    do
+    {
+        if (pos >= srcSize)
+        {
+            return false;
+        }
+        b = src[pos++];
+        length += b;
+    } while (b == 255);
+    return true;
+}
+
+void LzCodec::Compress(const u8* src, size_t size, std::vector<u8>& dst)
+{
+    // Last position each 4 byte sequence was seen at
+    u32 table[1 << HashBits] = {};
+
+    size_t anchor = 0;
+    size_t pos = 0;
+    while (pos + MinMatch <= size)
+    {
+        u32 seq = Read32(src + pos);
+        u32 h = (seq * 2654435761u) >> (32 - HashBits);
+        size_t candidate = table[h];
+        table[h] = (u32)pos;
+
+        if (candidate >= pos || pos - candidate > MaxOffset || Read32(src + candidate) != seq)
+        {
+            // Step faster through data that isn't matching
+            pos += 1 + ((pos - anchor) >> 6);
+            continue;
+        }
+
+        size_t length = MinMatch;
+        while (pos + length < size && src[candidate + length] == src[pos + length])
+        {
+            length++;
+        }
+
+        size_t literals = pos - anchor;
+        size_t matchLength = length - MinMatch;
+        dst.push_back((u8)((std::min<size_t>(literals, 15) << 4) | std::min<size_t>(matchLength, 15)));
+        if (literals >= 15)
+        {
+            WriteLength(literals, dst);
+        }
+        dst.insert(dst.end(), src + anchor, src + pos);
+        Put16((u16)(pos - candidate), dst);
+        if (matchLength >= 15)
+        {
+            WriteLength(matchLength, dst);
+        }
+
+        pos += length;
+        anchor = pos;
+    }
+
+    // The last sequence is just literals
+    size_t literals = size - anchor;
+    dst.push_back((u8)(std::min<size_t>(literals, 15) << 4));
+    if (literals >= 15)
+    {
+        WriteLength(literals, dst);
+    }
+    dst.insert(dst.end(), src + anchor, src + size);
+}
+
+bool LzCodec::Decompress(const u8* src, size_t srcSize, u8* dst, size_t size)
+{
+    size_t in = 0;
+    size_t out = 0;
+    while (in < srcSize)
+    {
+        u8 token = src[in++];
+
+        size_t literals = token >> 4;
+        if (literals == 15 && !ReadLength(src, srcSize, in, literals))
+        {
+            return false;
+        }
+        if (literals > srcSize - in || literals > size - out)
+        {
+            return false;
+        }
+        if (literals > 0)
+        {
+            memcpy(dst + out, src + in, literals);
+        }
+        in += literals;
+        out += literals;
+
+        if (in == srcSize)
+        {
+            break;
+        }
+
+        if (srcSize - in < 2)
+        {
+            return false;
+        }
+        size_t offset = (size_t)src[in] | ((size_t)src[in + 1] << 8);
+        in += 2;
+
+        size_t length = token & 0x0f;
+        if (length == 15 && !ReadLength(src, srcSize, in, length))
+        {
+            return false;
+        }
+        length += MinMatch;
+
+        if (offset == 0 || offset > out || length > size - out)
+        {
+            return false;
+        }
+
+        // Matches can overlap what they produce, runs of zeros are offset 1
+        const u8* from = dst + out - offset;
+        if (offset >= length)
+        {
+            memcpy(dst + out, from, length);
+        }
+        else
+        {
+            for (size_t i = 0; i < length; i++)
+            {
+                dst[out + i] = from[i];
+            }
+        }
+        out += length;
+    }
+
+    return out == size;
+}
+
+// State File
+
+void StateFile::Write(const StateFileHeader& header, const StateChunk* chunks, u32 count, std::vector<u8>& data)
+{
+    data.clear();
+    data.insert(data.end(), { 'N', 'E', 'S', 'S' });
+    Put16(Version, data);
+    Put16(header.Mapper, data);
+    Put64(header.RomHash, data);
+
+    MemoryStream state;
+    for (u32 i = 0; i < count; i++)
+    {
+        state.Clear();
+        chunks[i].Component->SaveState(state);
+
+        size_t start = data.size();
+        data.insert(data.end(), chunks[i].Id, chunks[i].Id + 4);
+        Put32((u32)state.Size(), data);
+        Put32(0, data);
+        data.push_back((u8)Codec::Lz);
+
+        size_t compressedStart = data.size();
+        LzCodec::Compress(state.Data(), state.Size(), data);
+
+        // Keep whichever is smaller
+        if (data.size() - compressedStart >= state.Size())
+        {
+            data.resize(compressedStart);
+            data.insert(data.end(), state.Data(), state.Data() + state.Size());
+            data[start + 12] = (u8)Codec::Raw;
+        }
+
+        u32 stored = (u32)(data.size() - compressedStart);
+        for (int b = 0; b < 4; b++)
+        {
+            data[start + 8 + b] = (u8)(stored >> (b * 8));
+        }
+    }
+}
+
+bool StateFile::Read(const StateFileHeader& header, const StateChunk* chunks, u32 count, const u8* data, size_t size)
+{
+    if (size < HeaderSize || memcmp(data, "NESS", 4) != 0)
+    {
+        printf("Not a save state.\n");
+        return false;
+    }
+
+    u16 version = (u16)(data[4] | (data[5] << 8));
+    u16 mapper = (u16)(data[6] | (data[7] << 8));
+    if (version > Version)
+    {
+        printf("Save state is from a newer version.\n");
+        return false;
+    }
+
+    if (mapper != header.Mapper || Read64(data + 8) != header.RomHash)
+    {
+        printf("Save state doesn't match this ROM.\n");
+        return false;
+    }
+
+    // Decode everything before touching the machine
+    std::vector<std::vector<u8>> states(count);
+    std::vector<bool> found(count, false);
+    MemoryStream current;
+
+    size_t pos = HeaderSize;
+    while (pos < size)
+    {
+        if (size - pos < ChunkHeaderSize)
+        {
+            printf("Save state is corrupt.\n");
+            return false;
+        }
+
+        const u8* id = data + pos;
+        u32 rawSize = Read32(data + pos + 4);
+        u32 storedSize = Read32(data + pos + 8);
+        Codec codec = (Codec)data[pos + 12];
+        pos += ChunkHeaderSize;
+
+        if (storedSize > size - pos)
+        {
+            printf("Save state is corrupt.\n");
+            return false;
+        }
+
+        const u8* stored = data + pos;
+        pos += storedSize;
+
+        u32 i = 0;
+        while (i < count && memcmp(id, chunks[i].Id, 4) != 0)
+        {
+            i++;
+        }
+
+        // Something a later version added
+        if (i == count)
+        {
+            continue;
+        }
+
+        // Components always save the same amount for a given game
+        current.Clear();
+        chunks[i].Component->SaveState(current);
+        if (rawSize != current.Size())
+        {
+            printf("Save state doesn't match this ROM.\n");
+            return false;
+        }
+
+        states[i].resize(rawSize);
+        bool ok = false;
+        if (codec == Codec::Raw)
+        {
+            ok = storedSize == rawSize;
+            if (ok)
+            {
+                memcpy(states[i].data(), stored, rawSize);
+            }
+        }
+        else if (codec == Codec::Lz)
+        {
+            ok = LzCodec::Decompress(stored, storedSize, states[i].data(), rawSize);
+        }
+
+        if (!ok)
+        {
+            printf("Save state is corrupt.\n");
+            return false;
+        }
+        found[i] = true;
+    }
+
+    for (u32 i = 0; i < count; i++)
+    {
+        if (!found[i])
+        {
+            printf("Save state is missing %.4s.\n", chunks[i].Id);
+            return false;
+        }
+    }
+
+    for (u32 i = 0; i < count; i++)
+    {
+        current.Clear();
+        current.write((char*)states[i].data(), states[i].size());
+        chunks[i].Component->LoadState(current);
+    }
+    return true;
+}
\ No newline at end of file
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "interfaces.h"
+
+// Small LZ77 codec for save states
+// Same idea as LZ4: a sequence is a token, literals, a 16-bit back reference
+// and the match length. States are mostly zero-filled ram, which comes out
+// as a handful of long overlapping matches.
+class LzCodec
+{
+public:
+    // Compress size bytes of src onto the end of dst
+    static void Compress(const u8* src, size_t size, std::vector<u8>& dst);
+
+    // returns: false if src is corrupt or doesn't decompress to exactly size bytes
+    static bool Decompress(const u8* src, size_t srcSize, u8* dst, size_t size);
+
+private:
+    static const u32 MinMatch = 4;
+    static const u32 HashBits = 12;
+    static const u32 MaxOffset = 0xffff;
+
+    static void WriteLength(size_t length, std::vector<u8>& dst);
+    static bool ReadLength(const u8* src, size_t srcSize, size_t& pos, size_t& length);
+};
+
+// A component of the machine that is stored as its own chunk
+struct StateChunk
+{
+    // Four characters, space padded
+    const char* Id;
+    ISaveState* Component;
+};
+
+struct StateFileHeader
+{
+    u64 RomHash;
+    u16 Mapper;
+};
+
+// Save state file format
+// Unlike the raw state used by run-ahead and netplay, files have to survive
+// emulator updates and sit in archives by the million, so they are versioned,
+// split into one compressed chunk per component and tagged with the game.
+//
+//   "NESS" u16 version u16 mapper u64 rom hash
+//   then per chunk: char id[4] u32 raw size u32 stored size u8 codec, data
+//
+// All values are little endian. Readers skip chunks they don't know.
+class StateFile
+{
+public:
+    static const u16 Version = 1;
+
+    static void Write(const StateFileHeader& header, const StateChunk* chunks, u32 count, std::vector<u8>& data);
+
+    // Nothing is loaded unless the whole file checks out: right game, every
+    // chunk present and the size the component expects.
+    static bool Read(const StateFileHeader& header, const StateChunk* chunks, u32 count, const u8* data, size_t size);
+
+private:
+    enum class Codec : u8
+    {
+        Raw = 0,
+        Lz = 1,
+    };
+
+    static const size_t HeaderSize = 16;
+    static const size_t ChunkHeaderSize = 13;
+};
\ No newline at end of file
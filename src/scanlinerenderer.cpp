@@ -0,0 +1,96 @@
+#include "stdafx.h"
+#include "scanlinerenderer.h"
+#include "rom.h"
+
+// Chr and mirroring straight from a recording
+class RecordedMapper : public IMapper, public NesObject
+{
+public:
+    RecordedMapper()
+        : _chr(nullptr)
+    {
+    }
+
+public:
+    DELEGATE_NESOBJECT_REFCOUNTING();
+
+    u8 prg_loadb(u16 addr) { return 0; }
+    u32 prg_rom_offset(u16 addr) { return 0; }
+    void prg_storeb(u16 addr, u8 val) { }
+    u8 chr_loadb(u16 addr) { return _chr[addr]; }
+    void chr_storeb(u16 addr, u8 val) { }
+    u32 chr_rom_offset(u16 addr) { return 0; }
+
+    void Use(const PpuMemory& memory)
+    {
+        _chr = memory.Chr;
+        Mirroring = memory.Mirroring;
+    }
+
+private:
+    const u8* _chr;
+};
+
+// A thread's share of the screen
+class ScanlineRenderer::Band
+{
+public:
+    Band()
+        : _mapper(new RecordedMapper())
+        , _ppu(new Ppu(_mapper))
+    {
+    }
+
+    void Draw(const PpuScanlines& scanlines, u16 begin, u16 end, u8 screen[])
+    {
+        // Memory is only loaded when it changes, which is rarely more than a
+        // few times a frame
+        const PpuMemory* current = nullptr;
+        for (u16 scanline = begin; scanline < end; scanline++)
+        {
+            const PpuScanline& line = scanlines.Lines[scanline];
+            if (line.Drawn)
+            {
+                continue;
+            }
+
+            const PpuMemory& memory = scanlines.Memory[line.Memory];
+            if (&memory != current)
+            {
+                _mapper->Use(memory);
+                _ppu->GetVRam().Load(memory.Nametables, memory.Palette);
+                current = &memory;
+            }
+
+            _ppu->DrawRecordedScanline(scanline, line, screen);
+        }
+    }
+
+private:
+    NPtr<RecordedMapper> _mapper;
+    NPtr<Ppu> _ppu;
+};
+
+ScanlineRenderer::ScanlineRenderer(unsigned int threads)
+    : _pool(threads)
+{
+    for (unsigned int i = 0; i < _pool.ThreadCount(); i++)
+    {
+        _bands.emplace_back(new Band());
+    }
+}
+
+ScanlineRenderer::~ScanlineRenderer()
+{
+}
+
+void ScanlineRenderer::Draw(u8 screen[])
+{
+    u32 bands = (u32)_bands.size();
+    _pool.ParallelFor(bands, 1, [this, bands, screen](u32 band)
+    {
+        u16 begin = (u16)(SCREEN_HEIGHT * band / bands);
+        u16 end = (u16)(SCREEN_HEIGHT * (band + 1) / bands);
+        _bands[band]->Draw(_scanlines, begin, end, screen);
+    });
+}
\ No newline at end of file
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "ppu.h"
+#include "threadpool.h"
+
+// Draws a frame's visible scanlines in parallel once the frame has run.
+// The ppu records each line's scroll, sprites and memory as the frame runs
+// instead of drawing it (see PpuScanlines), then the lines are split into
+// one band per thread. Every band has a Ppu of its own that draws from the
+// recording, so the pixels are the ones the ppu would have drawn itself.
+class ScanlineRenderer : public NesObject
+{
+public:
+    // threads: 0 for one per hardware thread
+    ScanlineRenderer(unsigned int threads);
+    virtual ~ScanlineRenderer();
+
+public:
+    DELEGATE_NESOBJECT_REFCOUNTING();
+
+    unsigned int ThreadCount() { return _pool.ThreadCount(); }
+
+    // For the ppu to record the next frame into
+    PpuScanlines& Scanlines() { return _scanlines; }
+
+    // Draw the recorded lines the ppu didn't draw itself
+    void Draw(u8 screen[]);
+
+private:
+    class Band;
+
+private:
+    WorkStealingPool _pool;
+    std::vector<std::unique_ptr<Band>> _bands;
+    PpuScanlines _scanlines;
+};
\ No newline at end of file
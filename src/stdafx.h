@@ -8,6 +8,8 @@
 // C includes
 #define _USE_MATH_DEFINES
 #include <math.h>
+#include <string.h>
+#include <stdint.h>
 
 // std C++ includes
 #include <iostream>
@@ -25,6 +27,13 @@
 #include <experimental/filesystem>
 namespace fs = std::experimental::filesystem;
 
+// The command line tools also build with gcc and clang
+#if !defined(_MSC_VER)
+#define __debugbreak() __builtin_trap()
+#define __declspec(x) __attribute__((x))
+#define printf_s printf
+#endif
+
 #include "../include/nptr.h"
 #include "../include/object.h"
 #include "types.h"
@@ -0,0 +1,150 @@
+#include "stdafx.h"
+#include "threadpool.h"
+
+#include <algorithm>
+
+// The pool the current thread works for, so tasks can queue follow-up work locally
+static thread_local WorkStealingPool* t_pool = nullptr;
+static thread_local unsigned int t_worker = 0;
+
+WorkStealingPool::WorkStealingPool(unsigned int threads)
+    : _nextWorker(0)
+    , _queued(0)
+    , _unfinished(0)
+    , _exit(false)
+{
+    if (threads == 0)
+    {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    for (unsigned int i = 0; i < threads; i++)
+    {
+        _workers.emplace_back(new Worker());
+    }
+
+    for (unsigned int i = 0; i < threads; i++)
+    {
+        _threads.emplace_back(&WorkStealingPool::Run, this, i);
+    }
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _exit = true;
+    }
+    _wake.notify_all();
+
+    for (std::thread& thread : _threads)
+    {
+        thread.join();
+    }
+}
+
+void WorkStealingPool::Submit(Task task)
+{
+    unsigned int index = (t_pool == this)
+        ? t_worker
+        : _nextWorker++ % (u32)_workers.size();
+
+    _unfinished++;
+    {
+        Worker& worker = *_workers[index];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.tasks.push_back(std::move(task));
+    }
+
+    // Counted under the lock so a worker about to sleep can't miss it
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _queued++;
+    }
+    _wake.notify_one();
+}
+
+void WorkStealingPool::Wait()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _done.wait(lock, [this] { return _unfinished == 0; });
+}
+
+void WorkStealingPool::ParallelFor(u32 count, u32 grain, const std::function<void(u32)>& body)
+{
+    grain = std::max(1u, grain);
+    for (u32 start = 0; start < count; start += grain)
+    {
+        u32 end = std::min(count, start + grain);
+        Submit([&body, start, end]
+        {
+            for (u32 i = start; i < end; i++)
+            {
+                body(i);
+            }
+        });
+    }
+    Wait();
+}
+
+bool WorkStealingPool::TakeTask(unsigned int index, Task& task)
+{
+    // Newest from our own queue, it is the most likely to be in cache
+    {
+        Worker& worker = *_workers[index];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        if (!worker.tasks.empty())
+        {
+            task = std::move(worker.tasks.back());
+            worker.tasks.pop_back();
+            return true;
+        }
+    }
+
+    // Oldest from someone else's
+    u32 count = (u32)_workers.size();
+    for (u32 i = 1; i < count; i++)
+    {
+        Worker& victim = *_workers[(index + i) % count];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty())
+        {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void WorkStealingPool::Run(unsigned int index)
+{
+    t_pool = this;
+    t_worker = index;
+
+    Task task;
+    for (;;)
+    {
+        if (TakeTask(index, task))
+        {
+            _queued--;
+            task();
+            task = nullptr;
+
+            if (--_unfinished == 0)
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _done.notify_all();
+            }
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(_mutex);
+        _wake.wait(lock, [this] { return _exit || _queued > 0; });
+        if (_exit && _queued == 0)
+        {
+            break;
+        }
+    }
+}
\ No newline at end of file
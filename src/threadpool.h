@@ -0,0 +1,62 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <thread>
+
+// Work-stealing thread pool
+// Each worker has its own queue. A worker takes its newest task first and,
+// once its queue is empty, steals the oldest task from another worker, so
+// uneven jobs (a few long runs among many short ones) still keep every core
+// busy without all the threads fighting over one queue.
+class WorkStealingPool
+{
+public:
+    typedef std::function<void()> Task;
+
+    // threads: number of workers, 0 for one per hardware thread
+    WorkStealingPool(unsigned int threads = 0);
+    ~WorkStealingPool();
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    unsigned int ThreadCount() { return (unsigned int)_threads.size(); }
+
+    // Queue a task. Tasks submitted from a worker go on that worker's own
+    // queue, others are spread across the workers.
+    void Submit(Task task);
+
+    // Wait for every submitted task to finish. Not for use from a task.
+    void Wait();
+
+    // Run body(i) for i in [0, count) across the pool and wait for it.
+    // Indices are handed out in batches of grain.
+    void ParallelFor(u32 count, u32 grain, const std::function<void(u32)>& body);
+
+private:
+    struct Worker
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    void Run(unsigned int index);
+    bool TakeTask(unsigned int index, Task& task);
+
+private:
+    std::vector<std::unique_ptr<Worker>> _workers;
+    std::vector<std::thread> _threads;
+    std::atomic<u32> _nextWorker;
+
+    // Tasks in the queues, and tasks queued or running.
+    // _queued is signed as a thief can take a task before it is counted.
+    std::atomic<int> _queued;
+    std::atomic<u32> _unfinished;
+
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::condition_variable _done;
+    bool _exit;
+};
\ No newline at end of file
@@ -0,0 +1,68 @@
+#include "stdafx.h"
+#include "trace.h"
+#include "diassembler.h"
+
+CpuTrace::CpuTrace(u32 count, Ppu* ppu, const u64* cpuCycles)
+    : _count(0)
+    , _ppu(ppu)
+    , _cpuCycles(cpuCycles)
+{
+    u64 size = 1;
+    while (size < count)
+    {
+        size <<= 1;
+    }
+
+    _records.resize((size_t)size);
+    _mask = size - 1;
+}
+
+void CpuTrace::Copy(u32 count, std::vector<TraceRecord>& records)
+{
+    u64 kept = _count < _records.size() ? _count : _records.size();
+    if (count > kept)
+    {
+        count = (u32)kept;
+    }
+
+    records.clear();
+    records.reserve(count);
+    for (u64 i = _count - count; i < _count; i++)
+    {
+        records.push_back(_records[i & _mask]);
+    }
+}
+
+void CpuTrace::Write(std::ostream& out, u32 count)
+{
+    std::vector<TraceRecord> records;
+    Copy(count, records);
+
+    char line[128];
+    for (const TraceRecord& record : records)
+    {
+        Format(record, line, sizeof(line));
+        out << line << '\n';
+    }
+}
+
+void CpuTrace::Format(const TraceRecord& record, char* line, size_t size)
+{
+    char bytes[DISASSEMBLY_TEXT_SIZE];
+    char instruction[DISASSEMBLY_TEXT_SIZE];
+    Disassembler::FormatBytes(record.Bytes, bytes);
+    Disassembler::Format(record.PC, record.Bytes, instruction);
+
+    snprintf(line, size, "%04X %-10s %-12s A:%02X X:%02X Y:%02X P:%02X S:%02X CYC:%llu SL:%u DOT:%u",
+        record.PC,
+        bytes,
+        instruction,
+        record.A,
+        record.X,
+        record.Y,
+        record.P,
+        record.S,
+        record.Cycle,
+        record.Scanline,
+        record.Dot);
+}
\ No newline at end of file
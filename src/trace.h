@@ -0,0 +1,80 @@
+#pragma once
+
+#include "cpu.h"
+#include "ppu.h"
+
+// One instruction as it was about to run
+struct TraceRecord
+{
+    u64 Cycle;     // cpu cycles since the machine was created
+    u16 PC;
+    u8 Bytes[3];   // as the cpu fetched them, past its length they mean nothing
+    u8 A;
+    u8 X;
+    u8 Y;
+    u8 P;
+    u8 S;
+    u16 Scanline;
+    u16 Dot;
+};
+
+// The last instructions the cpu ran, kept as they ran with nothing
+// formatted until they are written out. Costs a few nanoseconds per
+// instruction while it is set on the cpu and nothing when it isn't.
+class CpuTrace : public NesObject
+{
+public:
+    // Keeps at least count instructions, count is rounded up to a power of two.
+    // cpuCycles is the count of cycles the machine has run up to the
+    // current instruction, without the cpu's own Cycles.
+    CpuTrace(u32 count, Ppu* ppu, const u64* cpuCycles);
+
+public:
+    DELEGATE_NESOBJECT_REFCOUNTING();
+
+    // Before the instruction runs, RecordBytes fills in its bytes after
+    void Record(const CpuRegs& regs, u32 cycles)
+    {
+        TraceRecord& record = _records[_count & _mask];
+        _count++;
+
+        record.Cycle = *_cpuCycles + cycles;
+        record.PC = regs.PC;
+        record.A = regs.A;
+        record.X = regs.X;
+        record.Y = regs.Y;
+        record.P = regs.P;
+        record.S = regs.S;
+        record.Scanline = _ppu->Scanline();
+        record.Dot = _ppu->Dot();
+    }
+
+    // The bytes the cpu fetched for the last instruction recorded, so
+    // nothing is read through the mapper again
+    void RecordBytes(const u8* bytes)
+    {
+        TraceRecord& record = _records[(_count - 1) & _mask];
+        record.Bytes[0] = bytes[0];
+        record.Bytes[1] = bytes[1];
+        record.Bytes[2] = bytes[2];
+    }
+
+    void Clear() { _count = 0; }
+
+    // The last count instructions (or all of those kept), oldest first
+    void Copy(u32 count, std::vector<TraceRecord>& records);
+
+    // The last count instructions disassembled, a line each, oldest first
+    void Write(std::ostream& out, u32 count);
+
+    // One instruction as a line of text, without the newline
+    static void Format(const TraceRecord& record, char* line, size_t size);
+
+private:
+    std::vector<TraceRecord> _records;
+    u64 _mask;
+    u64 _count;
+
+    NPtr<Ppu> _ppu;
+    const u64* _cpuCycles;
+};
\ No newline at end of file
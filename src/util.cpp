@@ -1,55 +1,208 @@
 #include "stdafx.h"
 #include "util.h"
 
-void Util::WriteBytes(bool val, std::ofstream& ofs)
+void Util::WriteBytes(bool val, std::ostream& ofs)
 {
     u8 buf = val ? 0x01 : 0x00;
     ofs.write((char*)&buf, sizeof(buf));
 }
 
-void Util::WriteBytes(u8 val, std::ofstream& ofs)
+void Util::WriteBytes(u8 val, std::ostream& ofs)
 {
     ofs.write((char*)&val, sizeof(val));
 }
 
-void Util::WriteBytes(u16 val, std::ofstream& ofs)
+void Util::WriteBytes(u16 val, std::ostream& ofs)
 {
     ofs.write((char*)&val, sizeof(val));
 }
 
-void Util::WriteBytes(u32 val, std::ofstream& ofs)
+void Util::WriteBytes(u32 val, std::ostream& ofs)
 {
     ofs.write((char*)&val, sizeof(val));
 }
 
-void Util::WriteBytes(i32 val, std::ofstream& ofs)
+void Util::WriteBytes(i32 val, std::ostream& ofs)
 {
     ofs.write((char*)&val, sizeof(val));
 }
 
-void Util::ReadBytes(bool& val, std::ifstream& ifs)
+void Util::WriteBlock(const u8* data, size_t size, BlockHash& hash, std::ostream& ofs)
+{
+    if (HashStream* hashStream = dynamic_cast<HashStream*>(&ofs))
+    {
+        u64 value = hash.Value(data, size);
+        hashStream->write((char*)&value, sizeof(value));
+    }
+    else
+    {
+        ofs.write((char*)data, size);
+    }
+}
+
+void Util::ReadBytes(bool& val, std::istream& ifs)
 {
     u8 buf;
     ifs.read((char*)&buf, sizeof(buf));
     val = buf != 0 ? true : false;
 }
 
-void Util::ReadBytes(u8& val, std::ifstream& ifs)
+void Util::ReadBytes(u8& val, std::istream& ifs)
 {
     ifs.read((char*)&val, sizeof(val));
 }
 
-void Util::ReadBytes(u16& val, std::ifstream& ifs)
+void Util::ReadBytes(u16& val, std::istream& ifs)
 {
     ifs.read((char*)&val, sizeof(val));
 }
 
-void Util::ReadBytes(u32& val, std::ifstream& ifs)
+void Util::ReadBytes(u32& val, std::istream& ifs)
 {
     ifs.read((char*)&val, sizeof(val));
 }
 
-void Util::ReadBytes(i32& val, std::ifstream& ifs)
+void Util::ReadBytes(i32& val, std::istream& ifs)
 {
     ifs.read((char*)&val, sizeof(val));
+}
+
+MemoryStream::MemoryStream()
+    : std::iostream(&_buf)
+{
+}
+
+void MemoryStream::Clear()
+{
+    _buf.Clear();
+    clear();
+}
+
+void MemoryStream::Rewind()
+{
+    _buf.Rewind();
+    clear();
+}
+
+MemoryStream::Buffer::Buffer()
+    : _readPos(0)
+{
+}
+
+void MemoryStream::Buffer::Clear()
+{
+    _data.clear();
+    _readPos = 0;
+}
+
+void MemoryStream::Buffer::Rewind()
+{
+    _readPos = 0;
+}
+
+std::streamsize MemoryStream::Buffer::xsputn(const char* s, std::streamsize count)
+{
+    _data.insert(_data.end(), s, s + count);
+    return count;
+}
+
+MemoryStream::Buffer::int_type MemoryStream::Buffer::overflow(int_type c)
+{
+    if (!traits_type::eq_int_type(c, traits_type::eof()))
+    {
+        _data.push_back(traits_type::to_char_type(c));
+    }
+    return traits_type::not_eof(c);
+}
+
+std::streamsize MemoryStream::Buffer::xsgetn(char* s, std::streamsize count)
+{
+    size_t available = _data.size() - _readPos;
+    if ((size_t)count > available)
+    {
+        count = (std::streamsize)available;
+    }
+
+    memcpy(s, _data.data() + _readPos, (size_t)count);
+    _readPos += (size_t)count;
+    return count;
+}
+
+MemoryStream::Buffer::int_type MemoryStream::Buffer::underflow()
+{
+    if (_readPos >= _data.size())
+    {
+        return traits_type::eof();
+    }
+    return traits_type::to_int_type(_data[_readPos]);
+}
+
+MemoryStream::Buffer::int_type MemoryStream::Buffer::uflow()
+{
+    if (_readPos >= _data.size())
+    {
+        return traits_type::eof();
+    }
+    return traits_type::to_int_type(_data[_readPos++]);
+}
+
+BlockHash::BlockHash()
+    : _hash(0)
+    , _valid(false)
+{
+}
+
+u64 BlockHash::Value(const u8* data, size_t size)
+{
+    if (!_valid)
+    {
+        _hash = 0;
+        for (size_t i = 0; i < size; i++)
+        {
+            _hash += Mix(i, data[i]);
+        }
+        _valid = true;
+    }
+    return _hash;
+}
+
+HashStream::HashStream()
+    : std::ostream(&_buf)
+{
+}
+
+void HashStream::Clear()
+{
+    _buf.Clear();
+    clear();
+}
+
+HashStream::Buffer::Buffer()
+{
+    Clear();
+}
+
+void HashStream::Buffer::Clear()
+{
+    _hash = 0xcbf29ce484222325;
+}
+
+std::streamsize HashStream::Buffer::xsputn(const char* s, std::streamsize count)
+{
+    for (std::streamsize i = 0; i < count; i++)
+    {
+        _hash ^= (u8)s[i];
+        _hash *= 0x100000001b3;
+    }
+    return count;
+}
+
+HashStream::Buffer::int_type HashStream::Buffer::overflow(int_type c)
+{
+    if (!traits_type::eq_int_type(c, traits_type::eof()))
+    {
+        _hash ^= (u8)traits_type::to_char_type(c);
+        _hash *= 0x100000001b3;
+    }
+    return traits_type::not_eof(c);
 }
\ No newline at end of file
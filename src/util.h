@@ -1,17 +1,138 @@
 #pragma once
 
+class BlockHash;
+
 class Util
 {
 public:
-    static void WriteBytes(bool val, std::ofstream& ofs);
-    static void WriteBytes(u8 val, std::ofstream& ofs);
-    static void WriteBytes(u16 val, std::ofstream& ofs);
-    static void WriteBytes(u32 val, std::ofstream& ofs);
-    static void WriteBytes(i32 val, std::ofstream& ofs);
-
-    static void ReadBytes(bool& val, std::ifstream& ifs);
-    static void ReadBytes(u8& val, std::ifstream& ifs);
-    static void ReadBytes(u16& val, std::ifstream& ifs);
-    static void ReadBytes(u32& val, std::ifstream& ifs);
-    static void ReadBytes(i32& val, std::ifstream& ifs);
+    // Writes a block of memory to a save state.
+    // A HashStream gets the block's running hash instead of its contents.
+    static void WriteBlock(const u8* data, size_t size, BlockHash& hash, std::ostream& ofs);
+
+    static void WriteBytes(bool val, std::ostream& ofs);
+    static void WriteBytes(u8 val, std::ostream& ofs);
+    static void WriteBytes(u16 val, std::ostream& ofs);
+    static void WriteBytes(u32 val, std::ostream& ofs);
+    static void WriteBytes(i32 val, std::ostream& ofs);
+
+    static void ReadBytes(bool& val, std::istream& ifs);
+    static void ReadBytes(u8& val, std::istream& ifs);
+    static void ReadBytes(u16& val, std::istream& ifs);
+    static void ReadBytes(u32& val, std::istream& ifs);
+    static void ReadBytes(i32& val, std::istream& ifs);
+};
+
+// Growable in-memory stream for save states that never touch disk (run-ahead, rollback).
+// Clear() keeps the underlying storage, so once it has grown to the size of a state
+// snapshotting and restoring every frame doesn't allocate.
+class MemoryStream : public std::iostream
+{
+public:
+    MemoryStream();
+
+    // Discard the contents and start writing at the beginning
+    void Clear();
+
+    // Start reading from the beginning again
+    void Rewind();
+
+    const u8* Data() { return (u8*)_buf.Data(); }
+    size_t Size() { return _buf.Size(); }
+
+private:
+    class Buffer : public std::streambuf
+    {
+    public:
+        Buffer();
+
+        void Clear();
+        void Rewind();
+
+        const char* Data() { return _data.data(); }
+        size_t Size() { return _data.size(); }
+
+    protected:
+        std::streamsize xsputn(const char* s, std::streamsize count);
+        int_type overflow(int_type c);
+        std::streamsize xsgetn(char* s, std::streamsize count);
+        int_type underflow();
+        int_type uflow();
+
+    private:
+        std::vector<char> _data;
+        size_t _readPos;
+    };
+
+    Buffer _buf;
+};
+
+// Hash of a block of memory that is kept up to date as bytes are stored, so
+// hashing the machine state costs the bytes changed rather than the total size.
+// Each byte contributes a mix of its offset and value and the contributions are
+// summed, so one store is one subtract and one add.
+// Tracking starts on the first Value() call. Bulk changes (reset, load) just
+// Invalidate() and the next Value() hashes the whole block again.
+class BlockHash
+{
+public:
+    BlockHash();
+
+    // Call before a byte is stored
+    void Update(size_t offset, u8 oldVal, u8 newVal)
+    {
+        if (_valid && oldVal != newVal)
+        {
+            _hash += Mix(offset, newVal) - Mix(offset, oldVal);
+        }
+    }
+
+    void Invalidate() { _valid = false; }
+
+    u64 Value(const u8* data, size_t size);
+
+private:
+    static u64 Mix(size_t offset, u8 val)
+    {
+        // splitmix64 finalizer
+        u64 x = (((u64)offset << 8) | val) + 0x9e3779b97f4a7c15;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+        return x ^ (x >> 31);
+    }
+
+private:
+    u64 _hash;
+    bool _valid;
+};
+
+// Output stream that hashes what is written to it (64-bit FNV-1a) instead of storing it.
+// Saving state into one gives the state hash; see Util::WriteBlock.
+class HashStream : public std::ostream
+{
+public:
+    HashStream();
+
+    // Start a new hash
+    void Clear();
+
+    u64 Hash() { return _buf.Hash(); }
+
+private:
+    class Buffer : public std::streambuf
+    {
+    public:
+        Buffer();
+
+        void Clear();
+        u64 Hash() { return _hash; }
+
+    protected:
+        std::streamsize xsputn(const char* s, std::streamsize count);
+        int_type overflow(int_type c);
+
+    private:
+        u64 _hash;
+    };
+
+    Buffer _buf;
 };
\ No newline at end of file
@@ -0,0 +1,248 @@
+#include "stdafx.h"
+#include "vecenv.h"
+#include "nes.h"
+#include "rom.h"
+
+#include <algorithm>
+
+static const u32 ScreenWidth = 256;
+static const u32 ScreenHeight = 240;
+static const u16 WorkRamEnd = 0x2000;
+
+VecEnv::VecEnv(const NesVecEnvConfig& config)
+    : _pool(config.threads)
+    , _frameSkip(config.frameSkip)
+    , _downsample(config.downsample)
+    , _width(ScreenWidth / config.downsample)
+    , _height(ScreenHeight / config.downsample)
+    , _channels(config.grayscale ? 1 : 3)
+    , _ramAddresses(config.ramAddresses, config.ramAddresses + config.ramAddressCount)
+    , _maxEpisodeFrames(config.maxEpisodeFrames)
+    , _doneAddress(config.doneAddress)
+    , _doneMask(config.doneMask)
+    , _doneValue(config.doneValue)
+{
+}
+
+VecEnv::~VecEnv()
+{
+    for (std::unique_ptr<Instance>& instance : _instances)
+    {
+        // Create can fail part way through
+        if (instance != nullptr)
+        {
+            instance->nes->Dispose();
+        }
+    }
+}
+
+bool VecEnv::Create(const NesVecEnvConfig& config, VecEnv** env)
+{
+    *env = nullptr;
+
+    if (config.count == 0 || config.frameSkip == 0)
+    {
+        printf("VecEnv needs at least one instance and one frame per step\n");
+        return false;
+    }
+
+    if (config.downsample != 1 && config.downsample != 2 && config.downsample != 4)
+    {
+        printf("VecEnv downsample must be 1, 2 or 4\n");
+        return false;
+    }
+
+    if (config.ramAddressCount > 0 && config.ramAddresses == nullptr)
+    {
+        printf("VecEnv has a ram address count but no addresses\n");
+        return false;
+    }
+
+    for (unsigned int i = 0; i < config.ramAddressCount; i++)
+    {
+        if (config.ramAddresses[i] >= WorkRamEnd)
+        {
+            printf("VecEnv ram address $%04x is not work ram\n", config.ramAddresses[i]);
+            return false;
+        }
+    }
+
+    if (config.doneMask != 0 && config.doneAddress >= WorkRamEnd)
+    {
+        printf("VecEnv done address $%04x is not work ram\n", config.doneAddress);
+        return false;
+    }
+
+    NPtr<VecEnv> newEnv(new VecEnv(config));
+    newEnv->_instances.resize(config.count);
+    if (!newEnv->Init(config.romPath, config.statePath))
+    {
+        return false;
+    }
+
+    *env = newEnv.Detach();
+    return true;
+}
+
+bool VecEnv::Init(const char* romPath, const char* statePath)
+{
+    NPtr<MemoryRomFile> romFile;
+    if (!MemoryRomFile::Create(romPath, &romFile))
+    {
+        printf("Unable to open %s\n", romPath);
+        return false;
+    }
+
+    std::vector<u8> stateFile;
+    if (statePath != nullptr)
+    {
+        std::ifstream stream(statePath, std::ios::binary);
+        if (!stream.is_open())
+        {
+            printf("Unable to open %s\n", statePath);
+            return false;
+        }
+        stateFile.assign(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+    }
+
+    for (std::unique_ptr<Instance>& instance : _instances)
+    {
+        instance.reset(new Instance());
+        if (!Nes::Create(static_cast<IRomFile*>(romFile), nullptr, &instance->nes))
+        {
+            instance.reset();
+            return false;
+        }
+
+        if (!stateFile.empty() && !instance->nes->LoadStateFile(stateFile.data(), stateFile.size()))
+        {
+            return false;
+        }
+
+        // Kept raw so a reset is a plain load
+        instance->nes->SaveState(instance->start);
+        instance->controller = instance->nes->GetStandardController(0);
+        instance->episodeFrames = 0;
+        instance->screen.resize(ScreenWidth * ScreenHeight * 4);
+    }
+    return true;
+}
+
+void VecEnv::Reset(u8* observations, u8* ram)
+{
+    _pool.ParallelFor(Count(), 1, [this, observations, ram](u32 index)
+    {
+        ResetInstance(index);
+        WriteObservation(index, observations, ram);
+    });
+}
+
+void VecEnv::Step(const u8* actions, u8* observations, u8* ram, u8* done)
+{
+    // A few batches per thread keeps the cores even when some instances are slower
+    u32 grain = std::max(1u, Count() / (_pool.ThreadCount() * 4));
+
+    _pool.ParallelFor(Count(), grain, [this, actions, observations, ram, done](u32 index)
+    {
+        Instance& instance = *_instances[index];
+        instance.controller->SetButtons(actions[index]);
+
+        // Only the last frame is drawn
+        bool ended = false;
+        for (u32 frame = 0; frame < _frameSkip && !ended; frame++)
+        {
+            bool last = frame + 1 == _frameSkip;
+            instance.nes->DoFrame(last ? instance.screen.data() : nullptr, NES_FRAME_NO_AUDIO | (last ? 0 : NES_FRAME_NO_RENDER));
+            instance.episodeFrames++;
+            ended = EpisodeDone(instance);
+        }
+
+        if (ended)
+        {
+            ResetInstance(index);
+        }
+
+        if (done != nullptr)
+        {
+            done[index] = ended ? 1 : 0;
+        }
+        WriteObservation(index, observations, ram);
+    });
+}
+
+void VecEnv::ResetInstance(u32 index)
+{
+    Instance& instance = *_instances[index];
+    instance.start.Rewind();
+    instance.nes->LoadState(instance.start);
+
+    instance.controller->SetButtons(0);
+    instance.nes->DoFrame(instance.screen.data(), NES_FRAME_NO_AUDIO);
+    instance.episodeFrames = 0;
+}
+
+bool VecEnv::EpisodeDone(Instance& instance)
+{
+    if (_maxEpisodeFrames != 0 && instance.episodeFrames >= _maxEpisodeFrames)
+    {
+        return true;
+    }
+
+    return _doneMask != 0 && (instance.nes->PeekRam(_doneAddress) & _doneMask) == _doneValue;
+}
+
+void VecEnv::WriteObservation(u32 index, u8* observations, u8* ram)
+{
+    Instance& instance = *_instances[index];
+
+    if (observations != nullptr)
+    {
+        const u8* screen = instance.screen.data();
+        u8* out = observations + (size_t)index * ObservationSize();
+        u32 shift = _downsample == 4 ? 4 : _downsample == 2 ? 2 : 0;
+
+        for (u32 y = 0; y < _height; y++)
+        {
+            for (u32 x = 0; x < _width; x++)
+            {
+                // Sum the block of screen pixels, the screen is RGBA
+                u32 r = 0;
+                u32 g = 0;
+                u32 b = 0;
+                for (u32 dy = 0; dy < _downsample; dy++)
+                {
+                    const u8* pixel = screen + ((y * _downsample + dy) * ScreenWidth + x * _downsample) * 4;
+                    for (u32 dx = 0; dx < _downsample; dx++, pixel += 4)
+                    {
+                        r += pixel[0];
+                        g += pixel[1];
+                        b += pixel[2];
+                    }
+                }
+                r >>= shift;
+                g >>= shift;
+                b >>= shift;
+
+                if (_channels == 1)
+                {
+                    *out++ = (u8)((r * 77 + g * 150 + b * 29) >> 8);
+                }
+                else
+                {
+                    *out++ = (u8)r;
+                    *out++ = (u8)g;
+                    *out++ = (u8)b;
+                }
+            }
+        }
+    }
+
+    if (ram != nullptr)
+    {
+        u8* out = ram + (size_t)index * _ramAddresses.size();
+        for (u16 addr : _ramAddresses)
+        {
+            *out++ = instance.nes->PeekRam(addr);
+        }
+    }
+}
\ No newline at end of file
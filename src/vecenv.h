@@ -0,0 +1,73 @@
+#pragma once
+
+#include "../include/nes_api.h"
+#include "threadpool.h"
+
+class Nes;
+
+// Many instances of one game stepped together, for training agents.
+// A step runs every instance for frameSkip frames with its action held down
+// and writes the observations straight into the caller's buffers. Instances
+// are spread over a thread pool and everything they need is allocated up
+// front, so a step doesn't allocate per instance.
+// An episode starts from the start state (the state file or power on) plus
+// one frame with nothing pressed, which gives its first observation. An
+// instance whose episode ends is reset during the same step and the
+// observation it returns is the new episode's first.
+class VecEnv : public NesObject
+{
+private:
+    struct Instance
+    {
+        NPtr<Nes> nes;
+        IStandardController* controller;
+        MemoryStream start;
+        u32 episodeFrames;
+        std::vector<u8> screen;
+    };
+
+    VecEnv(const NesVecEnvConfig& config);
+
+public:
+    virtual ~VecEnv();
+
+public:
+    DELEGATE_NESOBJECT_REFCOUNTING();
+
+    static bool Create(const NesVecEnvConfig& config, VecEnv** env);
+
+    u32 Count() { return (u32)_instances.size(); }
+
+    // Bytes of observation per instance
+    u32 ObservationSize() { return _width * _height * _channels; }
+
+    // Start a new episode on every instance.
+    // observations: Count() * ObservationSize() bytes
+    // ram: Count() * ramAddressCount bytes, may be null
+    void Reset(u8* observations, u8* ram);
+
+    // actions: one NesButtons byte per instance
+    // done: one byte per instance, set to 1 where an episode ended, may be null
+    void Step(const u8* actions, u8* observations, u8* ram, u8* done);
+
+private:
+    bool Init(const char* romPath, const char* statePath);
+    void ResetInstance(u32 index);
+    bool EpisodeDone(Instance& instance);
+    void WriteObservation(u32 index, u8* observations, u8* ram);
+
+private:
+    WorkStealingPool _pool;
+    std::vector<std::unique_ptr<Instance>> _instances;
+
+    u32 _frameSkip;
+    u32 _downsample;
+    u32 _width;
+    u32 _height;
+    u32 _channels;
+    std::vector<u16> _ramAddresses;
+    u32 _maxEpisodeFrames;
+    u16 _doneAddress;
+    u8 _doneMask;
+    u8 _doneValue;
+};
\ No newline at end of file
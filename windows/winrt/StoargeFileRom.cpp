@@ -47,6 +47,16 @@ bool StorageFileRom::GetSaveGameStream(IWriteStream** stream)
 }
 
 bool StorageFileRom::GetLoadGameStream(IReadStream** stream)
+{
+    return false;
+}
+
+bool StorageFileRom::GetSaveStateStream(IWriteStream** stream)
+{
+    return false;
+}
+
+bool StorageFileRom::GetLoadStateStream(IReadStream** stream)
 {
     return false;
 }
\ No newline at end of file
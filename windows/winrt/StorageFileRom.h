@@ -41,6 +41,8 @@ public:
     bool GetRomFileStream(IReadStream** stream);
     bool GetSaveGameStream(IWriteStream** stream);
     bool GetLoadGameStream(IReadStream** stream);
+    bool GetSaveStateStream(IWriteStream** stream);
+    bool GetLoadStateStream(IReadStream** stream);
 
 private:
     Windows::Storage::StorageFile^ _romFile;
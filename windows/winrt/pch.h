@@ -4,6 +4,8 @@
 #include <collection.h>
 #include <ppltasks.h>
 #include <xaudio2.h>
+#include <iostream>
+#include <vector>
 using namespace concurrency;
 
 
@@ -12,6 +14,7 @@ using namespace concurrency;
 #include "..\..\include\object.h"
 #include "..\..\include\nptr.h"
 #include "..\..\src\types.h"
+#include "..\..\src\util.h"
 #include "..\..\src\nes.h"
 
 #define IfFailRet(HR) do { hr = (HR); if (FAILED(hr)) return hr; } while (false)